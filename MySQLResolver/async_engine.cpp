@@ -0,0 +1,526 @@
+#include "async_engine.h"
+#include "codec.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+#include <pxr/base/tf/fileUtils.h>
+#include <pxr/base/tf/pathUtils.h>
+
+#include <errmsg.h>
+#include <my_global.h>
+#include <my_sys.h>
+#include <mysql.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+constexpr double INVALID_TIME = std::numeric_limits<double>::lowest();
+constexpr int MAX_EVENTS = 64;
+
+using mutex_scoped_lock = std::lock_guard<std::mutex>;
+using steady_clock = std::chrono::steady_clock;
+} // namespace
+
+namespace usd_sql {
+// A nonblocking connection and the download in flight on it. Every call
+// into the client library either completes right away or returns the
+// events to wait for, resume continues it once they happened.
+struct AsyncEngine::Connection {
+    MYSQL* connection = nullptr;
+    bool connected = false;
+    bool busy = false; // a job is in flight
+    bool closed = false;
+    int socket = -1; // registered with epoll
+    std::function<int(int)> resume;
+    std::function<void()> completed;
+    bool has_deadline = false;
+    steady_clock::time_point deadline;
+
+    // results of the pending call
+    MYSQL* connect_ret = nullptr;
+    int query_ret = 0;
+    MYSQL_RES* result = nullptr;
+
+    Job job;
+    std::string escaped_path;
+    std::string query;
+    std::string temp_path;
+    std::fstream file;
+    std::unique_ptr<Decoder> decoder;
+    unsigned long long written = 0; // decoded bytes in the file
+    unsigned long long offset = 0;
+    unsigned long long data_length = 0;
+    double timestamp = INVALID_TIME;
+};
+
+AsyncEngine::AsyncEngine(
+    const std::string& server_name, const std::string& server_user,
+    const std::string& server_password, const std::string& server_db,
+    unsigned int server_port, const std::string& table_name,
+    const std::string& encoding_column, size_t max_connections,
+    size_t chunk_size)
+    : server_name(server_name),
+      server_user(server_user),
+      server_password(server_password),
+      server_db(server_db),
+      server_port(server_port),
+      table_name(table_name),
+      encoding_column(encoding_column.empty() ? "NULL" : encoding_column),
+      max_connections(max_connections),
+      chunk_size(chunk_size),
+      stopping(false),
+      epoll_fd(epoll_create1(EPOLL_CLOEXEC)),
+      event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event);
+    thread = std::thread(&AsyncEngine::run, this);
+}
+
+AsyncEngine::~AsyncEngine() {
+    {
+        mutex_scoped_lock sc(queue_mutex);
+        stopping = true;
+    }
+    wake();
+    thread.join();
+    ::close(event_fd);
+    ::close(epoll_fd);
+}
+
+void AsyncEngine::fetch(
+    const std::string& asset_path, const std::string& local_path,
+    Callback callback) {
+    {
+        mutex_scoped_lock sc(queue_mutex);
+        queue.push_back(Job{asset_path, local_path, std::move(callback)});
+    }
+    wake();
+}
+
+void AsyncEngine::wake() {
+    const uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) < 0) {
+        TF_DEBUG(USD_URI_RESOLVER).Msg("AsyncEngine::wake: write failed\n");
+    }
+}
+
+bool AsyncEngine::take_job(Job& job) {
+    mutex_scoped_lock sc(queue_mutex);
+    if (queue.empty() || stopping) { return false; }
+    job = std::move(queue.front());
+    queue.pop_front();
+    return true;
+}
+
+void AsyncEngine::run() {
+    my_thread_init();
+    epoll_event events[MAX_EVENTS];
+    while (true) {
+        size_t pending = 0;
+        {
+            mutex_scoped_lock sc(queue_mutex);
+            if (stopping) { break; }
+            pending = queue.size();
+        }
+        // hand queued jobs to idle connections, then open more connections
+        // up to the limit for the rest
+        for (size_t i = 0; i < connections.size() && pending > 0; ++i) {
+            auto& connection = *connections[i];
+            if (connection.connected && !connection.busy) {
+                --pending;
+                start_next(connection);
+            }
+        }
+        size_t connecting = std::count_if(
+            connections.begin(), connections.end(),
+            [](const std::unique_ptr<Connection>& connection) {
+                return !connection->connected && !connection->closed;
+            });
+        while (pending > connecting && connections.size() < max_connections) {
+            connections.emplace_back(new Connection());
+            ++connecting;
+            open(*connections.back());
+        }
+
+        int timeout = -1;
+        auto now = steady_clock::now();
+        for (const auto& connection : connections) {
+            if (!connection->has_deadline) { continue; }
+            const auto remaining =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    connection->deadline - now)
+                    .count();
+            const int ms = static_cast<int>(std::max<long long>(remaining, 0));
+            timeout = timeout < 0 ? ms : std::min(timeout, ms);
+        }
+
+        const int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t value = 0;
+                while (read(event_fd, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+            auto& connection = *static_cast<Connection*>(events[i].data.ptr);
+            if (connection.closed) { continue; }
+            if (!connection.resume) {
+                // an idle connection has nothing to read unless the server
+                // closed it
+                close(connection);
+                continue;
+            }
+            int ready = 0;
+            if (events[i].events & EPOLLIN) { ready |= MYSQL_WAIT_READ; }
+            if (events[i].events & EPOLLOUT) { ready |= MYSQL_WAIT_WRITE; }
+            if (events[i].events & EPOLLPRI) { ready |= MYSQL_WAIT_EXCEPT; }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                ready |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+            }
+            resume(connection, ready);
+        }
+
+        now = steady_clock::now();
+        for (size_t i = 0; i < connections.size(); ++i) {
+            auto& connection = *connections[i];
+            if (!connection.closed && connection.has_deadline &&
+                connection.deadline <= now) {
+                resume(connection, MYSQL_WAIT_TIMEOUT);
+            }
+        }
+        connections.erase(
+            std::remove_if(
+                connections.begin(), connections.end(),
+                [](const std::unique_ptr<Connection>& connection) {
+                    return connection->closed;
+                }),
+            connections.end());
+    }
+
+    for (auto& connection : connections) {
+        if (connection->busy) { finish(*connection, false); }
+        close(*connection);
+    }
+    connections.clear();
+    std::deque<Job> unfinished;
+    {
+        mutex_scoped_lock sc(queue_mutex);
+        unfinished.swap(queue);
+    }
+    for (const auto& job : unfinished) { job.callback(false, 0, 1.0); }
+    my_thread_end();
+}
+
+void AsyncEngine::open(Connection& connection) {
+    TF_DEBUG(USD_URI_RESOLVER)
+        .Msg(
+            "AsyncEngine::open: opening connection %zu to %s\n",
+            connections.size(), server_name.c_str());
+    connection.connection = mysql_init(nullptr);
+    if (connection.connection == nullptr) {
+        connection.closed = true;
+        return;
+    }
+    mysql_options(connection.connection, MYSQL_OPT_NONBLOCK, nullptr);
+    const int status = mysql_real_connect_start(
+        &connection.connect_ret, connection.connection, server_name.c_str(),
+        server_user.c_str(), server_password.c_str(), server_db.c_str(),
+        server_port, nullptr, 0);
+    call(
+        connection, status,
+        [&connection](int ready) {
+            return mysql_real_connect_cont(
+                &connection.connect_ret, connection.connection, ready);
+        },
+        [this, &connection]() {
+            if (connection.connect_ret != nullptr) {
+                connection.connected = true;
+                start_next(connection);
+                return;
+            }
+            TF_WARN(
+                "[SQLResolver] Failed to connect to: %s\nReason: %s",
+                server_name.c_str(), mysql_error(connection.connection));
+            close(connection);
+            // without any connection the queued jobs would wait forever
+            const bool usable = std::any_of(
+                connections.begin(), connections.end(),
+                [](const std::unique_ptr<Connection>& other) {
+                    return !other->closed;
+                });
+            if (usable) { return; }
+            std::deque<Job> failed;
+            {
+                mutex_scoped_lock sc(queue_mutex);
+                failed.swap(queue);
+            }
+            for (const auto& job : failed) { job.callback(false, 0, 1.0); }
+        });
+}
+
+void AsyncEngine::close(Connection& connection) {
+    if (connection.socket != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.socket, nullptr);
+        connection.socket = -1;
+    }
+    if (connection.connection != nullptr) {
+        mysql_close(connection.connection);
+        connection.connection = nullptr;
+    }
+    connection.connected = false;
+    connection.closed = true;
+    connection.has_deadline = false;
+    connection.resume = nullptr;
+    connection.completed = nullptr;
+}
+
+// Run completed once the call that returned status finished, calling
+// resume whenever the events it waits for happened
+void AsyncEngine::call(
+    Connection& connection, int status, std::function<int(int)> resume,
+    std::function<void()> completed) {
+    if (status == 0) {
+        completed();
+        return;
+    }
+    connection.resume = std::move(resume);
+    connection.completed = std::move(completed);
+    wait(connection, status);
+}
+
+void AsyncEngine::wait(Connection& connection, int status) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if (status & MYSQL_WAIT_READ) { event.events |= EPOLLIN; }
+    if (status & MYSQL_WAIT_WRITE) { event.events |= EPOLLOUT; }
+    if (status & MYSQL_WAIT_EXCEPT) { event.events |= EPOLLPRI; }
+    event.data.ptr = &connection;
+    // the socket is only known once connecting started
+    const int socket = mysql_get_socket(connection.connection);
+    if (socket != connection.socket) {
+        if (connection.socket != -1) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection.socket, nullptr);
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &event);
+        connection.socket = socket;
+    } else {
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, socket, &event);
+    }
+    connection.has_deadline = (status & MYSQL_WAIT_TIMEOUT) != 0;
+    if (connection.has_deadline) {
+        connection.deadline =
+            steady_clock::now() +
+            std::chrono::milliseconds(
+                mysql_get_timeout_value_ms(connection.connection));
+    }
+}
+
+void AsyncEngine::resume(Connection& connection, int ready) {
+    connection.has_deadline = false;
+    const int status = connection.resume(ready);
+    if (status != 0) {
+        wait(connection, status);
+        return;
+    }
+    // stop watching the socket until the next call waits for it, errors
+    // and hangups are still reported
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.ptr = &connection;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.socket, &event);
+    auto completed = std::move(connection.completed);
+    connection.resume = nullptr;
+    connection.completed = nullptr;
+    completed();
+}
+
+// Start the next queued job on an idle connection
+void AsyncEngine::start_next(Connection& connection) {
+    Job job;
+    while (take_job(job)) {
+        connection.busy = true;
+        connection.job = std::move(job);
+        connection.decoder.reset();
+        connection.written = 0;
+        connection.offset = 0;
+        connection.data_length = 0;
+        connection.timestamp = INVALID_TIME;
+
+        const auto& local_path = connection.job.local_path;
+        const auto local_dir = TfGetPathName(local_path);
+        connection.temp_path = local_path + ".XXXXXX";
+        if (!TfIsDir(local_dir) && !TfMakeDirs(local_dir) &&
+            !TfIsDir(local_dir)) {
+            finish(connection, false);
+            continue;
+        }
+        const int fd = mkstemp(&connection.temp_path[0]);
+        if (fd == -1) {
+            finish(connection, false);
+            continue;
+        }
+        ::close(fd);
+        connection.file.open(
+            connection.temp_path,
+            std::ios::out | std::ios::binary | std::ios::trunc);
+
+        const auto& asset_path = connection.job.asset_path;
+        std::vector<char> escaped(asset_path.size() * 2 + 1);
+        const auto length = mysql_real_escape_string(
+            connection.connection, escaped.data(), asset_path.c_str(),
+            asset_path.size());
+        connection.escaped_path.assign(escaped.data(), length);
+        query_chunk(connection);
+        return;
+    }
+    connection.busy = false;
+}
+
+void AsyncEngine::query_chunk(Connection& connection) {
+    connection.query = "SELECT SUBSTRING(data, " +
+                       std::to_string(connection.offset + 1) + ", " +
+                       std::to_string(chunk_size) +
+                       "), LENGTH(data), UNIX_TIMESTAMP(timestamp), " +
+                       encoding_column + " FROM " + table_name +
+                       " WHERE path = '" + connection.escaped_path +
+                       "' LIMIT 1";
+    const int status = mysql_real_query_start(
+        &connection.query_ret, connection.connection,
+        connection.query.c_str(), connection.query.size());
+    call(
+        connection, status,
+        [&connection](int ready) {
+            return mysql_real_query_cont(
+                &connection.query_ret, connection.connection, ready);
+        },
+        [this, &connection]() {
+            if (connection.query_ret != 0) {
+                TF_WARN(
+                    "[SQLResolver] Error executing query: %s\nError code: "
+                    "%i\nError string: %s",
+                    connection.query.c_str(),
+                    mysql_errno(connection.connection),
+                    mysql_error(connection.connection));
+                // the next connection is opened for the queued jobs
+                finish(connection, false);
+                close(connection);
+                return;
+            }
+            const int status = mysql_store_result_start(
+                &connection.result, connection.connection);
+            call(
+                connection, status,
+                [&connection](int ready) {
+                    return mysql_store_result_cont(
+                        &connection.result, connection.connection, ready);
+                },
+                [this, &connection]() { read_chunk(connection); });
+        });
+}
+
+// Write a chunk to the file and query the next one, or finish the job
+void AsyncEngine::read_chunk(Connection& connection) {
+    if (connection.result == nullptr) {
+        TF_WARN(
+            "[SQLResolver] Error reading result: %s\nError string: %s",
+            connection.query.c_str(), mysql_error(connection.connection));
+        finish(connection, false);
+        close(connection);
+        return;
+    }
+    bool success = false;
+    bool more = false;
+    const auto row = mysql_fetch_row(connection.result);
+    if (row != nullptr && row[0] != nullptr) {
+        const auto lengths = mysql_fetch_lengths(connection.result);
+        const double timestamp =
+            row[2] == nullptr ? INVALID_TIME : atof(row[2]);
+        connection.data_length =
+            row[1] == nullptr ? 0 : strtoull(row[1], nullptr, 10);
+        if (connection.offset == 0) {
+            connection.timestamp = timestamp;
+            const std::string encoding =
+                row[3] == nullptr ? "" : std::string(row[3], lengths[3]);
+            connection.decoder = create_decoder(encoding);
+            if (connection.decoder == nullptr) {
+                TF_WARN(
+                    "[SQLResolver] %s has unsupported encoding '%s', "
+                    "supported: %s",
+                    connection.job.asset_path.c_str(), encoding.c_str(),
+                    supported_encodings().c_str());
+            }
+        }
+        auto& file = connection.file;
+        auto& written = connection.written;
+        const Sink write = [&file, &written](const char* data, size_t size) {
+            file.write(data, size);
+            written += size;
+            return file.good();
+        };
+        if (connection.decoder == nullptr) {
+            // unsupported encoding, warned above
+        } else if (timestamp != connection.timestamp) {
+            TF_DEBUG(USD_URI_RESOLVER)
+                .Msg("AsyncEngine::read_chunk: data changed while fetching\n");
+        } else if (connection.decoder->write(row[0], lengths[0], write)) {
+            connection.offset += lengths[0];
+            if (connection.offset >= connection.data_length ||
+                lengths[0] == 0) {
+                // an empty asset is a single empty chunk
+                success = connection.offset == connection.data_length &&
+                          connection.decoder->finish();
+            } else {
+                more = true;
+            }
+        } else {
+            TF_DEBUG(USD_URI_RESOLVER)
+                .Msg("AsyncEngine::read_chunk: failed decoding data\n");
+        }
+    }
+    mysql_free_result(connection.result);
+    connection.result = nullptr;
+    if (more) {
+        query_chunk(connection);
+        return;
+    }
+    finish(connection, success);
+    start_next(connection);
+}
+
+void AsyncEngine::finish(Connection& connection, bool success) {
+    if (connection.file.is_open()) {
+        connection.file.close();
+        success = success && !connection.file.fail();
+    }
+    connection.file.clear();
+    connection.decoder.reset();
+    auto& job = connection.job;
+    success = success && rename(
+                             connection.temp_path.c_str(),
+                             job.local_path.c_str()) == 0;
+    if (!success) { remove(connection.temp_path.c_str()); }
+    TF_DEBUG(USD_URI_RESOLVER)
+        .Msg(
+            "AsyncEngine::finish: %s %s, %llu bytes, %llu bytes stored\n",
+            job.asset_path.c_str(), success ? "fetched" : "failed",
+            connection.offset, connection.written);
+    const double timestamp =
+        connection.timestamp == INVALID_TIME ? 1.0 : connection.timestamp;
+    const auto callback = std::move(job.callback);
+    job = Job();
+    connection.busy = false;
+    callback(success, connection.written, timestamp);
+}
+} // namespace usd_sql
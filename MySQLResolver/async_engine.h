@@ -0,0 +1,83 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace usd_sql {
+// Downloads assets over nonblocking connections, using the nonblocking API
+// of MariaDB Connector/C. A single thread drives every connection from an
+// epoll loop, so many downloads are in flight without a thread blocked in
+// each query. Only built when the client library has the nonblocking API,
+// see USD_SQL_ASYNC.
+class AsyncEngine {
+public:
+    // Called on the engine thread once a download finished. On success the
+    // decoded data is at the local path, along with its size and the
+    // timestamp of the row.
+    using Callback = std::function<void(
+        bool success, unsigned long long size, double timestamp)>;
+
+    AsyncEngine(
+        const std::string& server_name, const std::string& server_user,
+        const std::string& server_password, const std::string& server_db,
+        unsigned int server_port, const std::string& table_name,
+        const std::string& encoding_column, size_t max_connections,
+        size_t chunk_size);
+    // Jobs not finished yet are reported as failed
+    ~AsyncEngine();
+
+    // Queue the download of an asset to local_path, in chunks of chunk_size
+    // bytes like SQLServer::fetch_data
+    void fetch(
+        const std::string& asset_path, const std::string& local_path,
+        Callback callback);
+
+private:
+    struct Job {
+        std::string asset_path;
+        std::string local_path;
+        Callback callback;
+    };
+    struct Connection;
+
+    void run();
+    void wake();
+    bool take_job(Job& job);
+    void open(Connection& connection);
+    void close(Connection& connection);
+    void call(
+        Connection& connection, int status, std::function<int(int)> resume,
+        std::function<void()> completed);
+    void wait(Connection& connection, int status);
+    void resume(Connection& connection, int ready);
+    void start_next(Connection& connection);
+    void query_chunk(Connection& connection);
+    void read_chunk(Connection& connection);
+    void finish(Connection& connection, bool success);
+
+    std::string server_name;
+    std::string server_user;
+    std::string server_password;
+    std::string server_db;
+    unsigned int server_port;
+    std::string table_name;
+    std::string encoding_column; // NULL if the table has none
+    size_t max_connections;
+    size_t chunk_size;
+
+    std::mutex queue_mutex;
+    std::deque<Job> queue;
+    bool stopping;
+
+    int epoll_fd;
+    int event_fd; // wakes the loop for new jobs and stopping
+    // only used on the engine thread
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::thread thread;
+};
+} // namespace usd_sql
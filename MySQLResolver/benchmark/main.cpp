@@ -0,0 +1,318 @@
+#include "sql.h"
+
+#include <errmsg.h>
+#include <my_global.h>
+#include <my_sys.h>
+#include <mysql.h>
+
+#include <benchmark/benchmark.h>
+
+#include <z85/z85.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Query throughput of the MySQL resolver versus thread count, against the
+// server in USD_SQL_DBHOST, using the usual USD_SQL_* settings to connect.
+// The benchmark table is filled with small assets on startup.
+//
+// USD_SQL_BENCH_TABLE   - table holding the generated assets (usd_sql_bench)
+// USD_SQL_BENCH_ASSETS  - number of assets /bench/asset_#####.usda (1000)
+// USD_SQL_BENCH_THREADS - highest thread count to measure (16)
+// USD_SQL_BENCH_CACHED_THREADS - highest thread count of the cache hit
+//                                benchmark (64)
+
+namespace {
+std::string server_name;
+std::string table_name;
+std::string cache_path;
+std::vector<std::string> assets;
+
+std::string get_env_var(
+    const std::string& server_name, const std::string& env_var,
+    const std::string& default_value) {
+    const auto env_first = getenv((server_name + "_" + env_var).c_str());
+    if (env_first != nullptr) { return env_first; }
+    const auto env_second = getenv(env_var.c_str());
+    if (env_second != nullptr) { return env_second; }
+    return default_value;
+}
+
+int get_env_int(const char* env_var, int default_value) {
+    return atoi(
+        get_env_var(server_name, env_var, std::to_string(default_value))
+            .c_str());
+}
+
+MYSQL* connect() {
+    my_thread_init();
+    auto connection = mysql_init(nullptr);
+    const auto password = z85::decode_with_padding(get_env_var(
+        server_name, usd_sql::PASSWORD_ENV_VAR,
+        z85::encode_with_padding(std::string("12345678"))));
+    const auto port = static_cast<unsigned int>(atoi(
+        get_env_var(server_name, usd_sql::PORT_ENV_VAR, "3306").c_str()));
+    if (mysql_real_connect(
+            connection, server_name.c_str(),
+            get_env_var(server_name, usd_sql::USER_ENV_VAR, "root").c_str(),
+            password.c_str(),
+            get_env_var(server_name, usd_sql::DB_ENV_VAR, "usd").c_str(),
+            port, nullptr, 0) == nullptr) {
+        std::cerr << "Failed to connect to " << server_name << ": "
+                  << mysql_error(connection) << std::endl;
+        mysql_close(connection);
+        return nullptr;
+    }
+    return connection;
+}
+
+bool query(MYSQL* connection, const std::string& text) {
+    if (mysql_real_query(connection, text.c_str(), text.size()) != 0) {
+        std::cerr << "Error executing query: " << text << "\n"
+                  << mysql_error(connection) << std::endl;
+        return false;
+    }
+    auto result = mysql_store_result(connection);
+    if (result != nullptr) { mysql_free_result(result); }
+    return true;
+}
+
+// Create the benchmark table and fill it with small layers
+bool generate_assets(int count) {
+    auto connection = connect();
+    if (connection == nullptr) { return false; }
+    bool success = query(
+        connection, "CREATE TABLE IF NOT EXISTS " + table_name +
+                        " (path VARCHAR(255) PRIMARY KEY, data LONGBLOB, "
+                        "timestamp TIMESTAMP DEFAULT CURRENT_TIMESTAMP ON "
+                        "UPDATE CURRENT_TIMESTAMP)");
+    char name[64];
+    for (int i = 0; success && i < count; ++i) {
+        snprintf(name, sizeof(name), "/bench/asset_%05d.usda", i);
+        assets.push_back(name);
+        success = query(
+            connection, "INSERT IGNORE INTO " + table_name +
+                            " (path, data) VALUES ('" + name +
+                            "', '#usda 1.0\\n')");
+    }
+    mysql_close(connection);
+    return success;
+}
+
+// Text protocol query built per call, the way the resolver used to query
+void BM_TextQuery(benchmark::State& state) {
+    auto connection = connect();
+    if (connection == nullptr) {
+        state.SkipWithError("could not connect");
+        return;
+    }
+    size_t i = state.thread_index();
+    char text[4096];
+    for (auto _ : state) {
+        snprintf(
+            text, sizeof(text),
+            "SELECT timestamp FROM %s WHERE path = '%s' LIMIT 1",
+            table_name.c_str(), assets[i++ % assets.size()].c_str());
+        if (mysql_real_query(connection, text, strlen(text)) != 0) {
+            state.SkipWithError(mysql_error(connection));
+            break;
+        }
+        auto result = mysql_store_result(connection);
+        benchmark::DoNotOptimize(mysql_fetch_row(result));
+        mysql_free_result(result);
+    }
+    state.SetItemsProcessed(state.iterations());
+    mysql_close(connection);
+}
+
+// The same query as a prepared statement, executed in the binary protocol
+void BM_PreparedQuery(benchmark::State& state) {
+    auto connection = connect();
+    if (connection == nullptr) {
+        state.SkipWithError("could not connect");
+        return;
+    }
+    const std::string text =
+        "SELECT timestamp FROM " + table_name + " WHERE path = ? LIMIT 1";
+    auto statement = mysql_stmt_init(connection);
+    if (mysql_stmt_prepare(statement, text.c_str(), text.size()) != 0) {
+        state.SkipWithError(mysql_stmt_error(statement));
+        mysql_stmt_close(statement);
+        mysql_close(connection);
+        return;
+    }
+    MYSQL_BIND param;
+    memset(&param, 0, sizeof(param));
+    unsigned long path_length = 0;
+    param.buffer_type = MYSQL_TYPE_STRING;
+    param.length = &path_length;
+    MYSQL_BIND result;
+    memset(&result, 0, sizeof(result));
+    MYSQL_TIME time;
+    result.buffer_type = MYSQL_TYPE_TIMESTAMP;
+    result.buffer = &time;
+
+    size_t i = state.thread_index();
+    for (auto _ : state) {
+        const auto& asset = assets[i++ % assets.size()];
+        param.buffer = const_cast<char*>(asset.data());
+        param.buffer_length = path_length = asset.size();
+        if (mysql_stmt_bind_param(statement, &param) != 0 ||
+            mysql_stmt_execute(statement) != 0 ||
+            mysql_stmt_bind_result(statement, &result) != 0) {
+            state.SkipWithError(mysql_stmt_error(statement));
+            break;
+        }
+        benchmark::DoNotOptimize(mysql_stmt_fetch(statement));
+        mysql_stmt_free_result(statement);
+    }
+    state.SetItemsProcessed(state.iterations());
+    mysql_stmt_close(statement);
+    mysql_close(connection);
+}
+
+usd_sql::SQL& get_sql() {
+    static usd_sql::SQL sql;
+    return sql;
+}
+
+// Resolve and query the timestamp of assets through the resolver, which
+// shares a pool of connections between the threads
+void BM_ResolverTimestamp(benchmark::State& state) {
+    size_t i = state.thread_index();
+    for (auto _ : state) {
+        const auto path =
+            std::string(usd_sql::SQL_PREFIX) + assets[i++ % assets.size()];
+        get_sql().resolve_name(path);
+        benchmark::DoNotOptimize(get_sql().get_timestamp(path));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Resolve cached assets only, no queries, which measures the contention of
+// the resolve path between threads
+void BM_ResolveCached(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        std::vector<std::string> paths;
+        for (const auto& asset : assets) {
+            paths.push_back(usd_sql::SQL_PREFIX + asset);
+        }
+        get_sql().resolve_names(paths);
+    }
+    size_t i = state.thread_index();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(get_sql().resolve_name(
+            usd_sql::SQL_PREFIX + assets[i++ % assets.size()]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Resolve every asset with a cold cache, one query per asset
+void BM_ResolveAll(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        get_sql().clear();
+        state.ResumeTiming();
+        for (const auto& asset : assets) {
+            benchmark::DoNotOptimize(
+                get_sql().resolve_name(usd_sql::SQL_PREFIX + asset));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * assets.size());
+}
+
+// The same with the batch API, one query per USD_SQL_BATCH_SIZE assets
+void BM_ResolveAllBatched(benchmark::State& state) {
+    std::vector<std::string> paths;
+    for (const auto& asset : assets) {
+        paths.push_back(usd_sql::SQL_PREFIX + asset);
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        get_sql().clear();
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(get_sql().resolve_names(paths));
+    }
+    state.SetItemsProcessed(state.iterations() * assets.size());
+}
+
+// Fetch every asset with a cold cache, all of them in flight at once
+void BM_FetchAllAsync(benchmark::State& state) {
+    std::vector<std::string> paths;
+    for (const auto& asset : assets) {
+        paths.push_back(usd_sql::SQL_PREFIX + asset);
+    }
+    const auto index_path = cache_path + "/" + server_name + "/" +
+                            table_name + "/" + usd_sql::INDEX_FILE_NAME;
+    for (auto _ : state) {
+        state.PauseTiming();
+        get_sql().clear();
+        remove(index_path.c_str());
+        get_sql().resolve_names(paths);
+        state.ResumeTiming();
+        std::vector<std::future<bool>> fetches;
+        for (const auto& path : paths) {
+            fetches.push_back(get_sql().fetch_async(path));
+        }
+        size_t failed = 0;
+        for (auto& fetch : fetches) { failed += fetch.get() ? 0 : 1; }
+        if (failed > 0) {
+            state.SkipWithError("fetch failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * assets.size());
+}
+
+void register_benchmark(
+    const char* name, void (*function)(benchmark::State&), int max_threads) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        benchmark::RegisterBenchmark(name, function)
+            ->Threads(threads)
+            ->UseRealTime();
+    }
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto host = getenv(usd_sql::HOST_ENV_VAR);
+    if (host == nullptr) {
+        std::cerr << "Set " << usd_sql::HOST_ENV_VAR
+                  << " to the server to benchmark" << std::endl;
+        return 1;
+    }
+    server_name = host;
+    my_init();
+    table_name =
+        get_env_var(server_name, "USD_SQL_BENCH_TABLE", "usd_sql_bench");
+    if (!generate_assets(get_env_int("USD_SQL_BENCH_ASSETS", 1000))) {
+        return 1;
+    }
+    // the resolver reads the same table
+    setenv(usd_sql::TABLE_ENV_VAR, table_name.c_str(), 1);
+    // fetched assets go to a cache of their own
+    char cache_template[] = "/tmp/usd_sql_bench_XXXXXX";
+    if (mkdtemp(cache_template) == nullptr) { return 1; }
+    cache_path = cache_template;
+    setenv(usd_sql::CACHE_PATH_ENV_VAR, cache_path.c_str(), 1);
+    const int max_threads = get_env_int("USD_SQL_BENCH_THREADS", 16);
+
+    register_benchmark("timestamp/text", BM_TextQuery, max_threads);
+    register_benchmark("timestamp/prepared", BM_PreparedQuery, max_threads);
+    register_benchmark("resolver/timestamp", BM_ResolverTimestamp, max_threads);
+    register_benchmark(
+        "resolver/resolve_cached", BM_ResolveCached,
+        get_env_int("USD_SQL_BENCH_CACHED_THREADS", 64));
+    register_benchmark("resolver/resolve_all", BM_ResolveAll, 1);
+    register_benchmark("resolver/resolve_all_batched", BM_ResolveAllBatched, 1);
+    register_benchmark("resolver/fetch_all_async", BM_FetchAllAsync, 1);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) { return 1; }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
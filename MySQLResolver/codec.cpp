@@ -0,0 +1,238 @@
+#include "codec.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifdef USD_SQL_ZSTD
+#include <zstd.h>
+#endif // USD_SQL_ZSTD
+
+#ifdef USD_SQL_LZ4
+#include <lz4frame.h>
+#endif // USD_SQL_LZ4
+
+namespace {
+using usd_sql::Decoder;
+using usd_sql::Encoder;
+using usd_sql::Sink;
+
+class RawDecoder : public Decoder {
+public:
+    bool write(const char* data, size_t size, const Sink& sink) override {
+        return sink(data, size);
+    }
+    bool finish() override { return true; }
+};
+
+class RawEncoder : public Encoder {
+public:
+    bool write(const char* data, size_t size, const Sink& sink) override {
+        return sink(data, size);
+    }
+    bool finish(const Sink&) override { return true; }
+};
+
+#ifdef USD_SQL_ZSTD
+class ZstdDecoder : public Decoder {
+public:
+    ZstdDecoder()
+        : stream(ZSTD_createDStream()),
+          buffer(ZSTD_DStreamOutSize()),
+          frame_done(true) {
+        ZSTD_initDStream(stream);
+    }
+    ~ZstdDecoder() override { ZSTD_freeDStream(stream); }
+
+    bool write(const char* data, size_t size, const Sink& sink) override {
+        ZSTD_inBuffer input{data, size, 0};
+        bool output_full = false;
+        while (input.pos < input.size || output_full) {
+            ZSTD_outBuffer output{buffer.data(), buffer.size(), 0};
+            const auto ret = ZSTD_decompressStream(stream, &output, &input);
+            if (ZSTD_isError(ret)) { return false; }
+            if (output.pos > 0 && !sink(buffer.data(), output.pos)) {
+                return false;
+            }
+            frame_done = ret == 0;
+            output_full = output.pos == output.size;
+        }
+        return true;
+    }
+    bool finish() override { return frame_done; }
+
+private:
+    ZSTD_DStream* stream;
+    std::vector<char> buffer;
+    bool frame_done;
+};
+
+class ZstdEncoder : public Encoder {
+public:
+    ZstdEncoder(int level)
+        : stream(ZSTD_createCStream()), buffer(ZSTD_CStreamOutSize()) {
+        ZSTD_initCStream(stream, level);
+    }
+    ~ZstdEncoder() override { ZSTD_freeCStream(stream); }
+
+    bool write(const char* data, size_t size, const Sink& sink) override {
+        ZSTD_inBuffer input{data, size, 0};
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output{buffer.data(), buffer.size(), 0};
+            const auto ret = ZSTD_compressStream(stream, &output, &input);
+            if (ZSTD_isError(ret)) { return false; }
+            if (output.pos > 0 && !sink(buffer.data(), output.pos)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool finish(const Sink& sink) override {
+        size_t remaining = 0;
+        do {
+            ZSTD_outBuffer output{buffer.data(), buffer.size(), 0};
+            remaining = ZSTD_endStream(stream, &output);
+            if (ZSTD_isError(remaining)) { return false; }
+            if (output.pos > 0 && !sink(buffer.data(), output.pos)) {
+                return false;
+            }
+        } while (remaining > 0);
+        return true;
+    }
+
+private:
+    ZSTD_CStream* stream;
+    std::vector<char> buffer;
+};
+#endif // USD_SQL_ZSTD
+
+#ifdef USD_SQL_LZ4
+constexpr size_t LZ4_BLOCK = 64 * 1024;
+
+class Lz4Decoder : public Decoder {
+public:
+    Lz4Decoder() : context(nullptr), buffer(LZ4_BLOCK), frame_done(true) {
+        LZ4F_createDecompressionContext(&context, LZ4F_VERSION);
+    }
+    ~Lz4Decoder() override { LZ4F_freeDecompressionContext(context); }
+
+    bool write(const char* data, size_t size, const Sink& sink) override {
+        size_t position = 0;
+        bool output_full = false;
+        while (position < size || output_full) {
+            size_t output_size = buffer.size();
+            size_t input_size = size - position;
+            const auto ret = LZ4F_decompress(
+                context, buffer.data(), &output_size, data + position,
+                &input_size, nullptr);
+            if (LZ4F_isError(ret)) { return false; }
+            position += input_size;
+            if (output_size > 0 && !sink(buffer.data(), output_size)) {
+                return false;
+            }
+            frame_done = ret == 0;
+            output_full = output_size == buffer.size();
+            if (input_size == 0 && output_size == 0) { break; }
+        }
+        return true;
+    }
+    bool finish() override { return frame_done; }
+
+private:
+    LZ4F_dctx* context;
+    std::vector<char> buffer;
+    bool frame_done;
+};
+
+class Lz4Encoder : public Encoder {
+public:
+    Lz4Encoder(int level) : context(nullptr), preferences(), started(false) {
+        LZ4F_createCompressionContext(&context, LZ4F_VERSION);
+        preferences.compressionLevel = level;
+        buffer.resize(LZ4F_compressBound(LZ4_BLOCK, &preferences) +
+                      LZ4F_HEADER_SIZE_MAX);
+    }
+    ~Lz4Encoder() override { LZ4F_freeCompressionContext(context); }
+
+    bool write(const char* data, size_t size, const Sink& sink) override {
+        if (!begin(sink)) { return false; }
+        for (size_t position = 0; position < size; position += LZ4_BLOCK) {
+            const auto ret = LZ4F_compressUpdate(
+                context, buffer.data(), buffer.size(), data + position,
+                std::min(LZ4_BLOCK, size - position), nullptr);
+            if (LZ4F_isError(ret)) { return false; }
+            if (ret > 0 && !sink(buffer.data(), ret)) { return false; }
+        }
+        return true;
+    }
+    bool finish(const Sink& sink) override {
+        if (!begin(sink)) { return false; }
+        const auto ret =
+            LZ4F_compressEnd(context, buffer.data(), buffer.size(), nullptr);
+        return !LZ4F_isError(ret) && sink(buffer.data(), ret);
+    }
+
+private:
+    bool begin(const Sink& sink) {
+        if (started) { return true; }
+        started = true;
+        const auto ret = LZ4F_compressBegin(
+            context, buffer.data(), buffer.size(), &preferences);
+        return !LZ4F_isError(ret) && sink(buffer.data(), ret);
+    }
+
+    LZ4F_cctx* context;
+    LZ4F_preferences_t preferences;
+    std::vector<char> buffer;
+    bool started;
+};
+#endif // USD_SQL_LZ4
+} // namespace
+
+namespace usd_sql {
+std::unique_ptr<Decoder> create_decoder(const std::string& encoding) {
+    if (encoding.empty() || encoding == "raw") {
+        return std::unique_ptr<Decoder>(new RawDecoder());
+    }
+#ifdef USD_SQL_ZSTD
+    if (encoding == "zstd") {
+        return std::unique_ptr<Decoder>(new ZstdDecoder());
+    }
+#endif // USD_SQL_ZSTD
+#ifdef USD_SQL_LZ4
+    if (encoding == "lz4") {
+        return std::unique_ptr<Decoder>(new Lz4Decoder());
+    }
+#endif // USD_SQL_LZ4
+    return nullptr;
+}
+
+std::unique_ptr<Encoder> create_encoder(
+    const std::string& encoding, int level) {
+    if (encoding.empty() || encoding == "raw") {
+        return std::unique_ptr<Encoder>(new RawEncoder());
+    }
+#ifdef USD_SQL_ZSTD
+    if (encoding == "zstd") {
+        return std::unique_ptr<Encoder>(new ZstdEncoder(level));
+    }
+#endif // USD_SQL_ZSTD
+#ifdef USD_SQL_LZ4
+    if (encoding == "lz4") {
+        return std::unique_ptr<Encoder>(new Lz4Encoder(level));
+    }
+#endif // USD_SQL_LZ4
+    static_cast<void>(level);
+    return nullptr;
+}
+
+std::string supported_encodings() {
+    std::string encodings = "raw";
+#ifdef USD_SQL_ZSTD
+    encodings += " zstd";
+#endif // USD_SQL_ZSTD
+#ifdef USD_SQL_LZ4
+    encodings += " lz4";
+#endif // USD_SQL_LZ4
+    return encodings;
+}
+} // namespace usd_sql
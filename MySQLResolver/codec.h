@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace usd_sql {
+// Receives the decoded or encoded bytes, returns false to stop
+using Sink = std::function<bool(const char* data, size_t size)>;
+
+// Streaming codecs for the data of assets, named by the encoding column of
+// the table. The empty encoding and "raw" store the data as is, "zstd" and
+// "lz4" (frame format) are available when the build found the libraries.
+class Decoder {
+public:
+    virtual ~Decoder() = default;
+    // Decode the next piece of the data. Returns false if the data is
+    // corrupt or the sink stopped.
+    virtual bool write(const char* data, size_t size, const Sink& sink) = 0;
+    // Returns false if the data ended in the middle of a frame
+    virtual bool finish() = 0;
+};
+
+class Encoder {
+public:
+    virtual ~Encoder() = default;
+    // Encode the next piece of the data. Returns false if the sink stopped.
+    virtual bool write(const char* data, size_t size, const Sink& sink) = 0;
+    // Flush the end of the encoded data
+    virtual bool finish(const Sink& sink) = 0;
+};
+
+// Return nullptr for encodings this build doesn't support
+std::unique_ptr<Decoder> create_decoder(const std::string& encoding);
+// The level is passed to the library, 0 picks its default
+std::unique_ptr<Encoder> create_encoder(const std::string& encoding, int level);
+
+// The encodings this build supports, separated by spaces
+std::string supported_encodings();
+} // namespace usd_sql
@@ -2,13 +2,16 @@
 
 #include <pxr/base/tf/pathUtils.h>
 
+#include <pxr/usd/ar/asset.h>
 #include <pxr/usd/ar/assetInfo.h>
 #include <pxr/usd/ar/resolverContext.h>
 
 #include <pxr/usd/ar/defaultResolver.h>
 #include <pxr/usd/ar/defineResolver.h>
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <map>
 #include <memory>
@@ -29,7 +32,37 @@ PXR_NAMESPACE_OPEN_SCOPE
 
 namespace {
 usd_sql::SQL g_sql;
-}
+
+#ifdef USD_SQL_OPEN_ASSET
+// The data of an asset fetched into memory, shared with the resolver cache
+// and every layer reading it
+class SQLMemoryAsset : public ArAsset {
+public:
+    explicit SQLMemoryAsset(std::shared_ptr<const std::vector<char>> data)
+        : data(std::move(data)) {}
+
+    size_t GetSize() override { return data->size(); }
+
+    std::shared_ptr<const char> GetBuffer() override {
+        return std::shared_ptr<const char>(data, data->data());
+    }
+
+    size_t Read(void* buffer, size_t count, size_t offset) override {
+        if (offset >= data->size()) { return 0; }
+        const auto read = std::min(count, data->size() - offset);
+        memcpy(buffer, data->data() + offset, read);
+        return read;
+    }
+
+    std::pair<FILE*, size_t> GetFileUnsafe() override {
+        return std::make_pair(nullptr, 0);
+    }
+
+private:
+    std::shared_ptr<const std::vector<char>> data;
+};
+#endif // USD_SQL_OPEN_ASSET
+} // namespace
 
 AR_DEFINE_RESOLVER(URIResolver, ArResolver)
 
@@ -89,4 +122,14 @@ bool URIResolver::FetchToLocalResolvedPath(
     return !g_sql.matches_schema(path) || g_sql.fetch_asset(path);
 }
 
+#ifdef USD_SQL_OPEN_ASSET
+std::shared_ptr<ArAsset> URIResolver::OpenAsset(
+    const std::string& resolvedPath) {
+    auto data = g_sql.open_buffer(resolvedPath);
+    return data == nullptr
+               ? ArDefaultResolver::OpenAsset(resolvedPath)
+               : std::make_shared<SQLMemoryAsset>(std::move(data));
+}
+#endif // USD_SQL_OPEN_ASSET
+
 PXR_NAMESPACE_CLOSE_SCOPE
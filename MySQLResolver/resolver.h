@@ -39,6 +39,12 @@ public:
 
     bool FetchToLocalResolvedPath(
         const std::string& path, const std::string& resolvedPath) override;
+
+#ifdef USD_SQL_OPEN_ASSET
+    // Serves assets the SQL resolver keeps in memory without a local file
+    std::shared_ptr<ArAsset> OpenAsset(
+        const std::string& resolvedPath) override;
+#endif // USD_SQL_OPEN_ASSET
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
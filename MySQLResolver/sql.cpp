@@ -1,20 +1,42 @@
 #include "sql.h"
+#include "cache_engine.h"
+#include "codec.h"
 #include "debugCodes.h"
 
+#ifdef USD_SQL_ASYNC
+#include "async_engine.h"
+#endif // USD_SQL_ASYNC
+
 #include <pxr/base/tf/diagnosticLite.h>
+#include <pxr/base/tf/fileUtils.h>
+#include <pxr/base/tf/pathUtils.h>
+#include <pxr/base/tf/stringUtils.h>
 
 #include <errmsg.h>
 #include <my_global.h>
 #include <my_sys.h>
 #include <mysql.h>
 
-#include <time.h>
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <locale>
+#include <memory>
+#include <thread>
+#include <set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <z85/z85.hpp>
 
@@ -71,6 +93,7 @@ namespace {
 constexpr double INVALID_TIME = std::numeric_limits<double>::lowest();
 
 using mutex_scoped_lock = std::lock_guard<std::mutex>;
+using steady_clock = std::chrono::steady_clock;
 
 // Otherwise clang static analyser will throw errors.
 template <size_t len>
@@ -78,20 +101,20 @@ constexpr size_t cexpr_strlen(const char (&)[len]) {
     return len - 1;
 }
 
-std::string generate_name(
-    const std::string& base, const std::string& extension, char* buffer) {
-    std::tmpnam(buffer);
-    std::string ret(buffer);
-    const auto last_slash = ret.find_last_of('/');
-    if (last_slash == std::string::npos) {
-        return base + ret + extension;
-    } else {
-        return base + ret.substr(last_slash + 1) + extension;
-    }
-}
-
 thread_local std::once_flag thread_flag;
 
+// The server a thread looked up last, reused while the host and the
+// generation of the servers stay the same. The reference keeps a server
+// removed by clear alive until the thread looks up another one.
+struct ServerLookup {
+    size_t generation = 0;
+    std::string server_name;
+    std::shared_ptr<usd_sql::SQLServer> server;
+};
+thread_local ServerLookup last_lookup;
+// every SQL instance and every clear starts a new generation
+std::atomic<size_t> next_generation(1);
+
 void sql_thread_init() {
     std::call_once(thread_flag, []() { my_thread_init(); });
 }
@@ -107,17 +130,17 @@ std::string get_env_var(
 }
 
 template <
-    typename key_t, typename value_t, value_t default_value = value_t(),
+    typename key_t, typename value_t,
     typename pair_t = std::pair<key_t, value_t>>
 value_t find_in_sorted_vector(
     const std::vector<pair_t>& vec, const key_t& key) {
     const auto ret = std::lower_bound(
-        vec.begin(), vec.end(), pair_t{key, default_value},
+        vec.begin(), vec.end(), pair_t{key, value_t()},
         [](const pair_t& a, const pair_t& b) { return a.first < b.first; });
     if (ret != vec.end() && ret->first == key) {
         return ret->second;
     } else {
-        return default_value;
+        return value_t();
     }
 }
 
@@ -132,117 +155,227 @@ std::string parse_path(const std::string& path) {
     }
 }
 
-double convert_char_to_time(const char* raw_time) {
-    // GCC 4.8 doesn't have the get_time function of C++11
-    std::tm parsed_time = {};
-    strptime(raw_time, "%Y-%m-%d %H:%M:%S", &parsed_time);
-    parsed_time.tm_isdst = 0;
-    // I have to set daylight savings to 0
-    // for the asctime function to match the actual time
-    // even without that, the parsed times will be consistent, so
-    // probably it won't cause any issues
-    return mktime(&parsed_time);
+void bind_string(
+    MYSQL_BIND& bind, const std::string& value, unsigned long& length) {
+    memset(&bind, 0, sizeof(bind));
+    length = value.size();
+    bind.buffer_type = MYSQL_TYPE_STRING;
+    bind.buffer = const_cast<char*>(value.data());
+    bind.buffer_length = length;
+    bind.length = &length;
 }
 
-double convert_mysql_result_to_time(
-    MYSQL_FIELD* field, MYSQL_ROW row, size_t field_i) {
-    auto ret = INVALID_TIME;
+void bind_longlong(MYSQL_BIND& bind, unsigned long long& value) {
+    memset(&bind, 0, sizeof(bind));
+    bind.buffer_type = MYSQL_TYPE_LONGLONG;
+    bind.buffer = &value;
+    bind.is_unsigned = 1;
+}
 
-    if (!row) {
-        SQL_WARN("[SQLResolver] row was null");
-    } else if (!field) {
-        SQL_WARN(
-            "[SQLResolver] could not find the field type to retrieve a "
-            "timestamp");
-    } else if (field->type != MYSQL_TYPE_TIMESTAMP) {
-        SQL_WARN(
-            "[SQLResolver] Wrong type for time field. Found %i instead of 7.",
-            field->type);
-    } else if (row[field_i] == nullptr) {
-        SQL_WARN("[SQLResolver] Field %lu was null", field_i);
-    } else if (field->max_length <= 0) {
-        SQL_WARN("[SQLResolver] Field %lu had 0 length", field_i);
-    } else {
-        ret = convert_char_to_time(row[field_i]);
+// Write all of the buffer to a file at offset
+bool write_at(
+    int fd, const std::vector<char>& buffer, unsigned long long offset) {
+    size_t written = 0;
+    while (written < buffer.size()) {
+        const auto ret = pwrite(
+            fd, buffer.data() + written, buffer.size() - written,
+            static_cast<off_t>(offset + written));
+        if (ret < 0 && errno == EINTR) { continue; }
+        if (ret <= 0) { return false; }
+        written += static_cast<size_t>(ret);
     }
-    return ret;
+    return true;
 }
 
-double get_timestamp_raw(
-    MYSQL* connection, const std::string& table_name,
-    const std::string& asset_path) {
-    MYSQL_RES* result = nullptr;
-    constexpr size_t query_max_length = 4096;
-    char query[query_max_length];
-    snprintf(
-        query, query_max_length,
-        "SELECT timestamp FROM %s WHERE path = '%s' LIMIT 1",
-        table_name.c_str(), asset_path.c_str());
-    unsigned long query_length = strlen(query);
-    TF_DEBUG(USD_URI_RESOLVER).Msg("get_timestamp_raw: query:\n%s\n", query);
-    const auto query_ret = mysql_real_query(connection, query, query_length);
-    // I only have to flush when there is a successful query.
-    if (query_ret != 0) {
-        SQL_WARN(
-            "[SQLResolver] Error executing query: %s\nError code: %i\nError "
-            "string: %s",
-            query, mysql_errno(connection), mysql_error(connection));
-    } else {
-        result = mysql_store_result(connection);
-    }
+// Errors after which the connection is gone, rather than the query wrong
+bool is_connection_error(unsigned int error) {
+    return error == CR_CONNECTION_ERROR || error == CR_CONN_HOST_ERROR ||
+           error == CR_SERVER_GONE_ERROR || error == CR_SERVER_LOST;
+}
+
+// Write data to path through a temporary file, so other processes sharing
+// the cache never see a partial copy
+bool write_file(const std::string& path, const std::vector<char>& data) {
+    const auto dir = TfGetPathName(path);
+    if (!TfIsDir(dir) && !TfMakeDirs(dir) && !TfIsDir(dir)) { return false; }
+    std::string temp_path = path + ".XXXXXX";
+    const int fd = mkstemp(&temp_path[0]);
+    if (fd == -1) { return false; }
+    bool success = write_at(fd, data, 0);
+    success = close(fd) == 0 && success;
+    success = success && rename(temp_path.c_str(), path.c_str()) == 0;
+    if (!success) { remove(temp_path.c_str()); }
+    return success;
+}
 
-    auto ret = INVALID_TIME;
+void bind_double(MYSQL_BIND& bind, double& value, my_bool& is_null) {
+    memset(&bind, 0, sizeof(bind));
+    bind.buffer_type = MYSQL_TYPE_DOUBLE;
+    bind.buffer = &value;
+    bind.is_null = &is_null;
+}
+} // namespace
 
-    if (result != nullptr) {
-        if (mysql_num_rows(result) == 1) {
-            auto row = mysql_fetch_row(result);
-            assert(mysql_num_fields(result) == 1);
-            auto field = mysql_fetch_field(result);
-            ret = convert_mysql_result_to_time(field, row, 0);
-            if (ret == INVALID_TIME) {
-                TF_DEBUG(USD_URI_RESOLVER)
-                    .Msg("get_timestamp_raw: failed to convert timestamp\n");
-            } else {
+namespace usd_sql {
+// The data of fetched assets kept in memory instead of at their local path,
+// up to budget bytes for all servers. Assets larger than asset_limit are
+// never kept. The least recently opened assets are spilled to their local
+// path to make room, so they are found on disk from then on.
+class MemoryStore {
+public:
+    using Buffer = std::shared_ptr<const std::vector<char>>;
+
+    MemoryStore(size_t budget, size_t asset_limit)
+        : budget(budget), asset_limit(std::min(budget, asset_limit)) {}
+
+    bool fits(unsigned long long size) const { return size <= asset_limit; }
+
+    // Keep the data of the asset at local_path, replacing an older version.
+    // Returns false if it doesn't fit, the caller writes it to disk then.
+    bool insert(const std::string& local_path, Buffer data) {
+        if (!fits(data->size())) { return false; }
+        // the victims are written before they are dropped, so they are
+        // found either in memory or on disk at any time
+        std::vector<std::pair<std::string, Buffer>> victims;
+        {
+            mutex_scoped_lock sc(mutex);
+            // an older version of the asset is replaced, not spilled
+            const auto previous = entries.find(local_path);
+            size_t freed = previous == entries.end()
+                               ? 0
+                               : previous->second.first->size();
+            for (auto it = lru.rbegin();
+                 it != lru.rend() && used - freed + data->size() > budget;
+                 ++it) {
+                if (*it == local_path) { continue; }
+                const auto& victim = entries[*it].first;
+                victims.emplace_back(*it, victim);
+                freed += victim->size();
+            }
+        }
+        for (const auto& victim : victims) {
+            if (!write_file(victim.first, *victim.second)) {
                 TF_DEBUG(USD_URI_RESOLVER)
-                    .Msg("get_timestamp_raw: got: %f\n", ret);
+                    .Msg(
+                        "MemoryStore::insert: failed to spill %s\n",
+                        victim.first.c_str());
+            }
+        }
+
+        mutex_scoped_lock sc(mutex);
+        for (const auto& victim : victims) {
+            const auto entry = entries.find(victim.first);
+            if (entry != entries.end() &&
+                entry->second.first == victim.second) {
+                remove(entry);
             }
         }
-        mysql_free_result(result);
+        const auto entry = entries.find(local_path);
+        if (entry != entries.end()) { remove(entry); }
+        lru.push_front(local_path);
+        used += data->size();
+        entries.emplace(local_path, std::make_pair(data, lru.begin()));
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "MemoryStore::insert: %s, %zu bytes, %zu bytes in use\n",
+                local_path.c_str(), data->size(), used);
+        return true;
     }
-    return ret;
-}
-} // namespace
 
-namespace usd_sql {
+    // Drop the data of an asset that was written to disk again
+    void erase(const std::string& local_path) {
+        mutex_scoped_lock sc(mutex);
+        const auto entry = entries.find(local_path);
+        if (entry != entries.end()) { remove(entry); }
+    }
+
+    // Returns nullptr if the asset isn't kept in memory
+    Buffer find(const std::string& local_path) {
+        mutex_scoped_lock sc(mutex);
+        const auto entry = entries.find(local_path);
+        if (entry == entries.end()) { return nullptr; }
+        lru.splice(lru.begin(), lru, entry->second.second);
+        return entry->second.first;
+    }
+
+    void clear() {
+        mutex_scoped_lock sc(mutex);
+        entries.clear();
+        lru.clear();
+        used = 0;
+    }
+
+private:
+    using Entries = std::map<
+        std::string, std::pair<Buffer, std::list<std::string>::iterator>>;
+
+    void remove(Entries::iterator entry) {
+        used -= entry->second.first->size();
+        lru.erase(entry->second.second);
+        entries.erase(entry);
+    }
+
+    size_t budget;
+    size_t asset_limit;
+    std::mutex mutex;
+    Entries entries;
+    std::list<std::string> lru; // most recently opened first
+    size_t used = 0;
+};
+
+// A single connection to a server. The MySQL API only allows one query in
+// flight per connection, so each one is used by one thread at a time,
+// leased from the pool of its SQLServer.
 struct SQLConnection {
-    enum CacheState { CACHE_MISSING, CACHE_NEEDS_FETCHING, CACHE_FETCHED };
-    struct Cache {
-        CacheState state;
-        std::string local_path;
-        double timestamp;
+    // The queries of the resolver run as server side prepared statements,
+    // so the server parses and plans them once per connection, and the
+    // asset path is sent as a bound parameter in the binary protocol.
+    enum Statement {
+        STATEMENT_NOW,
+        STATEMENT_METADATA_BATCH, // batch_size paths, see SQLServer
+        STATEMENT_CHANGES,
+        STATEMENT_FETCH,
+        STATEMENT_CHUNKS, // the chunk table, see SQLServer::fetch_chunked
+        STATEMENT_FETCH_CHUNK,
+        STATEMENT_COUNT
     };
-    std::mutex connection_mutex; // do we actually need this? the api should
-                                 // support multithreaded queries!
-    std::map<std::string, Cache> cached_queries;
-    std::string table_name;
-    std::string cache_path;
-    char tmp_name_buffer[TMP_MAX];
-    MYSQL* connection;
 
-    SQLConnection(const std::string& server_name)
-        : connection(mysql_init(nullptr)) {
-        cache_path = get_env_var(server_name, CACHE_PATH_ENV_VAR, "/tmp/");
-        if (cache_path.back() != '/') { cache_path += "/"; }
-        const auto server_user = get_env_var(server_name, USER_ENV_VAR, "root");
-        const auto compacted_default_pass =
-            z85::encode_with_padding(std::string("12345678"));
-        auto server_password =
-            get_env_var(server_name, PASSWORD_ENV_VAR, compacted_default_pass);
-        server_password = z85::decode_with_padding(server_password);
-        const auto server_db = get_env_var(server_name, DB_ENV_VAR, "usd");
-        table_name = get_env_var(server_name, TABLE_ENV_VAR, "headers");
-        const auto server_port = static_cast<unsigned int>(
-            atoi(get_env_var(server_name, PORT_ENV_VAR, "3306").c_str()));
+    MYSQL* connection;
+    std::string queries[STATEMENT_COUNT];
+    MYSQL_STMT* statements[STATEMENT_COUNT];
+    size_t host = 0; // index in SQLServer::hosts
+    bool failed = false; // lost the connection, see SQLServer::release
+    double latency = 0; // seconds of the last execution
+
+    SQLConnection(
+        const std::string& server_name, const std::string& server_user,
+        const std::string& server_password, const std::string& server_db,
+        unsigned int server_port, const std::string& table_name,
+        const std::string& chunk_table, const std::string& encoding_column,
+        size_t batch_size)
+        : connection(mysql_init(nullptr)), statements() {
+        queries[STATEMENT_NOW] = "SELECT UNIX_TIMESTAMP()";
+        queries[STATEMENT_METADATA_BATCH] =
+            "SELECT path, UNIX_TIMESTAMP(timestamp), LENGTH(data) FROM " +
+            table_name + " WHERE path IN (?";
+        for (size_t i = 1; i < batch_size; ++i) {
+            queries[STATEMENT_METADATA_BATCH] += ",?";
+        }
+        queries[STATEMENT_METADATA_BATCH] += ")";
+        queries[STATEMENT_CHANGES] =
+            "SELECT path, UNIX_TIMESTAMP(timestamp), LENGTH(data) FROM " +
+            table_name + " WHERE timestamp >= FROM_UNIXTIME(?)";
+        queries[STATEMENT_FETCH] =
+            "SELECT SUBSTRING(data, ?, ?), LENGTH(data), "
+            "UNIX_TIMESTAMP(timestamp), " +
+            (encoding_column.empty() ? "NULL" : encoding_column) + " FROM " +
+            table_name + " WHERE path = ? LIMIT 1";
+        queries[STATEMENT_CHUNKS] =
+            "SELECT chunk_index, LENGTH(chunk_data) FROM " + chunk_table +
+            " WHERE path = ? ORDER BY chunk_index";
+        queries[STATEMENT_FETCH_CHUNK] =
+            "SELECT chunk_data FROM " + chunk_table +
+            " WHERE path = ? AND chunk_index = ?";
         // Turn on auto-reconnect
         // Note that it IS still possible for the reconnect to fail, and we
         // don't do any explicit check for this; experimented with also adding
@@ -262,10 +395,10 @@ struct SQLConnection {
             server_password.c_str(), server_db.c_str(), server_port, nullptr,
             0);
         if (ret == nullptr) {
-            mysql_close(connection);
             SQL_WARN(
                 "[SQLResolver] Failed to connect to: %s\nReason: %s",
                 server_name.c_str(), mysql_error(connection));
+            mysql_close(connection);
             connection = nullptr;
         }
 #if SESSION_WAIT_TIMEOUT > 0
@@ -285,306 +418,1506 @@ struct SQLConnection {
     }
 
     ~SQLConnection() {
-        for (const auto& cache : cached_queries) {
-            if (cache.second.state == CACHE_FETCHED) {
-                auto local_path = cache.second.local_path.c_str();
+        close_statements();
+        if (connection != nullptr) { mysql_close(connection); }
+    }
+
+    void close_statements() {
+        for (auto& statement : statements) {
+            if (statement != nullptr) {
+                mysql_stmt_close(statement);
+                statement = nullptr;
+            }
+        }
+    }
+
+    // Statements are prepared on first use
+    MYSQL_STMT* get_statement(Statement statement) {
+        if (statements[statement] != nullptr) { return statements[statement]; }
+        const auto& query = queries[statement];
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLConnection::get_statement: preparing:\n%s\n",
+                query.c_str());
+        auto prepared = mysql_stmt_init(connection);
+        if (prepared == nullptr) {
+            SQL_WARN(
+                "[SQLResolver] Error creating statement: %s\nError code: "
+                "%i\nError string: %s",
+                query.c_str(), mysql_errno(connection),
+                mysql_error(connection));
+            return nullptr;
+        }
+        if (mysql_stmt_prepare(prepared, query.c_str(), query.size()) != 0) {
+            warn(prepared, statement);
+            mysql_stmt_close(prepared);
+            return nullptr;
+        }
+        statements[statement] = prepared;
+        return prepared;
+    }
+
+    // Execute a statement with its parameters bound. Prepared statements are
+    // lost when the connection is reestablished, so a failed execution is
+    // retried once with the statements prepared again.
+    MYSQL_STMT* execute(Statement statement, MYSQL_BIND* params) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            auto prepared = get_statement(statement);
+            if (prepared == nullptr) {
+                failed = failed || is_connection_error(mysql_errno(connection));
+                return nullptr;
+            }
+            const auto started = steady_clock::now();
+            if (mysql_stmt_bind_param(prepared, params) == 0 &&
+                mysql_stmt_execute(prepared) == 0) {
+                latency = std::chrono::duration<double>(
+                              steady_clock::now() - started)
+                              .count();
+                return prepared;
+            }
+            if (attempt > 0) {
+                warn(prepared, statement);
+            } else {
                 TF_DEBUG(USD_URI_RESOLVER)
                     .Msg(
-                        "SQLConnection::~SQLConnection: removing local path: "
-                        "%s\n",
-                        local_path);
-                remove(local_path);
+                        "SQLConnection::execute: preparing statements again "
+                        "after: %s\n",
+                        mysql_stmt_error(prepared));
+                close_statements();
+                mysql_ping(connection);
             }
         }
-        mysql_close(connection);
+        return nullptr;
     }
 
-    std::string resolve_name(const std::string& asset_path) {
+    void warn(MYSQL_STMT* prepared, Statement statement) {
+        failed = failed || is_connection_error(mysql_stmt_errno(prepared));
+        SQL_WARN(
+            "[SQLResolver] Error executing query: %s\nError code: "
+            "%i\nError string: %s",
+            queries[statement].c_str(), mysql_stmt_errno(prepared),
+            mysql_stmt_error(prepared));
+    }
+};
+
+using usd_cache::CACHE_FETCHED;
+using usd_cache::CACHE_FETCHING;
+using usd_cache::CACHE_MISSING;
+using usd_cache::CACHE_NEEDS_FETCHING;
+using Cache = usd_cache::Entry;
+
+// SQL rows have no etag, the etag of an entry tags the assets whose data is
+// NULL and stored in the chunk table instead, so the index keeps it too
+constexpr const char CHUNKED_TAG[] = "chunked";
+
+// Everything related to one server: a pool of up to max_connections
+// connections, opened on demand, and the cache of the assets resolved on
+// the server. The server is the backend of its cache engine, which never
+// holds its lock during a query, so cache hits don't wait for queries in
+// flight on other threads. The engine doesn't revalidate on its own, the
+// cached metadata is kept current by sync.
+struct SQLServer {
+
+    // Existence, timestamp and size of an asset
+    struct Metadata {
+        bool exists;
+        double timestamp;
+        unsigned long long size;
+        bool chunked; // the data is NULL, see is_chunked
+    };
+
+    // The primary or a read replica answering the queries, guarded by
+    // pool_mutex
+    struct Host {
+        std::string name;
+        unsigned int port;
+        std::vector<std::unique_ptr<SQLConnection>> idle_connections;
+        size_t open_connections;
+        size_t leased;  // connections in use
+        double latency; // moving average of the query time, in seconds
+        steady_clock::time_point down_until; // not used before, if failed
+    };
+
+    // Which hosts a lease may use. Reads go to any host, the change
+    // detection goes to the primary, as a lagging replica would make the
+    // sync miss changes.
+    enum Route { ROUTE_ANY, ROUTE_PRIMARY };
+
+    // Returns a connection to the pool when going out of scope
+    class Lease {
+    public:
+        Lease(SQLServer& server, Route route = ROUTE_ANY)
+            : server(server),
+              route(route),
+              connection(server.acquire(route)),
+              failovers(0) {}
+        ~Lease() {
+            if (connection != nullptr) {
+                server.release(std::move(connection));
+            }
+        }
+        explicit operator bool() const { return connection != nullptr; }
+        SQLConnection& operator*() const { return *connection; }
+        SQLConnection* operator->() const { return connection.get(); }
+
+        // After a query failed because the connection was lost, continue
+        // on another host. Returns false if the query failed for another
+        // reason or there is no other host left to try.
+        bool failover() {
+            if (connection == nullptr || !connection->failed ||
+                ++failovers >= server.hosts.size()) {
+                return false;
+            }
+            server.release(std::move(connection));
+            connection = server.acquire(route);
+            return connection != nullptr;
+        }
+
+    private:
+        SQLServer& server;
+        Route route;
+        std::unique_ptr<SQLConnection> connection;
+        size_t failovers;
+    };
+
+    std::string server_name;
+    std::string server_user;
+    std::string server_password;
+    std::string server_db;
+    unsigned int server_port;
+    std::string table_name;
+    std::string chunk_table; // assets without data are stored here
+    std::string encoding_column; // names the codec of the data, see codec.h
+    std::string cache_root;
+    // shared by the servers, which may outlive SQL, may be nullptr
+    std::shared_ptr<MemoryStore> memory_store;
+
+    std::mutex pool_mutex;
+    std::condition_variable pool_released;
+    std::vector<Host> hosts; // the primary first, then the replicas
+    steady_clock::duration host_retry; // time a failed host is avoided
+    size_t max_connections; // per host
+    size_t fetch_chunk_size;
+    steady_clock::duration freshness; // time between syncs
+    size_t batch_size;                 // paths per metadata query
+    steady_clock::duration batch_window;
+
+    std::unique_ptr<usd_cache::CacheEngine<SQLServer>> cache;
+    std::atomic<size_t> max_path_length; // of the cached assets
+
+    // The cached metadata is brought up to date by sync, guarded by
+    // sync_mutex
+    std::mutex sync_mutex;
+    std::condition_variable sync_finished;
+    bool syncing;
+    steady_clock::time_point synced; // last time the metadata was current
+    double sync_mark; // rows changed at or after this were not synced yet
+    double sync_window; // seconds a sync reaches back before the mark
+
+    // Resolves of assets missing from the cache are combined into batches,
+    // see resolve_batched
+    std::mutex batch_mutex;
+    std::condition_variable batch_changed;
+    std::vector<std::string> batch_paths; // of the batch being collected
+    bool batch_collecting;
+    size_t batch_id; // of the batch being collected
+    std::set<size_t> batches_in_flight;
+
+    // The fetches of fetch_async the async engine doesn't take and the
+    // chunks of fetch_chunked, run by up to max_connections workers started
+    // on demand, guarded by fetch_mutex. The workers initialise the client
+    // library once and live as long as the server. A job is called with
+    // false instead when the server goes away before it ran.
+    using FetchJob = std::function<void(bool run)>;
+    std::mutex fetch_mutex;
+    std::condition_variable fetch_queued;
+    std::deque<FetchJob> fetch_queue;
+    std::vector<std::thread> fetch_workers;
+    bool fetch_stopping;
+
+#ifdef USD_SQL_ASYNC
+    std::mutex engine_mutex;
+    std::unique_ptr<AsyncEngine> engine; // started by the first fetch_async
+#endif // USD_SQL_ASYNC
+
+    SQLServer(
+        const std::string& server_name,
+        const std::shared_ptr<MemoryStore>& memory_store)
+        : server_name(server_name),
+          memory_store(memory_store),
+          max_path_length(0),
+          syncing(false),
+          sync_mark(INVALID_TIME),
+          batch_collecting(false),
+          batch_id(0),
+          fetch_stopping(false) {
+        server_user = get_env_var(server_name, USER_ENV_VAR, "root");
+        const auto compacted_default_pass =
+            z85::encode_with_padding(std::string("12345678"));
+        server_password = z85::decode_with_padding(get_env_var(
+            server_name, PASSWORD_ENV_VAR, compacted_default_pass));
+        server_db = get_env_var(server_name, DB_ENV_VAR, "usd");
+        table_name = get_env_var(server_name, TABLE_ENV_VAR, "headers");
+        chunk_table = get_env_var(server_name, CHUNK_TABLE_ENV_VAR, "");
+        encoding_column =
+            get_env_var(server_name, ENCODING_COLUMN_ENV_VAR, "");
+        server_port = static_cast<unsigned int>(
+            atoi(get_env_var(server_name, PORT_ENV_VAR, "3306").c_str()));
+        max_connections = static_cast<size_t>(std::max(
+            1, atoi(get_env_var(server_name, CONNECTIONS_ENV_VAR, "4")
+                        .c_str())));
+        fetch_chunk_size = static_cast<size_t>(std::max(
+            1024ll, atoll(get_env_var(
+                              server_name, FETCH_CHUNK_SIZE_ENV_VAR, "15728640")
+                              .c_str())));
+        freshness = std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(atof(
+                get_env_var(server_name, FRESHNESS_ENV_VAR, "1").c_str())));
+        sync_window = std::max(
+            0.0,
+            atof(get_env_var(server_name, SYNC_WINDOW_ENV_VAR, "60").c_str()));
+        batch_size = static_cast<size_t>(std::max(
+            1, atoi(get_env_var(server_name, BATCH_SIZE_ENV_VAR, "128")
+                        .c_str())));
+        batch_window = std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(atof(
+                get_env_var(server_name, BATCH_WINDOW_ENV_VAR, "0").c_str())));
+        host_retry = std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(atof(
+                get_env_var(server_name, HOST_RETRY_ENV_VAR, "5").c_str())));
+        hosts.push_back(Host{server_name, server_port, {}, 0, 0, 0, {}});
+        for (const auto& replica : TfStringTokenize(
+                 get_env_var(server_name, REPLICAS_ENV_VAR, ""), ", ")) {
+            const auto colon = replica.rfind(':');
+            hosts.push_back(Host{
+                replica.substr(0, colon),
+                colon == std::string::npos
+                    ? server_port
+                    : static_cast<unsigned int>(
+                          atoi(replica.substr(colon + 1).c_str())),
+                {}, 0, 0, 0, {}});
+        }
+        cache_root = TfNormPath(
+            get_env_var(server_name, CACHE_PATH_ENV_VAR, "/tmp") + "/" +
+            server_name + "/" + table_name);
+        cache.reset(new usd_cache::CacheEngine<SQLServer>(
+            *this, usd_cache::Options{
+                       cache_root, INDEX_FILE_NAME, -1.0,
+                       static_cast<uint64_t>(std::max(
+                           0ll, atoll(get_env_var(
+                                          server_name, CACHE_SIZE_ENV_VAR, "0")
+                                          .c_str()))),
+                       true, 0}));
+        load_index();
+    }
+
+    ~SQLServer() {
+        // the queued fetches fail, the ones in flight finish
+        std::deque<FetchJob> unfinished;
+        {
+            mutex_scoped_lock sc(fetch_mutex);
+            fetch_stopping = true;
+            unfinished.swap(fetch_queue);
+        }
+        fetch_queued.notify_all();
+        for (auto& worker : fetch_workers) { worker.join(); }
+        for (const auto& job : unfinished) { job(false); }
+#ifdef USD_SQL_ASYNC
+        // fails the downloads in flight, which update the cache
+        engine.reset();
+#endif // USD_SQL_ASYNC
+        save_index();
+        const auto metrics = cache->metrics();
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLServer: %llu hits, %llu misses, %llu fetches (%llu "
+                "failed, %llu bytes), %llu changes, %llu evictions\n",
+                static_cast<unsigned long long>(metrics.hits),
+                static_cast<unsigned long long>(metrics.misses),
+                static_cast<unsigned long long>(metrics.fetches),
+                static_cast<unsigned long long>(metrics.fetch_failures),
+                static_cast<unsigned long long>(metrics.fetched_bytes),
+                static_cast<unsigned long long>(metrics.changes),
+                static_cast<unsigned long long>(metrics.evictions));
+    }
+
+#ifdef USD_SQL_ASYNC
+    AsyncEngine& get_engine() {
+        mutex_scoped_lock sc(engine_mutex);
+        if (engine == nullptr) {
+            engine.reset(new AsyncEngine(
+                server_name, server_user, server_password, server_db,
+                server_port, table_name, encoding_column, max_connections,
+                fetch_chunk_size));
+        }
+        return *engine;
+    }
+#endif // USD_SQL_ASYNC
+
+    // Local copies are kept under <cache_path>/<server>/<table>/ at their
+    // asset path, so later processes find them again
+    std::string generate_path(const std::string& asset_path) const {
+        return TfNormPath(cache_root + TfNormPath("/" + asset_path));
+    }
+
+    // Backend of the cache engine, see cache_engine.h. Metadata requests
+    // and listings are left out, changes are found by sync instead.
+    std::string local_path(const std::string& asset_path) const {
+        return generate_path(asset_path);
+    }
+
+    bool get(const std::string& asset_path, Cache& cache) {
+        return fetch_data(asset_path, cache);
+    }
+
+    // Seed the cache with the complete local copies of earlier runs. They
+    // are used right away, the first sync queries the changes since the
+    // mark of the index in one go.
+    void load_index() {
+        const double mark = cache->load_index();
+        if (mark == INVALID_TIME) { return; }
+        size_t entries = 0;
+        size_t longest = 0;
+        cache->for_each([&](const std::string& asset_path, const Cache&) {
+            longest = std::max(longest, asset_path.size());
+            ++entries;
+        });
+        if (entries == 0) { return; }
+        max_path_length = longest;
+        sync_mark = mark;
+        synced = steady_clock::now() - freshness;
         TF_DEBUG(USD_URI_RESOLVER)
-            .Msg("SQLConnection::resolve_name: '%s'\n", asset_path.c_str());
-        if (connection == nullptr) {
+            .Msg("SQLServer::load_index: %zu local copies\n", entries);
+    }
+
+    // Write the fetched assets to the persistent index, merged with the
+    // entries other processes wrote since we loaded it. The merged index
+    // keeps the older of the two marks, so neither misses changes.
+    void save_index() {
+        double mark = INVALID_TIME;
+        {
+            mutex_scoped_lock sc(sync_mutex);
+            mark = sync_mark;
+        }
+        if (mark == INVALID_TIME) { return; }
+        cache->save_index(mark);
+    }
+
+    // The host of the next lease, pool_mutex must be held. Of the hosts
+    // with a free connection, the one with the fewest leases weighted by
+    // its latency is picked. Failed hosts are left out for host_retry, or
+    // until every host failed. Returns hosts.size() if all are busy.
+    size_t pick_host(Route route) const {
+        const auto now = steady_clock::now();
+        const auto has_capacity = [&](const Host& host) {
+            return !host.idle_connections.empty() ||
+                   host.open_connections < max_connections;
+        };
+        const bool all_down = std::all_of(
+            hosts.begin(), hosts.end(),
+            [&](const Host& host) { return host.down_until > now; });
+        if (route == ROUTE_PRIMARY && hosts[0].down_until <= now) {
+            return has_capacity(hosts[0]) ? 0 : hosts.size();
+        }
+        size_t best = hosts.size();
+        double best_score = 0;
+        for (size_t i = 0; i < hosts.size(); ++i) {
+            const auto& host = hosts[i];
+            if (!has_capacity(host) || (!all_down && host.down_until > now)) {
+                continue;
+            }
+            // hosts without a measurement yet are tried first
+            const double score = static_cast<double>(host.leased + 1) *
+                                 std::max(host.latency, 1e-4);
+            if (best == hosts.size() || score < best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+        return best;
+    }
+
+    // Take an idle connection of the host picked by pick_host, open a new
+    // one, or wait for another thread to release one. Hosts that can't be
+    // connected to are marked as failed and the next one is tried. Returns
+    // nullptr if no host could be connected to.
+    std::unique_ptr<SQLConnection> acquire(Route route) {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        for (size_t attempt = 0; attempt < hosts.size(); ++attempt) {
+            size_t index = hosts.size();
+            pool_released.wait(lock, [&]() {
+                index = pick_host(route);
+                return index < hosts.size();
+            });
+            auto& host = hosts[index];
+            ++host.leased;
+            if (!host.idle_connections.empty()) {
+                auto connection = std::move(host.idle_connections.back());
+                host.idle_connections.pop_back();
+                return connection;
+            }
+            const auto count = ++host.open_connections;
+            lock.unlock();
             TF_DEBUG(USD_URI_RESOLVER)
                 .Msg(
-                    "SQLConnection::resolve_name: aborting due to null "
-                    "connection pointer\n");
-            return "";
+                    "SQLServer::acquire: opening connection %zu to %s\n",
+                    count, host.name.c_str());
+            std::unique_ptr<SQLConnection> connection(new SQLConnection(
+                host.name, server_user, server_password, server_db,
+                host.port, table_name, chunk_table, encoding_column,
+                batch_size));
+            connection->host = index;
+            lock.lock();
+            if (connection->connection != nullptr) { return connection; }
+            --host.open_connections;
+            --host.leased;
+            host.down_until = steady_clock::now() + host_retry;
+            // the threads waiting for this host can try another one
+            pool_released.notify_all();
         }
+        return nullptr;
+    }
 
-        const auto last_dot = asset_path.find_last_of('.');
-        if (last_dot == std::string::npos) {
+    // Return a connection to the pool. A connection that was lost marks its
+    // host as failed, and the idle connections to it are closed as well.
+    void release(std::unique_ptr<SQLConnection> connection) {
+        std::vector<std::unique_ptr<SQLConnection>> closed;
+        {
+            mutex_scoped_lock sc(pool_mutex);
+            auto& host = hosts[connection->host];
+            --host.leased;
+            if (connection->latency > 0) {
+                host.latency = host.latency == 0
+                                   ? connection->latency
+                                   : 0.8 * host.latency +
+                                         0.2 * connection->latency;
+                connection->latency = 0;
+            }
+            if (connection->failed) {
+                SQL_WARN(
+                    "[SQLResolver] Lost the connection to %s, avoiding it "
+                    "for a while",
+                    host.name.c_str());
+                host.down_until = steady_clock::now() + host_retry;
+                closed.swap(host.idle_connections);
+                closed.push_back(std::move(connection));
+                host.open_connections -= closed.size();
+            } else {
+                host.idle_connections.push_back(std::move(connection));
+            }
+        }
+        if (closed.empty()) {
+            pool_released.notify_one();
+        } else {
+            pool_released.notify_all();
+        }
+    }
+
+    // Whether the last sync is recent enough, sync_mutex must be held
+    bool synced_recently() const {
+        return steady_clock::now() - synced < freshness;
+    }
+
+    bool is_synced() {
+        mutex_scoped_lock sc(sync_mutex);
+        return synced_recently();
+    }
+
+    // Read the path, timestamp and size rows of an executed statement. The
+    // size, LENGTH(data), is NULL exactly when the data is NULL. Paths longer
+    // than max_length can't be of interest and are skipped.
+    bool read_metadata_rows(
+        SQLConnection& connection, SQLConnection::Statement statement_id,
+        MYSQL_STMT* statement, size_t max_length,
+        std::map<std::string, Metadata>& found) {
+        MYSQL_BIND results[3];
+        std::vector<char> path(max_length + 1);
+        unsigned long path_length = 0;
+        memset(&results[0], 0, sizeof(results[0]));
+        results[0].buffer_type = MYSQL_TYPE_STRING;
+        results[0].buffer = path.data();
+        results[0].buffer_length = path.size();
+        results[0].length = &path_length;
+        Metadata metadata{true, INVALID_TIME, 0, false};
+        my_bool timestamp_is_null = 0;
+        my_bool size_is_null = 0;
+        bind_double(results[1], metadata.timestamp, timestamp_is_null);
+        bind_longlong(results[2], metadata.size);
+        results[2].is_null = &size_is_null;
+        auto fetch_ret = mysql_stmt_bind_result(statement, results) == 0
+                             ? mysql_stmt_fetch(statement)
+                             : 1;
+        while (fetch_ret == 0 || fetch_ret == MYSQL_DATA_TRUNCATED) {
+            if (fetch_ret == 0) {
+                auto& result = found[std::string(path.data(), path_length)];
+                result = metadata;
+                if (timestamp_is_null) { result.timestamp = INVALID_TIME; }
+                result.chunked = size_is_null != 0;
+                if (size_is_null) { result.size = 0; }
+            }
+            fetch_ret = mysql_stmt_fetch(statement);
+        }
+        if (fetch_ret == 1) { connection.warn(statement, statement_id); }
+        mysql_stmt_free_result(statement);
+        return fetch_ret == MYSQL_NO_DATA;
+    }
+
+    // The current time of the server, in seconds since the epoch
+    bool query_now(SQLConnection& connection, double& now) {
+        auto statement =
+            connection.execute(SQLConnection::STATEMENT_NOW, nullptr);
+        if (statement == nullptr) { return false; }
+        MYSQL_BIND result;
+        my_bool is_null = 0;
+        bind_double(result, now, is_null);
+        const auto fetch_ret = mysql_stmt_bind_result(statement, &result) == 0
+                                   ? mysql_stmt_fetch(statement)
+                                   : 1;
+        if (fetch_ret == 1) {
+            connection.warn(statement, SQLConnection::STATEMENT_NOW);
+        }
+        mysql_stmt_free_result(statement);
+        return fetch_ret == 0 && !is_null;
+    }
+
+    // Bring the cached metadata up to date once the last sync is older than
+    // freshness. A single query returns the rows changed since the last
+    // sync, so the cost doesn't grow with the number of cached assets, and
+    // timestamps are answered from the cache in between. Assets with a newer
+    // timestamp are fetched again. Returns false if the query failed.
+    //
+    // A row is only visible once its transaction commits, but its timestamp
+    // is set when it is written, so a row may show up after rows with later
+    // timestamps were synced. The query reaches back sync_window seconds
+    // before the mark for those, rows returned again are left alone by the
+    // cache. Rows committed more than sync_window after their timestamp,
+    // e.g. by longer transactions or read from a replica lagging further
+    // behind, are missed.
+    bool sync() {
+        std::unique_lock<std::mutex> lock(sync_mutex);
+        sync_finished.wait(lock, [&]() { return !syncing; });
+        if (synced_recently() || sync_mark == INVALID_TIME) { return true; }
+        syncing = true;
+        double mark = sync_mark;
+        const size_t max_length = max_path_length;
+        const auto started = steady_clock::now();
+        lock.unlock();
+
+        std::map<std::string, Metadata> changes;
+        bool success = false;
+        {
+            Lease connection(*this, ROUTE_PRIMARY);
+            do {
+                if (!connection) { break; }
+                changes.clear();
+                MYSQL_BIND param;
+                double since = mark - sync_window;
+                my_bool since_is_null = 0;
+                bind_double(param, since, since_is_null);
+                auto statement = connection->execute(
+                    SQLConnection::STATEMENT_CHANGES, &param);
+                success = statement != nullptr &&
+                          read_metadata_rows(
+                              *connection, SQLConnection::STATEMENT_CHANGES,
+                              statement, max_length, changes);
+            } while (!success && connection.failover());
+        }
+
+        lock.lock();
+        syncing = false;
+        if (success) {
             TF_DEBUG(USD_URI_RESOLVER)
                 .Msg(
-                    "SQLConnection::resolve_name: asset path missing extension "
-                    "('%s')\n",
-                    asset_path.c_str());
-            return "";
+                    "SQLServer::sync: %zu assets changed since %f\n",
+                    changes.size(), mark - sync_window);
+            for (const auto& change : changes) {
+                // rows of the window before the mark are returned again
+                mark = std::max(mark, change.second.timestamp);
+                // older rows and assets not cached are left alone, fetched
+                // copies of newer rows are fetched again
+                cache->update(
+                    change.first, change.second.timestamp,
+                    change.second.size,
+                    change.second.chunked ? CHUNKED_TAG : std::string());
+            }
+            sync_mark = mark;
+            synced = started;
         }
-        mutex_scoped_lock sc(connection_mutex);
+        sync_finished.notify_all();
+        return success;
+    }
 
-        const auto cached_result = cached_queries.find(asset_path);
+    // Query the metadata of up to batch_size assets in one round trip.
+    // Assets missing from the table are left out of found.
+    bool query_metadata_batch(
+        SQLConnection& connection,
+        std::vector<std::string>::const_iterator first,
+        std::vector<std::string>::const_iterator last,
+        std::map<std::string, Metadata>& found) {
+        // the statement always takes batch_size paths, the spare
+        // placeholders repeat the last path
+        std::vector<MYSQL_BIND> params(batch_size);
+        std::vector<unsigned long> path_lengths(batch_size);
+        size_t max_length = 0;
+        for (size_t i = 0; i < batch_size; ++i) {
+            const auto& path = first + i < last ? first[i] : last[-1];
+            bind_string(params[i], path, path_lengths[i]);
+            max_length = std::max(max_length, path.size());
+        }
+        auto statement = connection.execute(
+            SQLConnection::STATEMENT_METADATA_BATCH, params.data());
+        const bool success =
+            statement != nullptr &&
+            read_metadata_rows(
+                connection, SQLConnection::STATEMENT_METADATA_BATCH,
+                statement, max_length, found);
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLServer::query_metadata_batch: %zu of %zu assets found\n",
+                found.size(), static_cast<size_t>(last - first));
+        return success;
+    }
 
-        auto fill_cache_data = [&](Cache& cache) -> std::string {
-            MYSQL_RES* result = nullptr;
-            constexpr size_t query_max_length = 4096;
-            char query[query_max_length];
-            snprintf(
-                query, query_max_length,
-                "SELECT EXISTS(SELECT 1 FROM %s WHERE path = '%s')",
-                table_name.c_str(), asset_path.c_str());
-            auto query_length = strlen(query);
-            TF_DEBUG(USD_URI_RESOLVER)
-                .Msg("SQLConnection::resolve_name: query:\n%s\n", query);
-            const auto query_ret =
-                mysql_real_query(connection, query, query_length);
-            // I only have to flush when there is a successful query.
-            if (query_ret != 0) {
-                SQL_WARN(
-                    "[SQLResolver] Error executing query: %s\nError code: "
-                    "%i\nError string: %s",
-                    query, mysql_errno(connection), mysql_error(connection));
-            } else {
-                result = mysql_store_result(connection);
-            }
-
-            if (result != nullptr) {
-                assert(mysql_num_rows(result) == 1);
-                auto row = mysql_fetch_row(result);
-                assert(mysql_num_fields(result) == 1);
-
-                if (row[0] != nullptr && strcmp(row[0], "1") == 0) {
-                    TF_DEBUG(USD_URI_RESOLVER)
-                        .Msg(
-                            "SQLConnection::resolve_name: found: %s\n",
-                            asset_path.c_str());
-                    cache.local_path = generate_name(
-                        cache_path, asset_path.substr(last_dot),
-                        tmp_name_buffer);
-                    cache.state = CACHE_NEEDS_FETCHING;
-                    cache.timestamp = 1.0;
+    // Add a resolved asset to the cache. Assets resolved by another thread
+    // in the meantime are left as they are.
+    void add_to_cache(const std::string& asset_path, const Metadata& metadata) {
+        if (!metadata.exists) {
+            cache->insert(
+                asset_path,
+                Cache{CACHE_MISSING, "", INVALID_TIME, 0, "", false});
+            return;
+        }
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg("SQLServer::add_to_cache: found: %s\n", asset_path.c_str());
+        cache->insert(
+            asset_path,
+            Cache{
+                CACHE_NEEDS_FETCHING, generate_path(asset_path),
+                metadata.timestamp == INVALID_TIME ? 1.0 : metadata.timestamp,
+                metadata.size, metadata.chunked ? CHUNKED_TAG : "", false});
+        auto longest = max_path_length.load();
+        while (longest < asset_path.size() &&
+               !max_path_length.compare_exchange_weak(
+                   longest, asset_path.size())) {}
+    }
+
+    // The local path of a resolved asset, without taking a lock. Returns an
+    // empty string if the asset is missing or not resolved yet.
+    std::string find_local_path(const std::string& asset_path) const {
+        return cache->find_local_path(asset_path);
+    }
+
+    // Query the metadata of assets in batches of batch_size paths, one round
+    // trip each, and add them to the cache. Assets a query failed for are
+    // cached as missing, like a failed single query.
+    void resolve_batch(const std::vector<std::string>& asset_paths) {
+        if (asset_paths.empty()) { return; }
+        // the changes made after the first resolve are picked up by sync,
+        // from the clock of the primary like the sync itself
+        bool needs_mark = false;
+        {
+            mutex_scoped_lock sc(sync_mutex);
+            needs_mark = sync_mark == INVALID_TIME;
+        }
+        if (needs_mark) {
+            Lease connection(*this, ROUTE_PRIMARY);
+            double now = INVALID_TIME;
+            bool success = false;
+            while (connection && !(success = query_now(*connection, now)) &&
+                   connection.failover()) {}
+            if (success) {
+                mutex_scoped_lock sc(sync_mutex);
+                if (sync_mark == INVALID_TIME) {
+                    sync_mark = now;
+                    synced = steady_clock::now();
                 }
-                mysql_free_result(result);
             }
+        }
+        Lease connection(*this);
+        if (!connection) {
+            TF_DEBUG(USD_URI_RESOLVER)
+                .Msg(
+                    "SQLServer::resolve_batch: aborting due to null "
+                    "connection pointer\n");
+            return;
+        }
+        auto first = asset_paths.cbegin();
+        // a failover that found no host leaves the rest unresolved
+        while (first != asset_paths.cend() && connection) {
+            const size_t remaining = asset_paths.cend() - first;
+            const auto last = first + std::min(batch_size, remaining);
+            std::map<std::string, Metadata> found;
+            while (!query_metadata_batch(*connection, first, last, found) &&
+                   connection.failover()) {
+                found.clear();
+            }
+            for (auto it = first; it != last; ++it) {
+                const auto result = found.find(*it);
+                add_to_cache(
+                    *it, result == found.end()
+                             ? Metadata{false, INVALID_TIME, 0, false}
+                             : result->second);
+            }
+            first = last;
+        }
+    }
+
+    // The first thread missing the cache starts collecting a batch. It waits
+    // for batch_window, then for as long as every connection is busy with
+    // another batch, while the paths other threads miss meanwhile join the
+    // batch. Under low load a batch holds a single path and adds no latency,
+    // under load the round trips are shared between many resolves.
+    void resolve_batched(const std::string& asset_path) {
+        std::unique_lock<std::mutex> lock(batch_mutex);
+        const auto id = batch_id;
+        batch_paths.push_back(asset_path);
+        if (batch_collecting) {
+            if (batch_paths.size() >= batch_size) {
+                batch_changed.notify_all();
+            }
+            batch_changed.wait(lock, [&]() {
+                return id < batch_id && batches_in_flight.count(id) == 0;
+            });
+            return;
+        }
+
+        batch_collecting = true;
+        const auto is_full = [&]() { return batch_paths.size() >= batch_size; };
+        if (batch_window > steady_clock::duration::zero()) {
+            batch_changed.wait_for(lock, batch_window, is_full);
+        }
+        batch_changed.wait(lock, [&]() {
+            return is_full() || batches_in_flight.size() < max_connections;
+        });
+        std::vector<std::string> paths;
+        paths.swap(batch_paths);
+        batch_collecting = false;
+        ++batch_id;
+        batches_in_flight.insert(id);
+        lock.unlock();
+
+        std::sort(paths.begin(), paths.end());
+        paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLServer::resolve_batched: batch %zu with %zu paths\n", id,
+                paths.size());
+        resolve_batch(paths);
+
+        lock.lock();
+        batches_in_flight.erase(id);
+        batch_changed.notify_all();
+    }
 
+    std::string resolve_name(const std::string& asset_path) {
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg("SQLServer::resolve_name: '%s'\n", asset_path.c_str());
+
+        const auto last_dot = asset_path.find_last_of('.');
+        if (last_dot == std::string::npos) {
             TF_DEBUG(USD_URI_RESOLVER)
                 .Msg(
-                    "SQLConnection::resolve_name: local path: %s\n",
-                    cache.local_path.c_str());
-            return cache.local_path;
-        };
+                    "SQLServer::resolve_name: asset path missing extension "
+                    "('%s')\n",
+                    asset_path.c_str());
+            return "";
+        }
 
-        if (cached_result != cached_queries.end()) {
-            if (cached_result->second.state != CACHE_MISSING) {
+        {
+            const auto local_path = find_local_path(asset_path);
+            if (!local_path.empty()) {
                 TF_DEBUG(USD_URI_RESOLVER)
                     .Msg(
-                        "SQLConnection::resolve_name: using cached result: "
+                        "SQLServer::resolve_name: using cached result: "
                         "'%s'\n",
-                        cached_result->second.local_path.c_str());
-                return cached_result->second.local_path;
+                        local_path.c_str());
+                return local_path;
             }
-            return fill_cache_data(cached_result->second);
-        } else {
-            Cache cache{CACHE_MISSING, ""};
-            std::string result = fill_cache_data(cache);
-            cached_queries.insert(std::make_pair(asset_path, cache));
-            return result;
         }
+
+        resolve_batched(asset_path);
+
+        const auto local_path = find_local_path(asset_path);
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLServer::resolve_name: local path: %s\n",
+                local_path.c_str());
+        return local_path;
     }
 
-    bool fetch(const std::string& asset_path) {
+    // Resolve assets ahead of time, the ones missing from the cache take one
+    // query per batch_size paths
+    std::vector<std::string> resolve_names(
+        const std::vector<std::string>& asset_paths) {
+        std::vector<std::string> missing;
+        for (const auto& asset_path : asset_paths) {
+            if (asset_path.find_last_of('.') != std::string::npos &&
+                find_local_path(asset_path).empty()) {
+                missing.push_back(asset_path);
+            }
+        }
+        std::sort(missing.begin(), missing.end());
+        missing.erase(
+            std::unique(missing.begin(), missing.end()), missing.end());
         TF_DEBUG(USD_URI_RESOLVER)
-            .Msg("SQLConnection::fetch: '%s'\n", asset_path.c_str());
-        if (connection == nullptr) {
-            TF_DEBUG(USD_URI_RESOLVER)
-                .Msg(
-                    "SQLConnection::fetch: aborting due to null connection "
-                    "pointer\n");
-            return false;
+            .Msg(
+                "SQLServer::resolve_names: %zu paths, %zu not cached\n",
+                asset_paths.size(), missing.size());
+        resolve_batch(missing);
+
+        std::vector<std::string> local_paths;
+        local_paths.reserve(asset_paths.size());
+        for (const auto& asset_path : asset_paths) {
+            local_paths.push_back(
+                asset_path.find_last_of('.') == std::string::npos
+                    ? ""
+                    : find_local_path(asset_path));
         }
+        return local_paths;
+    }
+
+    bool fetch(const std::string& asset_path) {
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg("SQLServer::fetch: '%s'\n", asset_path.c_str());
 
-        mutex_scoped_lock sc(connection_mutex);
-        const auto cached_result = cached_queries.find(asset_path);
-        if (cached_result == cached_queries.end()) {
+        Cache cached;
+        if (!cache->lookup(asset_path, cached)) {
             SQL_WARN(
                 "[SQLResolver] %s was not resolved before fetching!",
                 asset_path.c_str());
             return false;
         }
 
-        if (cached_result->second.state != CACHE_NEEDS_FETCHING) {
+        if (cached.state != CACHE_NEEDS_FETCHING && !is_synced()) {
             // ensure cached state is up to date before deciding not to fetch
             // (there is no guarantee that get_timestamp was called prior to
             // fetch)
-            auto current_timestamp =
-                get_timestamp_raw(connection, table_name, asset_path);
-            if (current_timestamp == INVALID_TIME) {
-                cached_result->second.state = CACHE_MISSING;
-            } else if (current_timestamp > cached_result->second.timestamp) {
+            if (!sync()) {
                 TF_DEBUG(USD_URI_RESOLVER)
-                    .Msg(
-                        "SQLConnection::fetch: local path data is out of "
-                        "date.\n");
-                cached_result->second.state = CACHE_NEEDS_FETCHING;
+                    .Msg("SQLServer::fetch: could not query metadata\n");
+                return false;
             }
         }
 
-        if (cached_result->second.state == CACHE_MISSING) {
-            TF_DEBUG(USD_URI_RESOLVER)
-                .Msg("SQLConnection::fetch: missing from database, no fetch\n");
-            return false;
+        // joins a fetch in flight, a fresh copy isn't fetched again
+        const bool success = cache->fetch(asset_path);
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLServer::fetch: %s\n",
+                success ? "local copy up to date"
+                        : "missing from database, no fetch");
+        return success;
+    }
+
+    // Like fetch, but returns right away. Assets known to need fetching are
+    // downloaded by the async engine when available, anything else, like
+    // waiting for a fetch in flight or a sync, is queued for the fetch
+    // workers, so any number of calls takes at most max_connections threads.
+    std::future<bool> fetch_async(const std::string& asset_path) {
+        Cache cached;
+        if (cache->lookup(asset_path, cached) &&
+            cached.state == CACHE_FETCHED && is_synced()) {
+            std::promise<bool> fetched;
+            fetched.set_value(true);
+            return fetched.get_future();
         }
+#ifdef USD_SQL_ASYNC
+        // chunked assets are fetched in parallel by fetch itself, and a
+        // fetch in flight is joined by fetch rather than waited for here
+        Cache claimed;
+        if (cache->begin_fetch(
+                asset_path, claimed,
+                [this](const Cache& entry) { return !is_chunked(entry); },
+                false)) {
+            auto fetched = std::make_shared<std::promise<bool>>();
+            get_engine().fetch(
+                asset_path, claimed.local_path,
+                [this, asset_path, claimed, fetched](
+                    bool success, unsigned long long size,
+                    double timestamp) mutable {
+                    claimed.state = success ? CACHE_FETCHED : CACHE_MISSING;
+                    if (success) {
+                        drop_from_memory(claimed.local_path);
+                        claimed.size = size;
+                        claimed.timestamp = timestamp;
+                    }
+                    cache->end_fetch(asset_path, claimed);
+                    fetched->set_value(success);
+                });
+            return fetched->get_future();
+        }
+#endif // USD_SQL_ASYNC
+        auto fetched = std::make_shared<std::promise<bool>>();
+        queue_fetch_job([this, asset_path, fetched](bool run) {
+            fetched->set_value(run && fetch(asset_path));
+        });
+        return fetched->get_future();
+    }
 
-        if (cached_result->second.state == CACHE_NEEDS_FETCHING) {
-            TF_DEBUG(USD_URI_RESOLVER)
-                .Msg("SQLConnection::fetch: Cache needed fetching\n");
-            cached_result->second.state =
-                CACHE_MISSING; // we'll set this up if fetching is successful
-
-            MYSQL_RES* result = nullptr;
-            constexpr size_t query_max_length = 4096;
-            char query[query_max_length];
-            snprintf(
-                query, query_max_length,
-                "SELECT data, timestamp FROM %s WHERE path = '%s' LIMIT 1",
-                table_name.c_str(), asset_path.c_str());
-            unsigned long query_length = strlen(query);
-            TF_DEBUG(USD_URI_RESOLVER)
-                .Msg("SQLConnection::fetch: query:\n%s\n", query);
-            const auto query_ret =
-                mysql_real_query(connection, query, query_length);
-            // I only have to flush when there is a successful query.
-            if (query_ret != 0) {
-                SQL_WARN(
-                    "[SQLResolver] Error executing query: %s\nError code: "
-                    "%i\nError string: %s",
-                    query, mysql_errno(connection), mysql_error(connection));
-            } else {
-                result = mysql_store_result(connection);
+    void queue_fetch_job(FetchJob job) {
+        {
+            mutex_scoped_lock sc(fetch_mutex);
+            fetch_queue.push_back(std::move(job));
+            if (fetch_workers.size() < max_connections) {
+                fetch_workers.emplace_back(&SQLServer::run_fetches, this);
             }
+        }
+        fetch_queued.notify_one();
+    }
+
+    // A fetch worker, runs the queued fetches until the server goes away
+    void run_fetches() {
+        sql_thread_init();
+        std::unique_lock<std::mutex> lock(fetch_mutex);
+        for (;;) {
+            fetch_queued.wait(
+                lock, [&]() { return fetch_stopping || !fetch_queue.empty(); });
+            if (fetch_stopping) { return; }
+            const FetchJob job = std::move(fetch_queue.front());
+            fetch_queue.pop_front();
+            lock.unlock();
+            job(true);
+            lock.lock();
+        }
+    }
+
+    // Query a chunk of the data of an asset starting at offset, along with
+    // the length of all the data, the timestamp and the encoding. Returns
+    // false if the query failed or the asset has no data.
+    bool fetch_chunk(
+        SQLConnection& connection, const std::string& asset_path,
+        unsigned long long offset, std::vector<char>& chunk,
+        unsigned long& chunk_length, unsigned long long& data_length,
+        double& timestamp, std::string& encoding) {
+        MYSQL_BIND params[3];
+        unsigned long long position = offset + 1; // SUBSTRING counts from 1
+        unsigned long long length = chunk.size();
+        unsigned long path_length = 0;
+        bind_longlong(params[0], position);
+        bind_longlong(params[1], length);
+        bind_string(params[2], asset_path, path_length);
+        auto statement =
+            connection.execute(SQLConnection::STATEMENT_FETCH, params);
+        if (statement == nullptr) { return false; }
+
+        MYSQL_BIND results[4];
+        my_bool data_is_null = 0;
+        memset(&results[0], 0, sizeof(results[0]));
+        results[0].buffer_type = MYSQL_TYPE_BLOB;
+        results[0].buffer = chunk.data();
+        results[0].buffer_length = chunk.size();
+        results[0].length = &chunk_length;
+        results[0].is_null = &data_is_null;
+        bind_longlong(results[1], data_length);
+        my_bool timestamp_is_null = 0;
+        bind_double(results[2], timestamp, timestamp_is_null);
+        char encoding_buffer[32];
+        unsigned long encoding_length = 0;
+        my_bool encoding_is_null = 0;
+        memset(&results[3], 0, sizeof(results[3]));
+        results[3].buffer_type = MYSQL_TYPE_STRING;
+        results[3].buffer = encoding_buffer;
+        results[3].buffer_length = sizeof(encoding_buffer);
+        results[3].length = &encoding_length;
+        results[3].is_null = &encoding_is_null;
+        const auto fetch_ret = mysql_stmt_bind_result(statement, results) == 0
+                                   ? mysql_stmt_fetch(statement)
+                                   : 1;
+        if (fetch_ret == 1) {
+            connection.warn(statement, SQLConnection::STATEMENT_FETCH);
+        }
+        mysql_stmt_free_result(statement);
+        if (fetch_ret != 0 || data_is_null) { return false; }
+        if (timestamp_is_null) { timestamp = INVALID_TIME; }
+        encoding = encoding_is_null
+                       ? std::string()
+                       : std::string(encoding_buffer, encoding_length);
+        return true;
+    }
+
+    // Assets with NULL data in the main table are stored as rows of the chunk
+    // table, when there is one. Empty data is an empty asset, not a chunked one.
+    bool is_chunked(const Cache& cache) const {
+        return !chunk_table.empty() && cache.etag == CHUNKED_TAG;
+    }
+
+    // Query the indices of the chunks of an asset and their offsets in the
+    // data, followed by the size of the data
+    bool query_chunks(
+        SQLConnection& connection, const std::string& asset_path,
+        std::vector<unsigned long long>& indices,
+        std::vector<unsigned long long>& offsets) {
+        MYSQL_BIND param;
+        unsigned long path_length = 0;
+        bind_string(param, asset_path, path_length);
+        auto statement =
+            connection.execute(SQLConnection::STATEMENT_CHUNKS, &param);
+        if (statement == nullptr) { return false; }
+        MYSQL_BIND results[2];
+        unsigned long long index = 0;
+        unsigned long long length = 0;
+        bind_longlong(results[0], index);
+        bind_longlong(results[1], length);
+        offsets.assign(1, 0);
+        auto fetch_ret = mysql_stmt_bind_result(statement, results) == 0
+                             ? mysql_stmt_fetch(statement)
+                             : 1;
+        while (fetch_ret == 0) {
+            indices.push_back(index);
+            offsets.push_back(offsets.back() + length);
+            fetch_ret = mysql_stmt_fetch(statement);
+        }
+        if (fetch_ret == 1) {
+            connection.warn(statement, SQLConnection::STATEMENT_CHUNKS);
+        }
+        mysql_stmt_free_result(statement);
+        return fetch_ret == MYSQL_NO_DATA && !indices.empty();
+    }
+
+    // Query the data of one chunk, which has to fill the buffer exactly
+    bool fetch_chunk_row(
+        SQLConnection& connection, const std::string& asset_path,
+        unsigned long long index, std::vector<char>& buffer) {
+        MYSQL_BIND params[2];
+        unsigned long path_length = 0;
+        bind_string(params[0], asset_path, path_length);
+        bind_longlong(params[1], index);
+        auto statement =
+            connection.execute(SQLConnection::STATEMENT_FETCH_CHUNK, params);
+        if (statement == nullptr) { return false; }
+        MYSQL_BIND result;
+        unsigned long length = 0;
+        my_bool is_null = 0;
+        memset(&result, 0, sizeof(result));
+        result.buffer_type = MYSQL_TYPE_BLOB;
+        result.buffer = buffer.data();
+        result.buffer_length = buffer.size();
+        result.length = &length;
+        result.is_null = &is_null;
+        const auto fetch_ret = mysql_stmt_bind_result(statement, &result) == 0
+                                   ? mysql_stmt_fetch(statement)
+                                   : 1;
+        if (fetch_ret == 1) {
+            connection.warn(statement, SQLConnection::STATEMENT_FETCH_CHUNK);
+        }
+        mysql_stmt_free_result(statement);
+        return fetch_ret == 0 && !is_null && length == buffer.size();
+    }
 
+    // Download an asset stored in the chunk table. The chunks are fetched
+    // in parallel over up to max_connections connections and written in
+    // place into a preallocated file, so a large asset downloads at the
+    // combined throughput of the connections and no row has to fit the
+    // whole asset. The calling thread fetches chunks itself and the fetch
+    // workers help, a helper that only starts once the chunks ran out
+    // returns right away, so a busy pool never stalls the download.
+    bool fetch_chunked(const std::string& asset_path, Cache& cache) {
+        std::vector<unsigned long long> indices;
+        std::vector<unsigned long long> offsets;
+        {
+            Lease connection(*this);
             bool success = false;
-            if (result != nullptr) {
-                if (mysql_num_rows(result) == 1) {
-                    auto row = mysql_fetch_row(result);
-                    assert(mysql_num_fields(result) == 2);
-                    auto field = mysql_fetch_field(result);
-                    if (row[0] != nullptr && field->max_length > 0) {
-                        TF_DEBUG(USD_URI_RESOLVER)
-                            .Msg(
-                                "SQLConnection::fetch: successfully fetched "
-                                "data\n");
-                        success = true;
-                        std::fstream fs(
-                            cached_result->second.local_path,
-                            std::ios::out | std::ios::binary);
-                        fs.write(row[0], field->max_length);
-                        fs.flush();
-                        cached_result->second.state = CACHE_FETCHED;
-
-                        field = mysql_fetch_field(result);
-                        double time =
-                            convert_mysql_result_to_time(field, row, 1);
-                        if (time == INVALID_TIME) {
-                            TF_DEBUG(USD_URI_RESOLVER)
-                                .Msg(
-                                    "SQLConnection::fetch: failed parsing "
-                                    "timestamp\n");
-                            time = 1.0;
-                        }
-                        cached_result->second.timestamp = time;
-                    }
+            while (connection &&
+                   !(success = query_chunks(
+                         *connection, asset_path, indices, offsets)) &&
+                   connection.failover()) {}
+            if (!success) {
+                TF_DEBUG(USD_URI_RESOLVER)
+                    .Msg(
+                        "SQLServer::fetch_chunked: no chunks for %s\n",
+                        asset_path.c_str());
+                return false;
+            }
+        }
+        const auto size = offsets.back();
+        const auto local_dir = TfGetPathName(cache.local_path);
+        if (!TfIsDir(local_dir) && !TfMakeDirs(local_dir) &&
+            !TfIsDir(local_dir)) {
+            return false;
+        }
+        std::string temp_path = cache.local_path + ".XXXXXX";
+        const int fd = mkstemp(&temp_path[0]);
+        if (fd == -1) { return false; }
+        // a file system without fallocate gets a sparse file instead
+        bool success = posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0 ||
+                       ftruncate(fd, static_cast<off_t>(size)) == 0;
+
+        std::atomic<size_t> next_chunk(0);
+        std::atomic<bool> failed(!success);
+        auto fetch_chunks = [&]() {
+            sql_thread_init();
+            Lease connection(*this);
+            if (!connection) {
+                failed = true;
+                return;
+            }
+            std::vector<char> buffer;
+            for (auto i = next_chunk++; i < indices.size() && !failed;
+                 i = next_chunk++) {
+                buffer.resize(static_cast<size_t>(offsets[i + 1] - offsets[i]));
+                bool fetched = false;
+                while (!(fetched = fetch_chunk_row(
+                             *connection, asset_path, indices[i], buffer)) &&
+                       connection.failover()) {}
+                if (!fetched || !write_at(fd, buffer, offsets[i])) {
+                    failed = true;
                 }
-                mysql_free_result(result);
             }
+        };
+        // the helpers only touch what is on this stack while counted in
+        // helpers, a late one only sees finished
+        struct Helpers {
+            std::mutex mutex;
+            std::condition_variable done;
+            size_t running = 0;
+            bool finished = false;
+        };
+        const auto helpers = std::make_shared<Helpers>();
+        const auto num_threads = std::min(max_connections, indices.size());
+        for (size_t i = 1; i < num_threads; ++i) {
+            queue_fetch_job([helpers, &fetch_chunks](bool run) {
+                {
+                    mutex_scoped_lock sc(helpers->mutex);
+                    if (!run || helpers->finished) { return; }
+                    ++helpers->running;
+                }
+                fetch_chunks();
+                mutex_scoped_lock sc(helpers->mutex);
+                --helpers->running;
+                helpers->done.notify_all();
+            });
+        }
+        fetch_chunks();
+        {
+            std::unique_lock<std::mutex> lock(helpers->mutex);
+            helpers->finished = true;
+            helpers->done.wait(lock, [&]() { return helpers->running == 0; });
+        }
+        success = !failed && close(fd) == 0 &&
+                  rename(temp_path.c_str(), cache.local_path.c_str()) == 0;
+        if (failed) { close(fd); }
 
-            if (!success) {
+        TF_DEBUG(USD_URI_RESOLVER)
+            .Msg(
+                "SQLServer::fetch_chunked: %s %zu chunks, %llu bytes with "
+                "%zu connections\n",
+                success ? "fetched" : "failed to fetch", indices.size(), size,
+                num_threads);
+        if (!success) {
+            remove(temp_path.c_str());
+            return false;
+        }
+        drop_from_memory(cache.local_path);
+        cache.state = CACHE_FETCHED;
+        cache.size = size;
+        return true;
+    }
+
+    // Assets written to their local path are no longer served from memory
+    void drop_from_memory(const std::string& local_path) {
+        if (memory_store != nullptr) { memory_store->erase(local_path); }
+    }
+
+    // Download the data of an asset to the local path of the cache entry.
+    // The data is streamed to the file in chunks of fetch_chunk_size bytes,
+    // one query each, so memory use doesn't grow with the size of the
+    // asset. Assets fitting in a chunk take a single query. The server reads
+    // the BLOB again for every chunk, so the chunk size defaults to as much
+    // as the default max_allowed_packet of MariaDB allows. The data goes
+    // to a temporary file first, so other processes sharing the cache never
+    // see a partial copy. With a memory store, assets that fit are kept in
+    // memory instead and never touch the disk, see SQL::open_buffer.
+    bool fetch_data(const std::string& asset_path, Cache& cache) {
+        if (is_chunked(cache)) { return fetch_chunked(asset_path, cache); }
+        Lease connection(*this);
+        if (!connection) {
+            TF_DEBUG(USD_URI_RESOLVER)
+                .Msg(
+                    "SQLServer::fetch_data: aborting due to null connection "
+                    "pointer\n");
+            return false;
+        }
+
+        // the size from the metadata saves allocating a full chunk for small
+        // assets, a size that changed since only costs more queries
+        const auto chunk_size = std::min<unsigned long long>(
+            fetch_chunk_size, std::max<unsigned long long>(cache.size, 1));
+        std::vector<char> chunk(static_cast<size_t>(chunk_size));
+        const bool in_memory =
+            memory_store != nullptr && memory_store->fits(cache.size);
+        auto buffer = std::make_shared<std::vector<char>>();
+        std::string temp_path;
+        std::fstream fs;
+        if (in_memory) {
+            buffer->reserve(static_cast<size_t>(cache.size));
+        } else {
+            const auto local_dir = TfGetPathName(cache.local_path);
+            if (!TfIsDir(local_dir) && !TfMakeDirs(local_dir) &&
+                !TfIsDir(local_dir)) {
+                TF_DEBUG(USD_URI_RESOLVER)
+                    .Msg(
+                        "SQLServer::fetch_data: failed to create %s\n",
+                        local_dir.c_str());
+                return false;
+            }
+            temp_path = cache.local_path + ".XXXXXX";
+            const int fd = mkstemp(&temp_path[0]);
+            if (fd == -1) {
+                TF_DEBUG(USD_URI_RESOLVER)
+                    .Msg(
+                        "SQLServer::fetch_data: failed to create %s\n",
+                        temp_path.c_str());
+                return false;
+            }
+            close(fd);
+            fs.open(
+                temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        }
+        // compressed data is decoded on the fly, written counts the bytes
+        // that end up in the local copy
+        unsigned long long written = 0;
+        const Sink write = [&](const char* data, size_t size) {
+            written += size;
+            if (in_memory) {
+                buffer->insert(buffer->end(), data, data + size);
+                return true;
+            }
+            fs.write(data, size);
+            return static_cast<bool>(fs);
+        };
+        std::unique_ptr<Decoder> decoder;
+        unsigned long long offset = 0;
+        unsigned long long data_length = 0;
+        double timestamp = INVALID_TIME;
+        bool success = false;
+        while (in_memory || fs) {
+            unsigned long chunk_length = 0;
+            double chunk_timestamp = INVALID_TIME;
+            std::string encoding;
+            if (!fetch_chunk(
+                    *connection, asset_path, offset, chunk, chunk_length,
+                    data_length, chunk_timestamp, encoding)) {
+                // a replica lagging behind is caught by the timestamp check
+                if (connection.failover()) { continue; }
+                break;
+            }
+            if (offset == 0) {
+                timestamp = chunk_timestamp;
+                decoder = create_decoder(encoding);
+                if (decoder == nullptr) {
+                    SQL_WARN(
+                        "[SQLResolver] %s has unsupported encoding '%s', "
+                        "supported: %s",
+                        asset_path.c_str(), encoding.c_str(),
+                        supported_encodings().c_str());
+                    break;
+                }
+            } else if (chunk_timestamp != timestamp) {
                 TF_DEBUG(USD_URI_RESOLVER)
                     .Msg(
-                        "SQLConnection::fetch: entry could not be fetched from "
-                        "database\n");
+                        "SQLServer::fetch_data: data changed while "
+                        "fetching\n");
+                break;
+            }
+            if (!decoder->write(chunk.data(), chunk_length, write)) {
+                TF_DEBUG(USD_URI_RESOLVER)
+                    .Msg("SQLServer::fetch_data: failed decoding data\n");
+                break;
+            }
+            offset += chunk_length;
+            // fetch_chunk fails on a missing row or NULL data, an empty
+            // asset is a single empty chunk
+            if (offset >= data_length || chunk_length == 0) {
+                success = offset == data_length && decoder->finish();
+                break;
+            }
+        }
+        if (in_memory) {
+            // decoded assets may turn out too large, they spill to disk
+            // through a temporary file like the victims of the memory store
+            success = success &&
+                      (memory_store->insert(cache.local_path, buffer) ||
+                       write_file(cache.local_path, *buffer));
+        } else {
+            fs.close();
+            success = success && fs &&
+                      rename(temp_path.c_str(), cache.local_path.c_str()) == 0;
+            if (success) { drop_from_memory(cache.local_path); }
+        }
+
+        if (success) {
+            TF_DEBUG(USD_URI_RESOLVER)
+                .Msg(
+                    "SQLServer::fetch_data: successfully fetched %llu "
+                    "bytes, %llu bytes stored%s\n",
+                    data_length, written, in_memory ? " in memory" : "");
+            cache.state = CACHE_FETCHED;
+            cache.size = written;
+            if (timestamp == INVALID_TIME) {
+                TF_DEBUG(USD_URI_RESOLVER)
+                    .Msg("SQLServer::fetch_data: failed parsing timestamp\n");
+                timestamp = 1.0;
             }
+            cache.timestamp = timestamp;
         } else {
             TF_DEBUG(USD_URI_RESOLVER)
-                .Msg("SQLConnection::fetch: Cache didn't need fetching\n");
+                .Msg(
+                    "SQLServer::fetch_data: entry could not be fetched from "
+                    "database\n");
+            if (!temp_path.empty()) { remove(temp_path.c_str()); }
         }
-
-        return true;
+        return success;
     }
 
+    // Answered from the cache, after a sync if the last one is older than
+    // freshness
     double get_timestamp(const std::string& asset_path) {
-        if (connection == nullptr) { return 1.0; }
-
-        mutex_scoped_lock sc(connection_mutex);
-        const auto cached_result = cached_queries.find(asset_path);
-        if (cached_result == cached_queries.end() ||
-            cached_result->second.state == CACHE_MISSING) {
+        Cache cached;
+        if (!cache->lookup(asset_path, cached) ||
+            cached.state == CACHE_MISSING) {
             SQL_WARN(
                 "[SQLResolver] %s is missing when querying timestamps!",
                 asset_path.c_str());
             return 1.0;
-        } else {
-            auto ret = get_timestamp_raw(connection, table_name, asset_path);
-            if (ret == INVALID_TIME) {
-                cached_result->second.state = CACHE_MISSING;
-                ret = cached_result->second.timestamp;
-            } else if (ret > cached_result->second.timestamp) {
-                cached_result->second.state = CACHE_NEEDS_FETCHING;
-            }
-            return ret;
         }
+        if (is_synced()) { return cached.timestamp; }
+
+        if (!sync()) { return 1.0; }
+        return cache->lookup(asset_path, cached) ? cached.timestamp : 1.0;
     }
 };
 
-SQL::SQL() { my_init(); }
+SQL::SQL()
+    : servers(std::make_shared<server_table>()),
+      generation(next_generation++) {
+    my_init();
+    const auto budget = getenv(MEMORY_BUDGET_ENV_VAR);
+    const auto budget_bytes = budget == nullptr ? 0ll : atoll(budget);
+    if (budget_bytes > 0) {
+#ifdef USD_SQL_OPEN_ASSET
+        const auto asset_limit = getenv(MEMORY_ASSET_LIMIT_ENV_VAR);
+        memory_store.reset(new MemoryStore(
+            static_cast<size_t>(budget_bytes),
+            static_cast<size_t>(std::max(
+                0ll, asset_limit == nullptr ? 16777216ll
+                                            : atoll(asset_limit)))));
+#else
+        // without OpenAsset USD reads the local path, which must exist
+        SQL_WARN(
+            "[SQLResolver] $%s is ignored, USD was built without "
+            "ArResolver::OpenAsset",
+            MEMORY_BUDGET_ENV_VAR);
+#endif // USD_SQL_OPEN_ASSET
+    }
+}
 
 SQL::~SQL() { clear(); }
 
 void SQL::clear() {
     sql_thread_init();
-    mutex_scoped_lock sc(connections_mutex);
-    for (const auto& connection : connections) { delete connection.second; }
-    connections.clear();
+    mutex_scoped_lock sc(servers_mutex);
+    // the lookups cached by threads refer to the deleted servers
+    generation = next_generation++;
+    // the servers are deleted once the calls in flight and the cached
+    // lookups release them
+    std::atomic_store(
+        &servers,
+        std::shared_ptr<const server_table>(std::make_shared<server_table>()));
+    if (memory_store != nullptr) { memory_store->clear(); }
 }
 
-SQLConnection* SQL::get_connection(bool create) {
+// Cache hits don't take a lock here: the host is compared with the lookup
+// cached by the thread, and other lookups search the current copy of the
+// server table. Only adding a server takes servers_mutex. The caller holds
+// the returned reference for the duration of its call, so a concurrent
+// clear can't delete the server under it.
+std::shared_ptr<SQLServer> SQL::get_server(bool create) {
     sql_thread_init();
-    SQLConnection* conn = nullptr;
-    {
-        const auto server_name = getenv(HOST_ENV_VAR);
-        if (server_name == nullptr) {
-            SQL_WARN(
-                "[SQLResolver] Could not get host name - make sure $%s"
-                " is defined",
-                HOST_ENV_VAR);
-            return conn;
-        }
-        mutex_scoped_lock sc(connections_mutex);
-        conn = find_in_sorted_vector<
-            connection_pair::first_type, connection_pair::second_type, nullptr>(
-            connections, server_name);
-        if (create && conn == nullptr) { // initialize new connection
-            conn = new SQLConnection(server_name);
-            connections.emplace_back(server_name, conn);
+    const auto server_name = getenv(HOST_ENV_VAR);
+    if (server_name == nullptr) {
+        SQL_WARN(
+            "[SQLResolver] Could not get host name - make sure $%s"
+            " is defined",
+            HOST_ENV_VAR);
+        return nullptr;
+    }
+    const auto current_generation = generation.load();
+    if (last_lookup.server != nullptr &&
+        last_lookup.generation == current_generation &&
+        last_lookup.server_name == server_name) {
+        return last_lookup.server;
+    }
+    // don't keep a server removed by clear alive any longer
+    last_lookup.server.reset();
+    auto server = find_in_sorted_vector<
+        server_pair::first_type, server_pair::second_type>(
+        *std::atomic_load(&servers), server_name);
+    if (create && server == nullptr) {
+        mutex_scoped_lock sc(servers_mutex);
+        // another thread may have added the server in the meantime
+        const auto table = std::atomic_load(&servers);
+        server = find_in_sorted_vector<
+            server_pair::first_type, server_pair::second_type>(
+            *table, server_name);
+        if (server == nullptr) { // initialize new server
+            server = std::make_shared<SQLServer>(
+                server_name, memory_store);
+            auto updated = std::make_shared<server_table>(*table);
+            updated->emplace_back(server_name, server);
             std::sort(
-                connections.begin(), connections.end(),
-                [](const connection_pair& a, const connection_pair& b) -> bool {
+                updated->begin(), updated->end(),
+                [](const server_pair& a, const server_pair& b) -> bool {
                     return a.first < b.first;
                 });
+            std::atomic_store(
+                &servers, std::shared_ptr<const server_table>(updated));
         }
     }
-    return conn;
+    if (server != nullptr) {
+        last_lookup.generation = current_generation;
+        last_lookup.server_name = server_name;
+        last_lookup.server = server;
+    }
+    return server;
 }
 
 std::string SQL::resolve_name(const std::string& path) {
     const auto parsed_path = parse_path(path);
-    auto conn = get_connection(true);
-    return conn == nullptr ? "" : conn->resolve_name(parsed_path);
+    auto server = get_server(true);
+    return server == nullptr ? "" : server->resolve_name(parsed_path);
+}
+
+std::vector<std::string> SQL::resolve_names(
+    const std::vector<std::string>& paths) {
+    std::vector<std::string> parsed_paths;
+    parsed_paths.reserve(paths.size());
+    for (const auto& path : paths) { parsed_paths.push_back(parse_path(path)); }
+    auto server = get_server(true);
+    return server == nullptr ? std::vector<std::string>(paths.size())
+                             : server->resolve_names(parsed_paths);
 }
 
 bool SQL::fetch_asset(const std::string& path) {
     const auto parsed_path = parse_path(path);
-    auto conn = get_connection(false);
+    auto server = get_server(false);
     // fetching asset will be after resolving, thus there should be a server
-    return conn != nullptr && conn->fetch(parsed_path);
+    return server != nullptr && server->fetch(parsed_path);
+}
+
+std::future<bool> SQL::fetch_async(const std::string& path) {
+    const auto parsed_path = parse_path(path);
+    auto server = get_server(false);
+    if (server == nullptr) {
+        std::promise<bool> fetched;
+        fetched.set_value(false);
+        return fetched.get_future();
+    }
+    return server->fetch_async(parsed_path);
+}
+
+std::shared_ptr<const std::vector<char>> SQL::open_buffer(
+    const std::string& local_path) {
+    return memory_store == nullptr ? nullptr : memory_store->find(local_path);
 }
 
 bool SQL::matches_schema(const std::string& path) {
@@ -595,7 +1928,7 @@ bool SQL::matches_schema(const std::string& path) {
 
 double SQL::get_timestamp(const std::string& path) {
     const auto parsed_path = parse_path(path);
-    auto conn = get_connection(false);
-    return conn == nullptr ? 1.0 : conn->get_timestamp(parsed_path);
+    auto server = get_server(false);
+    return server == nullptr ? 1.0 : server->get_timestamp(parsed_path);
 }
 } // namespace usd_sql
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <future>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
 namespace usd_sql {
-struct SQLConnection;
+struct SQLServer;
+class MemoryStore;
 
 constexpr const char SQL_PREFIX[] = "sql://";
 constexpr const char SQL_PREFIX_SHORT[] = "sql:";
@@ -14,9 +18,24 @@ constexpr const char HOST_ENV_VAR[] = "USD_SQL_DBHOST";
 constexpr const char PORT_ENV_VAR[] = "USD_SQL_PORT";
 constexpr const char DB_ENV_VAR[] = "USD_SQL_DB";
 constexpr const char TABLE_ENV_VAR[] = "USD_SQL_TABLE";
+constexpr const char CHUNK_TABLE_ENV_VAR[] = "USD_SQL_CHUNK_TABLE";
+constexpr const char ENCODING_COLUMN_ENV_VAR[] = "USD_SQL_ENCODING_COLUMN";
+constexpr const char REPLICAS_ENV_VAR[] = "USD_SQL_REPLICAS";
+constexpr const char HOST_RETRY_ENV_VAR[] = "USD_SQL_HOST_RETRY";
 constexpr const char USER_ENV_VAR[] = "USD_SQL_USER";
 constexpr const char PASSWORD_ENV_VAR[] = "USD_SQL_PASSWD";
 constexpr const char CACHE_PATH_ENV_VAR[] = "USD_SQL_CACHE_PATH";
+constexpr const char INDEX_FILE_NAME[] = ".usd_sql_index";
+constexpr const char CACHE_SIZE_ENV_VAR[] = "USD_SQL_CACHE_SIZE";
+constexpr const char CONNECTIONS_ENV_VAR[] = "USD_SQL_CONNECTIONS";
+constexpr const char FETCH_CHUNK_SIZE_ENV_VAR[] = "USD_SQL_FETCH_CHUNK_SIZE";
+constexpr const char FRESHNESS_ENV_VAR[] = "USD_SQL_FRESHNESS";
+constexpr const char SYNC_WINDOW_ENV_VAR[] = "USD_SQL_SYNC_WINDOW";
+constexpr const char BATCH_SIZE_ENV_VAR[] = "USD_SQL_BATCH_SIZE";
+constexpr const char BATCH_WINDOW_ENV_VAR[] = "USD_SQL_BATCH_WINDOW";
+constexpr const char MEMORY_BUDGET_ENV_VAR[] = "USD_SQL_MEMORY_BUDGET";
+constexpr const char MEMORY_ASSET_LIMIT_ENV_VAR[] =
+    "USD_SQL_MEMORY_ASSET_LIMIT";
 
 class SQL {
 public:
@@ -25,14 +44,33 @@ public:
     void clear();
 
     std::string resolve_name(const std::string& path);
+    // Resolve many paths at once, with one query per batch of paths missing
+    // from the cache. Returns the local paths in the same order.
+    std::vector<std::string> resolve_names(
+        const std::vector<std::string>& paths);
     bool fetch_asset(const std::string& path);
+    // Fetch without blocking the calling thread, the future holds whether
+    // the asset was fetched. Built with USD_SQL_ASYNC, downloads in flight
+    // share a single thread driving nonblocking connections, otherwise they
+    // are queued for up to USD_SQL_CONNECTIONS threads per server.
+    std::future<bool> fetch_async(const std::string& path);
+    // The data of a fetched asset kept in memory instead of at its local
+    // path, see USD_SQL_MEMORY_BUDGET. Returns nullptr for assets on disk.
+    std::shared_ptr<const std::vector<char>> open_buffer(
+        const std::string& local_path);
     bool matches_schema(const std::string& path);
     double get_timestamp(const std::string& path);
 
 private:
-    using connection_pair = std::pair<std::string, SQLConnection*>;
-    SQLConnection* get_connection(bool create);
-    std::mutex connections_mutex;
-    std::vector<connection_pair> connections;
+    using server_pair = std::pair<std::string, std::shared_ptr<SQLServer>>;
+    using server_table = std::vector<server_pair>;
+    std::shared_ptr<SQLServer> get_server(bool create);
+    // The server table is copied on write, lookups load the current copy
+    // without a lock and new servers are added under servers_mutex
+    std::mutex servers_mutex;
+    std::shared_ptr<const server_table> servers;
+    // Changes when clear removes the servers, see get_server
+    std::atomic<size_t> generation;
+    std::shared_ptr<MemoryStore> memory_store; // nullptr without a budget
 };
 } // namespace usd_sql
@@ -0,0 +1,433 @@
+#include "codec.h"
+#include "sql.h"
+
+#include <errmsg.h>
+#include <my_global.h>
+#include <my_sys.h>
+#include <mysql.h>
+
+#include <z85/z85.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ftw.h>
+
+// Uploads the files under a directory to the table of the SQL resolver,
+// connecting with the usual USD_SQL_* settings to the server in
+// USD_SQL_DBHOST. A file at <directory>/a/b.usda becomes the asset
+// <prefix>/a/b.usda, resolved as sql://<prefix>/a/b.usda.
+//
+// The data is streamed to the server with mysql_stmt_send_long_data, so
+// files are never loaded whole, over several connections in parallel. Each
+// connection commits its uploads in transactions of a batch of files. Files
+// whose length and CRC32 match the row already stored are skipped.
+
+namespace {
+constexpr size_t READ_SIZE = 1024 * 1024;
+
+struct Options {
+    size_t threads = 4;
+    size_t batch_size = 32;
+    std::string encoding = "raw";
+    int level = 0;
+    bool force = false;
+    std::string directory;
+    std::string prefix = "/";
+};
+
+struct File {
+    std::string local_path;
+    std::string asset_path;
+};
+
+std::string server_name;
+std::string table_name;
+std::string encoding_column;
+Options options;
+std::vector<File> files;
+std::mutex output_mutex;
+
+std::string get_env_var(
+    const std::string& server_name, const std::string& env_var,
+    const std::string& default_value) {
+    const auto env_first = getenv((server_name + "_" + env_var).c_str());
+    if (env_first != nullptr) { return env_first; }
+    const auto env_second = getenv(env_var.c_str());
+    if (env_second != nullptr) { return env_second; }
+    return default_value;
+}
+
+void print_usage() {
+    std::cerr
+        << "usage: uri_resolver_upload [-j threads] [-b batch size] "
+           "[-c raw|zstd|lz4] [-l level] [-f] <directory> [prefix]\n"
+           "  -j  connections uploading in parallel (4)\n"
+           "  -b  files committed per transaction (32)\n"
+           "  -c  encoding of the data, needs USD_SQL_ENCODING_COLUMN "
+           "(raw)\n"
+           "  -l  compression level, 0 picks the default of the codec\n"
+           "  -f  upload files even if the stored data matches\n"
+           "  prefix  prepended to the paths of the assets (/)\n"
+           "supported encodings: "
+        << usd_sql::supported_encodings() << std::endl;
+}
+
+bool parse_options(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "-j" && has_value) {
+            options.threads = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-b" && has_value) {
+            options.batch_size = std::max(1, atoi(argv[++i]));
+        } else if (arg == "-c" && has_value) {
+            options.encoding = argv[++i];
+        } else if (arg == "-l" && has_value) {
+            options.level = atoi(argv[++i]);
+        } else if (arg == "-f") {
+            options.force = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.empty() || positional.size() > 2) { return false; }
+    options.directory = positional[0];
+    while (options.directory.size() > 1 && options.directory.back() == '/') {
+        options.directory.pop_back();
+    }
+    if (positional.size() > 1) { options.prefix = positional[1]; }
+    if (options.prefix.empty() || options.prefix.back() != '/') {
+        options.prefix += '/';
+    }
+    return true;
+}
+
+int collect_file(const char* path, const struct stat*, int type, FTW*) {
+    if (type != FTW_F) { return 0; }
+    const std::string local_path = path;
+    auto relative_path = local_path.substr(options.directory.size());
+    while (!relative_path.empty() && relative_path[0] == '/') {
+        relative_path.erase(0, 1);
+    }
+    files.push_back(File{local_path, options.prefix + relative_path});
+    return 0;
+}
+
+// The CRC32 of zlib, which is what the CRC32 function of MySQL computes
+uint32_t crc32_update(uint32_t crc, const char* data, size_t size) {
+    static const auto table = []() {
+        std::vector<uint32_t> table(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^
+              (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Stream a file through the encoder, the encoded data goes to the sink
+bool encode_file(const std::string& path, const usd_sql::Sink& sink) {
+    auto encoder = usd_sql::create_encoder(options.encoding, options.level);
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (encoder == nullptr || !file) { return false; }
+    std::vector<char> buffer(READ_SIZE);
+    while (file) {
+        file.read(buffer.data(), buffer.size());
+        const auto count = static_cast<size_t>(file.gcount());
+        if (count > 0 && !encoder->write(buffer.data(), count, sink)) {
+            return false;
+        }
+    }
+    return file.eof() && encoder->finish(sink);
+}
+
+MYSQL* connect() {
+    auto connection = mysql_init(nullptr);
+    const auto password = z85::decode_with_padding(get_env_var(
+        server_name, usd_sql::PASSWORD_ENV_VAR,
+        z85::encode_with_padding(std::string("12345678"))));
+    const auto port = static_cast<unsigned int>(atoi(
+        get_env_var(server_name, usd_sql::PORT_ENV_VAR, "3306").c_str()));
+    if (mysql_real_connect(
+            connection, server_name.c_str(),
+            get_env_var(server_name, usd_sql::USER_ENV_VAR, "root").c_str(),
+            password.c_str(),
+            get_env_var(server_name, usd_sql::DB_ENV_VAR, "usd").c_str(),
+            port, nullptr, 0) == nullptr) {
+        std::cerr << "Failed to connect to " << server_name << ": "
+                  << mysql_error(connection) << std::endl;
+        mysql_close(connection);
+        return nullptr;
+    }
+    return connection;
+}
+
+// Uploads batches of files over a connection of its own
+class Uploader {
+public:
+    size_t uploaded = 0;
+    size_t unchanged = 0;
+    size_t failed = 0;
+
+    Uploader() : connection(connect()), statement(nullptr) {
+        if (connection == nullptr) { return; }
+        std::string query =
+            "INSERT INTO " + table_name + " (path, data" +
+            (encoding_column.empty() ? "" : ", " + encoding_column) +
+            ") VALUES (?, ?" + (encoding_column.empty() ? "" : ", ?") +
+            ") ON DUPLICATE KEY UPDATE data = VALUES(data)";
+        if (!encoding_column.empty()) {
+            query += ", " + encoding_column + " = VALUES(" +
+                     encoding_column + ")";
+        }
+        statement = mysql_stmt_init(connection);
+        if (statement == nullptr ||
+            mysql_stmt_prepare(statement, query.c_str(), query.size()) != 0 ||
+            mysql_autocommit(connection, 0) != 0) {
+            std::cerr << "Error preparing: " << query << "\n"
+                      << mysql_error(connection) << std::endl;
+            close();
+        }
+    }
+
+    ~Uploader() { close(); }
+
+    explicit operator bool() const { return statement != nullptr; }
+
+    // Upload the changed files of a batch in a single transaction. Nothing
+    // of the batch is kept if one of them fails.
+    void upload(std::vector<File>::const_iterator first, size_t count) {
+        std::map<std::string, std::pair<unsigned long long, uint32_t>> stored;
+        if (!options.force && !query_checksums(first, count, stored)) {
+            failed += count;
+            return;
+        }
+        size_t batch_uploaded = 0;
+        for (auto file = first; file != first + count; ++file) {
+            if (!options.force && is_unchanged(*file, stored)) {
+                ++unchanged;
+                continue;
+            }
+            if (!upload_file(*file)) {
+                mysql_rollback(connection);
+                failed += batch_uploaded +
+                          static_cast<size_t>(first + count - file);
+                return;
+            }
+            ++batch_uploaded;
+        }
+        if (mysql_commit(connection) != 0) {
+            report("Error committing", mysql_error(connection));
+            failed += batch_uploaded;
+            return;
+        }
+        uploaded += batch_uploaded;
+    }
+
+private:
+    void close() {
+        if (statement != nullptr) { mysql_stmt_close(statement); }
+        if (connection != nullptr) { mysql_close(connection); }
+        statement = nullptr;
+        connection = nullptr;
+    }
+
+    void report(const std::string& message, const std::string& detail) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << message << ": " << detail << std::endl;
+    }
+
+    // The length and CRC32 of the data stored for the files of a batch
+    bool query_checksums(
+        std::vector<File>::const_iterator first, size_t count,
+        std::map<std::string, std::pair<unsigned long long, uint32_t>>&
+            stored) {
+        std::string query = "SELECT path, LENGTH(data), CRC32(data) FROM " +
+                            table_name + " WHERE path IN (";
+        for (auto file = first; file != first + count; ++file) {
+            std::vector<char> escaped(file->asset_path.size() * 2 + 1);
+            const auto length = mysql_real_escape_string(
+                connection, escaped.data(), file->asset_path.c_str(),
+                file->asset_path.size());
+            query += (file == first ? "'" : ",'") +
+                     std::string(escaped.data(), length) + "'";
+        }
+        query += ")";
+        if (mysql_real_query(connection, query.c_str(), query.size()) != 0) {
+            report("Error querying checksums", mysql_error(connection));
+            return false;
+        }
+        auto result = mysql_store_result(connection);
+        if (result == nullptr) { return false; }
+        while (auto row = mysql_fetch_row(result)) {
+            if (row[0] == nullptr || row[1] == nullptr || row[2] == nullptr) {
+                continue;
+            }
+            stored[row[0]] = std::make_pair(
+                strtoull(row[1], nullptr, 10),
+                static_cast<uint32_t>(strtoul(row[2], nullptr, 10)));
+        }
+        mysql_free_result(result);
+        return true;
+    }
+
+    // Compares the encoded file with the stored data, which costs a pass
+    // over the file but no transfer
+    bool is_unchanged(
+        const File& file,
+        const std::map<std::string, std::pair<unsigned long long, uint32_t>>&
+            stored) {
+        const auto row = stored.find(file.asset_path);
+        if (row == stored.end()) { return false; }
+        unsigned long long length = 0;
+        uint32_t crc = 0;
+        return encode_file(
+                   file.local_path,
+                   [&](const char* data, size_t size) {
+                       length += size;
+                       crc = crc32_update(crc, data, size);
+                       return true;
+                   }) &&
+               row->second == std::make_pair(length, crc);
+    }
+
+    bool upload_file(const File& file) {
+        MYSQL_BIND params[3];
+        memset(params, 0, sizeof(params));
+        unsigned long path_length = file.asset_path.size();
+        params[0].buffer_type = MYSQL_TYPE_STRING;
+        params[0].buffer = const_cast<char*>(file.asset_path.data());
+        params[0].buffer_length = path_length;
+        params[0].length = &path_length;
+        // the data is sent with mysql_stmt_send_long_data
+        params[1].buffer_type = MYSQL_TYPE_LONG_BLOB;
+        unsigned long encoding_length = options.encoding.size();
+        params[2].buffer_type = MYSQL_TYPE_STRING;
+        params[2].buffer = const_cast<char*>(options.encoding.data());
+        params[2].buffer_length = encoding_length;
+        params[2].length = &encoding_length;
+        if (mysql_stmt_bind_param(statement, params) != 0) {
+            report(file.local_path, mysql_stmt_error(statement));
+            return false;
+        }
+        // an empty file still sends one piece, so the data isn't NULL
+        bool sent = false;
+        const auto send = [&](const char* data, size_t size) {
+            sent = true;
+            return mysql_stmt_send_long_data(statement, 1, data, size) == 0;
+        };
+        if (!encode_file(file.local_path, send) ||
+            (!sent && !send("", 0)) || mysql_stmt_execute(statement) != 0) {
+            const auto error = mysql_stmt_error(statement);
+            report(file.local_path, *error ? error : "could not read");
+            mysql_stmt_reset(statement);
+            return false;
+        }
+        return true;
+    }
+
+    MYSQL* connection;
+    MYSQL_STMT* statement;
+};
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (!parse_options(argc, argv)) {
+        print_usage();
+        return 1;
+    }
+    const auto host = getenv(usd_sql::HOST_ENV_VAR);
+    if (host == nullptr) {
+        std::cerr << "Set " << usd_sql::HOST_ENV_VAR
+                  << " to the server to upload to" << std::endl;
+        return 1;
+    }
+    server_name = host;
+    table_name = get_env_var(server_name, usd_sql::TABLE_ENV_VAR, "headers");
+    encoding_column =
+        get_env_var(server_name, usd_sql::ENCODING_COLUMN_ENV_VAR, "");
+    if (usd_sql::create_encoder(options.encoding, options.level) == nullptr) {
+        std::cerr << "Unsupported encoding " << options.encoding
+                  << ", supported: " << usd_sql::supported_encodings()
+                  << std::endl;
+        return 1;
+    }
+    if (encoding_column.empty() && options.encoding != "raw") {
+        std::cerr << "Set " << usd_sql::ENCODING_COLUMN_ENV_VAR
+                  << " to store compressed data" << std::endl;
+        return 1;
+    }
+    if (nftw(options.directory.c_str(), collect_file, 64, FTW_PHYS) != 0) {
+        std::cerr << "Failed to read " << options.directory << std::endl;
+        return 1;
+    }
+    std::sort(
+        files.begin(), files.end(), [](const File& a, const File& b) {
+            return a.asset_path < b.asset_path;
+        });
+
+    my_init();
+    const size_t num_batches =
+        (files.size() + options.batch_size - 1) / options.batch_size;
+    std::atomic<size_t> next_batch(0);
+    std::atomic<size_t> uploaded(0);
+    std::atomic<size_t> unchanged(0);
+    std::atomic<size_t> failed(0);
+    auto upload_batches = [&]() {
+        my_thread_init();
+        {
+            Uploader uploader;
+            for (auto batch = next_batch++; batch < num_batches;
+                 batch = next_batch++) {
+                const auto first = batch * options.batch_size;
+                const auto count =
+                    std::min(options.batch_size, files.size() - first);
+                if (uploader) {
+                    uploader.upload(files.cbegin() + first, count);
+                } else {
+                    uploader.failed += count;
+                }
+            }
+            uploaded += uploader.uploaded;
+            unchanged += uploader.unchanged;
+            failed += uploader.failed;
+        }
+        my_thread_end();
+    };
+    std::vector<std::thread> threads;
+    const auto num_threads = std::min(options.threads, num_batches);
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back(upload_batches);
+    }
+    for (auto& thread : threads) { thread.join(); }
+
+    std::cout << "uploaded " << uploaded << ", unchanged " << unchanged
+              << ", failed " << failed << " of " << files.size() << " files"
+              << std::endl;
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,298 @@
+#include "object_store.h"
+#include "s3.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+#include <pxr/base/tf/fileUtils.h>
+
+#include <aws/core/Aws.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+
+#include <cstdio>
+#include <iterator>
+#include <stdlib.h>
+#include <unistd.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    constexpr const char ALLOCATION_TAG[] = "s3resolver";
+
+    // get an environment variable
+    std::string get_env_var(const std::string& env_var, const std::string& default_value) {
+        const auto env_var_value = getenv(env_var.c_str());
+        return (env_var_value != nullptr) ? env_var_value : default_value;
+    }
+
+    // Map an AWS error onto the few cases the resolver handles differently
+    template <class Outcome>
+    usd_s3::StoreOutcome make_failure(const Outcome& outcome) {
+        const auto& error = outcome.GetError();
+        usd_s3::StoreStatus status = usd_s3::STORE_ERROR;
+        switch (error.GetResponseCode()) {
+            case Aws::Http::HttpResponseCode::NOT_MODIFIED:
+                status = usd_s3::STORE_NOT_MODIFIED;
+                break;
+            case Aws::Http::HttpResponseCode::NOT_FOUND:
+                status = usd_s3::STORE_NOT_FOUND;
+                break;
+            case Aws::Http::HttpResponseCode::SERVICE_UNAVAILABLE:
+            case Aws::Http::HttpResponseCode::TOO_MANY_REQUESTS:
+                status = usd_s3::STORE_THROTTLED;
+                break;
+            case Aws::Http::HttpResponseCode::REQUEST_TIMEOUT:
+            case Aws::Http::HttpResponseCode::GATEWAY_TIMEOUT:
+                status = usd_s3::STORE_TIMEOUT;
+                break;
+            default:
+                break;
+        }
+        if (error.GetErrorType() == Aws::S3::S3Errors::SLOW_DOWN ||
+                error.GetErrorType() == Aws::S3::S3Errors::THROTTLING) {
+            status = usd_s3::STORE_THROTTLED;
+        } else if (error.GetErrorType() == Aws::S3::S3Errors::REQUEST_TIMEOUT ||
+                error.GetErrorType() == Aws::S3::S3Errors::NETWORK_CONNECTION) {
+            status = usd_s3::STORE_TIMEOUT;
+        }
+        return usd_s3::StoreOutcome{status,
+            std::string(error.GetExceptionName().c_str()) + " " + error.GetMessage().c_str()};
+    }
+
+    template <class Request>
+    void set_object(Request& aws_request, const usd_s3::ObjectRequest& request) {
+        aws_request.WithBucket(request.bucket.c_str()).WithKey(request.key.c_str());
+        if (!request.version_id.empty()) {
+            aws_request.WithVersionId(request.version_id.c_str());
+        }
+    }
+
+    template <class Result>
+    void set_info(usd_s3::ObjectInfo& info, const std::string& key, const Result& result) {
+        info.key = key;
+        info.last_modified = result.GetLastModified().SecondsWithMSPrecision();
+        info.etag = result.GetETag().c_str();
+        info.size = static_cast<uint64_t>(result.GetContentLength());
+    }
+
+    class AwsObjectStore : public usd_s3::ObjectStore {
+    public:
+        AwsObjectStore() {
+            TF_DEBUG(S3_DBG).Msg("S3: client setup \n");
+            Aws::InitAPI(options);
+
+            Aws::Client::ClientConfiguration config;
+            // TODO: set executor to a PooledThreadExecutor to limit the number of threads
+            config.scheme = Aws::Http::Scheme::HTTP;
+
+            // set a custom endpoint e.g. an ActiveScale system node or minio server
+            if (!get_env_var(usd_s3::ENDPOINT_ENV_VAR, "").empty()) {
+                config.endpointOverride = (get_env_var(usd_s3::ENDPOINT_ENV_VAR, "")).c_str();
+            }
+            if (!get_env_var(usd_s3::PROXY_HOST_ENV_VAR, "").empty()) {
+                config.proxyHost = get_env_var(usd_s3::PROXY_HOST_ENV_VAR, "").c_str();
+                config.proxyPort = atoi(get_env_var(usd_s3::PROXY_PORT_ENV_VAR, "80").c_str());
+            }
+
+            // enough connections for the adaptive request limit to reach its
+            // maximum, see concurrency.h
+            config.maxConnections = static_cast<unsigned>(
+                std::max(1, atoi(get_env_var(usd_s3::MAX_REQUESTS_ENV_VAR, "25").c_str())));
+            config.connectTimeoutMs = 3000;
+            config.requestTimeoutMs = 3000;
+
+            // create a client with useVirtualAddressing=false to use path style addressing
+            // see https://github.com/aws/aws-sdk-cpp/issues/587
+            client = Aws::New<Aws::S3::S3Client>(ALLOCATION_TAG, config, Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never, false);
+        }
+
+        ~AwsObjectStore() override {
+            TF_DEBUG(S3_DBG).Msg("S3: client teardown \n");
+            Aws::Delete(client);
+            Aws::ShutdownAPI(options);
+        }
+
+        usd_s3::StoreOutcome head(
+                const usd_s3::ObjectRequest& request, usd_s3::ObjectInfo& info) override {
+            Aws::S3::Model::HeadObjectRequest head_request;
+            set_object(head_request, request);
+
+            auto outcome = client->HeadObject(head_request);
+            if (!outcome.IsSuccess()) {
+                return make_failure(outcome);
+            }
+            set_info(info, request.key, outcome.GetResult());
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome get(
+                const usd_s3::ObjectRequest& request, double if_modified_since,
+                const std::string& local_path, usd_s3::ObjectInfo& info) override {
+            Aws::S3::Model::GetObjectRequest object_request;
+            set_object(object_request, request);
+            if (if_modified_since > 0.0) {
+                object_request.WithIfModifiedSince(Aws::Utils::DateTime(if_modified_since));
+            }
+
+            // Stream the body straight to disk instead of buffering the whole
+            // object in memory, and only replace local_path once complete
+            std::string temp_path = local_path + ".XXXXXX";
+            const int fd = mkstemp(&temp_path[0]);
+            if (fd == -1) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR,
+                    "failed to create a temporary file for " + local_path};
+            }
+            close(fd);
+            object_request.SetResponseStreamFactory([&temp_path]() {
+                return Aws::New<Aws::FStream>(
+                    ALLOCATION_TAG, temp_path.c_str(),
+                    std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+            });
+
+            auto outcome = client->GetObject(object_request);
+            if (!outcome.IsSuccess()) {
+                remove(temp_path.c_str());
+                return make_failure(outcome);
+            }
+            auto& body = outcome.GetResult().GetBody();
+            body.flush();
+            if (!body.good() || rename(temp_path.c_str(), local_path.c_str()) != 0) {
+                remove(temp_path.c_str());
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR,
+                    "failed to write " + local_path};
+            }
+            set_info(info, request.key, outcome.GetResult());
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome range_get(
+                const usd_s3::ObjectRequest& request, uint64_t offset, uint64_t length,
+                std::string& data, usd_s3::ObjectInfo& info) override {
+            // there is no empty byte range, bytes=0--1 would wrap around
+            if (length == 0) {
+                data.clear();
+                return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+            }
+            Aws::S3::Model::GetObjectRequest object_request;
+            set_object(object_request, request);
+            object_request.WithRange(("bytes=" + std::to_string(offset) + "-" +
+                std::to_string(offset + length - 1)).c_str());
+
+            auto outcome = client->GetObject(object_request);
+            if (!outcome.IsSuccess()) {
+                return make_failure(outcome);
+            }
+            auto& body = outcome.GetResult().GetBody();
+            data.assign(std::istreambuf_iterator<char>(body), std::istreambuf_iterator<char>());
+            set_info(info, request.key, outcome.GetResult());
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome list(
+                const std::string& bucket, const std::string& prefix,
+                std::vector<usd_s3::ObjectInfo>& objects) override {
+            Aws::S3::Model::ListObjectsV2Request list_request;
+            list_request.WithBucket(bucket.c_str()).WithPrefix(prefix.c_str());
+            while (true) {
+                auto outcome = client->ListObjectsV2(list_request);
+                if (!outcome.IsSuccess()) {
+                    return make_failure(outcome);
+                }
+                for (const auto& object : outcome.GetResult().GetContents()) {
+                    objects.push_back(usd_s3::ObjectInfo{
+                        object.GetKey().c_str(),
+                        object.GetLastModified().SecondsWithMSPrecision(),
+                        object.GetETag().c_str(),
+                        static_cast<uint64_t>(object.GetSize())});
+                }
+                if (!outcome.GetResult().GetIsTruncated()) {
+                    break;
+                }
+                list_request.WithContinuationToken(outcome.GetResult().GetNextContinuationToken());
+            }
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome create_multipart(
+                const usd_s3::ObjectRequest& request, std::string& upload_id) override {
+            Aws::S3::Model::CreateMultipartUploadRequest create_request;
+            create_request.WithBucket(request.bucket.c_str()).WithKey(request.key.c_str());
+
+            auto outcome = client->CreateMultipartUpload(create_request);
+            if (!outcome.IsSuccess()) {
+                return make_failure(outcome);
+            }
+            upload_id = outcome.GetResult().GetUploadId().c_str();
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome upload_part(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id,
+                int part_number, const char* data, size_t size, std::string& etag) override {
+            Aws::S3::Model::UploadPartRequest part_request;
+            part_request.WithBucket(request.bucket.c_str()).WithKey(request.key.c_str())
+                .WithUploadId(upload_id.c_str()).WithPartNumber(part_number);
+            // send the part straight from the caller's buffer
+            Aws::Utils::Stream::PreallocatedStreamBuf buffer(
+                reinterpret_cast<unsigned char*>(const_cast<char*>(data)), size);
+            part_request.SetBody(Aws::MakeShared<Aws::IOStream>(ALLOCATION_TAG, &buffer));
+            part_request.SetContentLength(static_cast<long long>(size));
+
+            auto outcome = client->UploadPart(part_request);
+            if (!outcome.IsSuccess()) {
+                return make_failure(outcome);
+            }
+            etag = outcome.GetResult().GetETag().c_str();
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome complete_multipart(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id,
+                const std::vector<std::string>& etags) override {
+            Aws::S3::Model::CompletedMultipartUpload upload;
+            for (size_t i = 0; i < etags.size(); ++i) {
+                upload.AddParts(Aws::S3::Model::CompletedPart()
+                    .WithETag(etags[i].c_str()).WithPartNumber(static_cast<int>(i + 1)));
+            }
+            Aws::S3::Model::CompleteMultipartUploadRequest complete_request;
+            complete_request.WithBucket(request.bucket.c_str()).WithKey(request.key.c_str())
+                .WithUploadId(upload_id.c_str()).WithMultipartUpload(upload);
+
+            auto outcome = client->CompleteMultipartUpload(complete_request);
+            if (!outcome.IsSuccess()) {
+                return make_failure(outcome);
+            }
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+        usd_s3::StoreOutcome abort_multipart(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id) override {
+            Aws::S3::Model::AbortMultipartUploadRequest abort_request;
+            abort_request.WithBucket(request.bucket.c_str()).WithKey(request.key.c_str())
+                .WithUploadId(upload_id.c_str());
+
+            auto outcome = client->AbortMultipartUpload(abort_request);
+            if (!outcome.IsSuccess()) {
+                return make_failure(outcome);
+            }
+            return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+        }
+
+    private:
+        Aws::SDKOptions options;
+        Aws::S3::S3Client* client;
+    };
+}
+
+namespace usd_s3 {
+    std::unique_ptr<ObjectStore> create_aws_store() {
+        return std::unique_ptr<ObjectStore>(new AwsObjectStore());
+    }
+}
@@ -0,0 +1,202 @@
+#include "s3.h"
+
+#include <pxr/base/arch/fileSystem.h>
+#include <pxr/base/tf/fileUtils.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+// Resolve / fetch throughput of usd_s3::S3 versus thread count.
+// The objects are generated and served by test/bench_s3.py, which also
+// sets USD_S3_ENDPOINT to the local S3 stand-in before running this.
+//
+// USD_S3_BENCH_BUCKET  - bucket holding the generated objects (usd-s3-bench)
+// USD_S3_BENCH_SMALL   - number of small layers small/layer_#####.usda (2000)
+// USD_S3_BENCH_CRATES  - number of large crates crate/crate_#.usdc (4)
+// USD_S3_BENCH_THREADS - highest thread count to measure (16)
+
+namespace {
+    std::string get_env_var(const char* env_var, const std::string& default_value) {
+        const auto env_var_value = getenv(env_var);
+        return (env_var_value != nullptr) ? env_var_value : default_value;
+    }
+
+    int get_env_int(const char* env_var, int default_value) {
+        return atoi(get_env_var(env_var, std::to_string(default_value)).c_str());
+    }
+
+    usd_s3::S3& get_s3() {
+        static usd_s3::S3 s3;
+        return s3;
+    }
+
+    std::vector<std::string> generate_assets(const char* pattern, int count) {
+        const std::string bucket = get_env_var("USD_S3_BENCH_BUCKET", "usd-s3-bench");
+        std::vector<std::string> assets;
+        char name[256];
+        for (int i = 0; i < count; ++i) {
+            snprintf(name, sizeof(name), pattern, i);
+            assets.push_back(std::string(usd_s3::S3_PREFIX) + bucket + "/" + name);
+        }
+        return assets;
+    }
+
+    std::atomic<size_t> next_asset;
+
+    // Forget everything the resolver knows, and optionally remove the local
+    // copies so the next fetch has to download the full object again.
+    void reset_cache(const std::vector<std::string>& assets, bool remove_local) {
+        if (remove_local) {
+            for (const auto& asset : assets) {
+                const auto local_path = get_s3().resolve_name(asset);
+                if (TfPathExists(local_path)) {
+                    TfDeleteFile(local_path);
+                }
+            }
+        }
+        get_s3().refresh("");
+        next_asset = 0;
+    }
+
+    // Resolve only, assets are never fetched. This is the cost composition
+    // pays for every asset path it sees.
+    void BM_Resolve(benchmark::State& state, const std::vector<std::string>* assets) {
+        if (state.thread_index() == 0) {
+            reset_cache(*assets, false);
+        }
+        for (auto _ : state) {
+            const auto& asset = (*assets)[next_asset++ % assets->size()];
+            benchmark::DoNotOptimize(get_s3().resolve_name(asset));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    // Resolve fetched assets, which checks the object store for changes.
+    void BM_ResolveFetched(benchmark::State& state, const std::vector<std::string>* assets) {
+        if (state.thread_index() == 0) {
+            reset_cache(*assets, false);
+            for (const auto& asset : *assets) {
+                get_s3().fetch_asset(asset, get_s3().resolve_name(asset));
+            }
+        }
+        for (auto _ : state) {
+            const auto& asset = (*assets)[next_asset++ % assets->size()];
+            benchmark::DoNotOptimize(get_s3().resolve_name(asset));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    // Resolve and fetch every asset once. Cold fetches download the objects,
+    // warm fetches find a local copy and only revalidate it.
+    void BM_Fetch(benchmark::State& state, const std::vector<std::string>* assets, bool cold) {
+        if (state.thread_index() == 0) {
+            reset_cache(*assets, cold);
+        }
+        int64_t bytes = 0;
+        for (auto _ : state) {
+            const auto& asset = (*assets)[next_asset++ % assets->size()];
+            const auto local_path = get_s3().resolve_name(asset);
+            if (!get_s3().fetch_asset(asset, local_path)) {
+                state.SkipWithError("fetch_asset failed");
+                break;
+            }
+            bytes += ArchGetFileLength(local_path.c_str());
+        }
+        state.SetItemsProcessed(state.iterations());
+        state.SetBytesProcessed(bytes);
+    }
+
+    // Resolve fetched assets while their USD_S3_TTL runs, reported as
+    // resolve calls per second. Only then is a resolve a cache hit without
+    // a lock or an allocation; with the default TTL of 0 every resolve
+    // sends a HEAD request instead, the label shows which one was measured.
+    void BM_ResolveHit(benchmark::State& state, const std::vector<std::string>* assets) {
+        if (state.thread_index() == 0) {
+            reset_cache(*assets, false);
+            for (const auto& asset : *assets) {
+                get_s3().fetch_asset(asset, get_s3().resolve_name(asset));
+            }
+        }
+        state.SetLabel("USD_S3_TTL=" + get_env_var(usd_s3::TTL_ENV_VAR, "0"));
+        size_t i = state.thread_index();
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(get_s3().resolve_name((*assets)[i++ % assets->size()]));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    // Fetch and query the timestamp of fetched assets, as Sdf does for every
+    // layer it opens. Neither needs the object store.
+    void BM_FetchHit(benchmark::State& state, const std::vector<std::string>* assets) {
+        if (state.thread_index() == 0) {
+            reset_cache(*assets, false);
+            for (const auto& asset : *assets) {
+                get_s3().fetch_asset(asset, get_s3().resolve_name(asset));
+            }
+        }
+        size_t i = state.thread_index();
+        for (auto _ : state) {
+            const auto& asset = (*assets)[i++ % assets->size()];
+            benchmark::DoNotOptimize(get_s3().fetch_asset(asset, std::string()));
+            benchmark::DoNotOptimize(get_s3().get_timestamp(asset));
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    // Every benchmark covers the whole asset list once, split over the threads
+    template <class... Args>
+    void register_benchmark(
+            const std::string& name, size_t asset_count, int max_threads, Args&&... args) {
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            const auto iterations = std::max<size_t>(1, asset_count / threads);
+            benchmark::RegisterBenchmark(name.c_str(), std::forward<Args>(args)...)
+                ->Threads(threads)
+                ->Iterations(iterations)
+                ->UseRealTime()
+                ->Unit(benchmark::kMillisecond);
+        }
+    }
+
+    // Cache hit benchmarks are cheap enough to let the library pick the
+    // number of iterations
+    template <class... Args>
+    void register_hit_benchmark(const std::string& name, int max_threads, Args&&... args) {
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            benchmark::RegisterBenchmark(name.c_str(), std::forward<Args>(args)...)
+                ->Threads(threads)
+                ->UseRealTime();
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const auto small = generate_assets(
+        "small/layer_%05d.usda", get_env_int("USD_S3_BENCH_SMALL", 2000));
+    const auto crates = generate_assets(
+        "crate/crate_%d.usdc", get_env_int("USD_S3_BENCH_CRATES", 4));
+    const int max_threads = get_env_int("USD_S3_BENCH_THREADS", 16);
+
+    register_benchmark("resolve/small", small.size(), max_threads, BM_Resolve, &small);
+    register_benchmark("resolve_fetched/small", small.size(), max_threads, BM_ResolveFetched, &small);
+    register_hit_benchmark("resolve_hit/small", max_threads, BM_ResolveHit, &small);
+    register_hit_benchmark("fetch_hit/small", max_threads, BM_FetchHit, &small);
+    register_benchmark("fetch_cold/small", small.size(), max_threads, BM_Fetch, &small, true);
+    register_benchmark("fetch_warm/small", small.size(), max_threads, BM_Fetch, &small, false);
+    register_benchmark("fetch_cold/crate", crates.size(), max_threads, BM_Fetch, &crates, true);
+    register_benchmark("fetch_warm/crate", crates.size(), max_threads, BM_Fetch, &crates, false);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,244 @@
+#include "concurrency.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+
+#include <algorithm>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+    using steady_clock = std::chrono::steady_clock;
+
+    constexpr double THROTTLED_DECREASE = 0.5;
+    constexpr double LATENCY_DECREASE = 0.9;
+    // The recent latency rising above this many times the long term
+    // average counts as congestion. Requests to an object store vary a lot,
+    // comparing with the lowest latency would see congestion all the time.
+    constexpr double LATENCY_TOLERANCE = 2.0;
+    // Weight of a new sample in the recent and the long term averages
+    constexpr double SAMPLE_WEIGHT = 0.2;
+    constexpr double BASELINE_WEIGHT = 0.01;
+    // Larger transfers take as long as the bandwidth needs, their time says
+    // little about the congestion of the endpoint
+    constexpr uint64_t SMALL_REQUEST_BYTES = 1 << 20;
+    constexpr auto THROUGHPUT_WINDOW = std::chrono::seconds(1);
+}
+
+namespace usd_s3 {
+    struct ConcurrencyController::Endpoint {
+        double limit;
+        size_t in_flight = 0;
+        uint64_t requests = 0;
+        uint64_t throttled = 0;
+        uint64_t bytes = 0;
+        double latency = 0.0;
+        double baseline_latency = 0.0;
+        double throughput = 0.0;
+        steady_clock::time_point last_decrease;
+        steady_clock::time_point window_start = steady_clock::now();
+        uint64_t window_bytes = 0;
+
+        explicit Endpoint(double limit) : limit(limit) {}
+
+        size_t allowed() const {
+            return std::max<size_t>(1, static_cast<size_t>(limit));
+        }
+    };
+
+    ConcurrencyController::ConcurrencyController(size_t initial_limit, size_t max_limit)
+        : initial_limit(static_cast<double>(std::max<size_t>(initial_limit, 1))),
+          max_limit(static_cast<double>(std::max(max_limit, std::max<size_t>(initial_limit, 1)))) {
+    }
+
+    ConcurrencyController::~ConcurrencyController() {
+    }
+
+    ConcurrencyController::Permit::Permit(ConcurrencyController& controller, const std::string& endpoint)
+        : controller(controller),
+          endpoint(controller.acquire(endpoint)),
+          started(steady_clock::now()),
+          reported(false) {
+    }
+
+    ConcurrencyController::Permit::~Permit() {
+        if (!reported) {
+            done(STORE_ERROR, 0);
+        }
+    }
+
+    void ConcurrencyController::Permit::done(StoreStatus status, uint64_t bytes) {
+        reported = true;
+        const double seconds = std::chrono::duration<double>(steady_clock::now() - started).count();
+        controller.release(endpoint, status, bytes, seconds);
+    }
+
+    std::map<std::string, EndpointMetrics> ConcurrencyController::metrics() {
+        mutex_scoped_lock lock(mutex);
+        std::map<std::string, EndpointMetrics> result;
+        for (const auto& endpoint : endpoints) {
+            const Endpoint& state = *endpoint.second;
+            result[endpoint.first] = EndpointMetrics{
+                state.allowed(), state.in_flight, state.requests, state.throttled,
+                state.bytes, state.latency, state.throughput};
+        }
+        return result;
+    }
+
+    ConcurrencyController::Endpoint& ConcurrencyController::acquire(const std::string& name) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto& slot = endpoints[name];
+        if (slot == nullptr) {
+            slot.reset(new Endpoint(initial_limit));
+        }
+        Endpoint& endpoint = *slot;
+        released.wait(lock, [&]() { return endpoint.in_flight < endpoint.allowed(); });
+        ++endpoint.in_flight;
+        return endpoint;
+    }
+
+    void ConcurrencyController::release(
+            Endpoint& endpoint, StoreStatus status, uint64_t bytes, double seconds) {
+        {
+            mutex_scoped_lock lock(mutex);
+            const bool was_limited = endpoint.in_flight >= endpoint.allowed();
+            --endpoint.in_flight;
+            ++endpoint.requests;
+            endpoint.bytes += bytes;
+
+            const auto now = steady_clock::now();
+            endpoint.window_bytes += bytes;
+            if (now - endpoint.window_start >= THROUGHPUT_WINDOW) {
+                const double window = std::chrono::duration<double>(now - endpoint.window_start).count();
+                endpoint.throughput += SAMPLE_WEIGHT * (endpoint.window_bytes / window - endpoint.throughput);
+                endpoint.window_start = now;
+                endpoint.window_bytes = 0;
+            }
+
+            bool congested = false;
+            double decrease = 1.0;
+            // missing objects, denied access and other client errors say
+            // nothing about the load of the store
+            if (status == STORE_THROTTLED || status == STORE_TIMEOUT) {
+                ++endpoint.throttled;
+                congested = true;
+                decrease = THROTTLED_DECREASE;
+            } else if (bytes < SMALL_REQUEST_BYTES) {
+                if (endpoint.latency == 0.0) {
+                    endpoint.latency = seconds;
+                    endpoint.baseline_latency = seconds;
+                }
+                endpoint.latency += SAMPLE_WEIGHT * (seconds - endpoint.latency);
+                endpoint.baseline_latency += BASELINE_WEIGHT * (seconds - endpoint.baseline_latency);
+                if (endpoint.latency > LATENCY_TOLERANCE * endpoint.baseline_latency) {
+                    congested = true;
+                    decrease = LATENCY_DECREASE;
+                }
+            }
+
+            if (congested) {
+                // once per round trip, the other requests in flight saw the
+                // same congestion
+                const auto round_trip = std::chrono::duration_cast<steady_clock::duration>(
+                    std::chrono::duration<double>(std::max(endpoint.latency, seconds)));
+                if (now - endpoint.last_decrease >= round_trip) {
+                    endpoint.limit = std::max(1.0, endpoint.limit * decrease);
+                    endpoint.last_decrease = now;
+                    TF_DEBUG(S3_DBG).Msg("S3: request limit lowered to %zu (%s)\n",
+                        endpoint.allowed(), decrease == THROTTLED_DECREASE ? "throttled" : "latency");
+                }
+            } else if (was_limited) {
+                endpoint.limit = std::min(max_limit, endpoint.limit + 1.0 / endpoint.limit);
+            }
+        }
+        released.notify_all();
+    }
+}
+
+namespace {
+    // Every request of the wrapped store waits for a slot of its bucket
+    class AdaptiveObjectStore : public usd_s3::ObjectStore {
+    public:
+        AdaptiveObjectStore(std::unique_ptr<usd_s3::ObjectStore> store, std::shared_ptr<usd_s3::ConcurrencyController> controller)
+            : store(std::move(store)), controller(std::move(controller)) {
+        }
+
+        usd_s3::StoreOutcome head(const usd_s3::ObjectRequest& request, usd_s3::ObjectInfo& info) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->head(request, info);
+            permit.done(outcome.status, 0);
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome get(
+                const usd_s3::ObjectRequest& request, double if_modified_since,
+                const std::string& local_path, usd_s3::ObjectInfo& info) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->get(request, if_modified_since, local_path, info);
+            permit.done(outcome.status, outcome.is_success() ? info.size : 0);
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome range_get(
+                const usd_s3::ObjectRequest& request, uint64_t offset, uint64_t length,
+                std::string& data, usd_s3::ObjectInfo& info) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->range_get(request, offset, length, data, info);
+            permit.done(outcome.status, data.size());
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome list(
+                const std::string& bucket, const std::string& prefix,
+                std::vector<usd_s3::ObjectInfo>& objects) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, bucket);
+            const auto outcome = store->list(bucket, prefix, objects);
+            permit.done(outcome.status, 0);
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome create_multipart(const usd_s3::ObjectRequest& request, std::string& upload_id) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->create_multipart(request, upload_id);
+            permit.done(outcome.status, 0);
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome upload_part(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id, int part_number,
+                const char* data, size_t size, std::string& etag) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->upload_part(request, upload_id, part_number, data, size, etag);
+            permit.done(outcome.status, outcome.is_success() ? size : 0);
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome complete_multipart(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id,
+                const std::vector<std::string>& etags) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->complete_multipart(request, upload_id, etags);
+            permit.done(outcome.status, 0);
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome abort_multipart(const usd_s3::ObjectRequest& request, const std::string& upload_id) override {
+            usd_s3::ConcurrencyController::Permit permit(*controller, request.bucket);
+            const auto outcome = store->abort_multipart(request, upload_id);
+            permit.done(outcome.status, 0);
+            return outcome;
+        }
+
+    private:
+        std::unique_ptr<usd_s3::ObjectStore> store;
+        std::shared_ptr<usd_s3::ConcurrencyController> controller;
+    };
+}
+
+namespace usd_s3 {
+    std::unique_ptr<ObjectStore> create_adaptive_store(
+            std::unique_ptr<ObjectStore> store, std::shared_ptr<ConcurrencyController> controller) {
+        return std::unique_ptr<ObjectStore>(new AdaptiveObjectStore(std::move(store), std::move(controller)));
+    }
+}
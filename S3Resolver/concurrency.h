@@ -0,0 +1,72 @@
+#ifndef CONCURRENCY_H
+#define CONCURRENCY_H
+
+#include "object_store.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace usd_s3 {
+    // The request limit of an endpoint and what it was derived from
+    struct EndpointMetrics {
+        size_t limit;           // requests allowed in flight
+        size_t in_flight;
+        uint64_t requests;
+        uint64_t throttled;     // SlowDown responses and timeouts
+        uint64_t bytes;         // transferred
+        double latency;         // moving average of small requests, seconds
+        double throughput;      // moving average, bytes per second
+    };
+
+    // Adjusts the number of requests in flight per endpoint (bucket) with
+    // additive increase, multiplicative decrease: every successful request
+    // made while the limit was in use adds 1 / limit, so the limit grows by
+    // one per round of requests. Throttling responses and timeouts halve it,
+    // and the latency of small requests rising well above its long term
+    // average lowers it by a tenth. A decrease is applied once per round trip, as
+    // the requests in flight at the time all see the same congestion.
+    class ConcurrencyController {
+        struct Endpoint;
+
+    public:
+        ConcurrencyController(size_t initial_limit, size_t max_limit);
+        ~ConcurrencyController();
+
+        // Holds a request slot of an endpoint while in scope, report the
+        // outcome before it goes out of scope
+        class Permit {
+        public:
+            Permit(ConcurrencyController& controller, const std::string& endpoint);
+            ~Permit();
+            void done(StoreStatus status, uint64_t bytes);
+
+        private:
+            ConcurrencyController& controller;
+            Endpoint& endpoint;
+            std::chrono::steady_clock::time_point started;
+            bool reported;
+        };
+
+        std::map<std::string, EndpointMetrics> metrics();
+
+    private:
+        Endpoint& acquire(const std::string& endpoint);
+        void release(Endpoint& endpoint, StoreStatus status, uint64_t bytes, double seconds);
+
+        const double initial_limit;
+        const double max_limit;
+        std::mutex mutex;
+        std::condition_variable released;
+        std::map<std::string, std::unique_ptr<Endpoint>> endpoints;
+    };
+
+    // Sends the requests of store through controller
+    std::unique_ptr<ObjectStore> create_adaptive_store(
+        std::unique_ptr<ObjectStore> store, std::shared_ptr<ConcurrencyController> controller);
+}
+
+#endif // CONCURRENCY_H
@@ -0,0 +1,347 @@
+#include "daemon.h"
+#include "s3.h"
+#include "debugCodes.h"
+
+#include "cache_engine.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+
+    bool make_address(const std::string& socket_path, sockaddr_un& address) {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+        return true;
+    }
+
+    // Blocking reads and writes on fd fail with EAGAIN after seconds, so a
+    // stuck peer can't hang the other side
+    void set_timeout(int fd, int option, int seconds) {
+        timeval timeout{seconds, 0};
+        setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+    }
+
+    bool write_all(int fd, const std::string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            // a peer gone away must not raise SIGPIPE in the resolving process
+            const auto count = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    // Read up to the next newline, buffer keeps what was read past it
+    bool read_line(int fd, std::string& buffer, std::string& line) {
+        size_t newline;
+        while ((newline = buffer.find('\n')) == std::string::npos) {
+            char chunk[4096];
+            const auto count = read(fd, chunk, sizeof(chunk));
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            buffer.append(chunk, static_cast<size_t>(count));
+        }
+        line = buffer.substr(0, newline);
+        buffer.erase(0, newline + 1);
+        return true;
+    }
+
+    // Fields are escaped like C strings, so paths may hold tabs and newlines
+    void append_escaped(std::string& line, const std::string& field) {
+        for (const char c : field) {
+            if (c == '\\') {
+                line += "\\\\";
+            } else if (c == '\t') {
+                line += "\\t";
+            } else if (c == '\n') {
+                line += "\\n";
+            } else {
+                line += c;
+            }
+        }
+    }
+
+    std::string join_fields(const std::vector<std::string>& fields) {
+        std::string line;
+        for (const auto& field : fields) {
+            if (!line.empty()) {
+                line += '\t';
+            }
+            append_escaped(line, field);
+        }
+        line += '\n';
+        return line;
+    }
+
+    std::vector<std::string> split_fields(const std::string& line) {
+        std::vector<std::string> fields(1);
+        for (size_t i = 0; i < line.size(); ++i) {
+            const char c = line[i];
+            if (c == '\t') {
+                fields.emplace_back();
+            } else if (c == '\\' && i + 1 < line.size()) {
+                const char escaped = line[++i];
+                fields.back() += escaped == 't' ? '\t' : escaped == 'n' ? '\n' : escaped;
+            } else {
+                fields.back() += c;
+            }
+        }
+        return fields;
+    }
+
+    std::string format_metrics(const usd_cache::Metrics& metrics) {
+        std::ostringstream reply;
+        reply << metrics.hits << ' ' << metrics.misses << ' ' << metrics.fetches << ' '
+              << metrics.fetch_failures << ' ' << metrics.joined << ' ' << metrics.revalidations << ' '
+              << metrics.stale << ' ' << metrics.changes << ' ' << metrics.evictions << ' '
+              << metrics.fetched_bytes << ' ' << metrics.cached_bytes << ' ' << metrics.entries;
+        return reply.str();
+    }
+
+    // Answer one request with a reply line
+    std::string handle_request(usd_s3::S3& s3, const std::vector<std::string>& fields) {
+        const auto& command = fields[0];
+        char timestamp[32];
+        std::string value;
+        if (command == "ping" && fields.size() == 1) {
+        } else if (command == "resolve" && fields.size() == 2) {
+            value = s3.resolve_name(fields[1]);
+        } else if (command == "fetch" && fields.size() == 3) {
+            const auto priority = atoi(fields[2].c_str()) == usd_s3::PRIORITY_PREFETCH
+                ? usd_s3::PRIORITY_PREFETCH : usd_s3::PRIORITY_DEMAND;
+            value = s3.fetch_asset(fields[1], std::string(), priority) ? "1" : "0";
+        } else if (command == "timestamp" && fields.size() == 2) {
+            snprintf(timestamp, sizeof(timestamp), "%.17g", s3.get_timestamp(fields[1]));
+            value = timestamp;
+        } else if (command == "save" && fields.size() == 3) {
+            value = s3.save_asset(fields[1], fields[2]) ? "1" : "0";
+        } else if (command == "refresh" && fields.size() == 2) {
+            s3.refresh(fields[1]);
+        } else if (command == "save_index" && fields.size() == 1) {
+            s3.save_index();
+        } else if (command == "metrics" && fields.size() == 1) {
+            value = format_metrics(s3.get_metrics());
+        } else {
+            return join_fields({"error", "unknown request " + command});
+        }
+        return join_fields({"ok", value});
+    }
+}
+
+namespace usd_s3 {
+    DaemonClient::DaemonClient(const std::string& socket_path, int timeout) :
+        socket_path(socket_path), timeout(timeout) {
+    }
+
+    DaemonClient::~DaemonClient() {
+        for (const auto& connection : idle) {
+            close(connection.fd);
+        }
+    }
+
+    bool DaemonClient::connect_socket(Connection& connection) {
+        sockaddr_un address;
+        if (!make_address(socket_path, address)) {
+            return false;
+        }
+        connection.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connection.fd == -1) {
+            return false;
+        }
+        // also bounds connect when the daemon's backlog is full
+        if (timeout > 0) {
+            set_timeout(connection.fd, SO_RCVTIMEO, timeout);
+            set_timeout(connection.fd, SO_SNDTIMEO, timeout);
+        }
+        if (connect(connection.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            const int error = errno;
+            close(connection.fd);
+            errno = error;
+            return false;
+        }
+        return true;
+    }
+
+    bool DaemonClient::request(
+            const std::vector<std::string>& fields, std::string& reply, bool* timed_out) {
+        if (timed_out != nullptr) {
+            *timed_out = false;
+        }
+        Connection connection{-1, std::string()};
+        {
+            mutex_scoped_lock lock(idle_mutex);
+            if (!idle.empty()) {
+                connection = std::move(idle.back());
+                idle.pop_back();
+            }
+        }
+        if (connection.fd == -1 && !connect_socket(connection)) {
+            if (timed_out != nullptr) {
+                *timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            return false;
+        }
+
+        std::string line = join_fields(fields);
+        if (!write_all(connection.fd, line) || !read_line(connection.fd, connection.buffer, line)) {
+            // SO_RCVTIMEO and SO_SNDTIMEO expired, a late reply must not
+            // be taken for the next request, so the connection goes
+            if (timed_out != nullptr) {
+                *timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            close(connection.fd);
+            return false;
+        }
+        {
+            mutex_scoped_lock lock(idle_mutex);
+            idle.push_back(std::move(connection));
+        }
+
+        const auto reply_fields = split_fields(line);
+        const bool success = reply_fields[0] == "ok";
+        reply = reply_fields.size() > 1 ? reply_fields[1] : std::string();
+        if (!success) {
+            TF_DEBUG(S3_DBG).Msg("S3: daemon request %s failed: %s\n", fields[0].c_str(), reply.c_str());
+        }
+        return success;
+    }
+
+    int run_daemon(const std::string& socket_path) {
+        // the S3 below works in process, not as a client of itself
+        unsetenv(DAEMON_SOCKET_ENV_VAR);
+        sockaddr_un address;
+        if (!make_address(socket_path, address)) {
+            std::cerr << "invalid socket path " << socket_path << std::endl;
+            return 1;
+        }
+        {
+            DaemonClient running(socket_path);
+            std::string reply;
+            if (running.request({"ping"}, reply)) {
+                std::cerr << "a daemon is already serving " << socket_path << std::endl;
+                return 1;
+            }
+        }
+
+        // the signals are taken by sigwait below, every thread started from
+        // here on inherits the mask
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        S3 s3;
+        const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        unlink(socket_path.c_str()); // left behind by a daemon that was killed
+        // only the owner may connect, the daemon saves any file a client
+        // names with its own credentials. A socket doesn't accept before
+        // listen, so there is no window with the default mode.
+        if (listener == -1 ||
+                bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+                chmod(socket_path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+                listen(listener, SOMAXCONN) != 0) {
+            std::cerr << "failed to listen on " << socket_path << ": " << strerror(errno) << std::endl;
+            if (listener != -1) {
+                close(listener);
+            }
+            return 1;
+        }
+        TF_DEBUG(S3_DBG).Msg("S3: daemon serving %s\n", socket_path.c_str());
+
+        // one detached thread per client connection, they stay open between
+        // requests and leave clients when the connection closes
+        std::mutex clients_mutex;
+        std::condition_variable clients_done;
+        std::set<int> clients;
+        bool stopping = false;
+        auto serve = [&](int fd) {
+            std::string buffer;
+            std::string line;
+            while (read_line(fd, buffer, line)) {
+                if (!write_all(fd, handle_request(s3, split_fields(line)))) {
+                    break;
+                }
+            }
+            mutex_scoped_lock lock(clients_mutex);
+            close(fd);
+            clients.erase(fd);
+            clients_done.notify_all();
+        };
+        std::thread acceptor([&]() {
+            while (true) {
+                const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd == -1) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    return;
+                }
+                mutex_scoped_lock lock(clients_mutex);
+                if (stopping) {
+                    close(fd);
+                    return;
+                }
+                // a client that stops reading can't hold its thread forever
+                set_timeout(fd, SO_SNDTIMEO, DAEMON_TIMEOUT);
+                clients.insert(fd);
+                std::thread(serve, fd).detach();
+            }
+        });
+
+        int signal_number = 0;
+        sigwait(&signals, &signal_number);
+        TF_DEBUG(S3_DBG).Msg("S3: daemon stopping on signal %d\n", signal_number);
+        {
+            mutex_scoped_lock lock(clients_mutex);
+            stopping = true;
+            for (const int fd : clients) {
+                shutdown(fd, SHUT_RDWR);
+            }
+        }
+        // wakes the acceptor
+        shutdown(listener, SHUT_RDWR);
+        acceptor.join();
+        close(listener);
+        unlink(socket_path.c_str());
+        // s3 must outlive the requests in flight
+        std::unique_lock<std::mutex> lock(clients_mutex);
+        clients_done.wait(lock, [&]() { return clients.empty(); });
+        // the cache index is written when s3 goes away
+        return 0;
+    }
+}
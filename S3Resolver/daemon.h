@@ -0,0 +1,52 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace usd_s3 {
+    // Seconds a request waits for the daemon, fetches of large objects
+    // answer only once they are downloaded
+    constexpr int DAEMON_TIMEOUT = 120;
+
+    // Talks to usd_s3_daemon over its Unix socket. A request is a line of
+    // tab separated fields, the command first, the reply a line with "ok"
+    // or "error" and a value. Backslashes, tabs and newlines in fields are
+    // escaped as \\, \t and \n. Safe to use from multiple threads, a request
+    // takes an idle connection or opens another one. A request that takes
+    // longer than timeout seconds fails, 0 waits forever.
+    class DaemonClient {
+    public:
+        explicit DaemonClient(const std::string& socket_path, int timeout = DAEMON_TIMEOUT);
+        ~DaemonClient();
+
+        // Returns false if the daemon couldn't be reached or rejected the
+        // request, reply holds the value otherwise. timed_out tells a
+        // daemon that didn't answer in time from one that went away.
+        bool request(
+            const std::vector<std::string>& fields, std::string& reply,
+            bool* timed_out = nullptr);
+
+    private:
+        struct Connection {
+            int fd;
+            std::string buffer; // read past the last reply
+        };
+
+        bool connect_socket(Connection& connection);
+
+        const std::string socket_path;
+        const int timeout;
+        std::mutex idle_mutex;
+        std::vector<Connection> idle;
+    };
+
+    // Serve DaemonClients on socket_path with an in-process S3, which owns
+    // the object store connections and the cache for every process of the
+    // host, until SIGINT or SIGTERM. Only the owner can connect to the
+    // socket. Returns the exit code.
+    int run_daemon(const std::string& socket_path);
+}
+
+#endif // DAEMON_H
@@ -0,0 +1,31 @@
+#include "daemon.h"
+#include "s3.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Serve the S3 cache of this host to the resolvers of every USD process,
+// which connect when USD_S3_DAEMON_SOCKET names the same socket.
+int main(int argc, char* argv[]) {
+    const char* socket_env = getenv(usd_s3::DAEMON_SOCKET_ENV_VAR);
+    std::string socket_path = socket_env == nullptr ? "" : socket_env;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else {
+            socket_path.clear();
+            break;
+        }
+    }
+
+    if (socket_path.empty()) {
+        std::cerr << "Usage: usd_s3_daemon [-s socket]" << std::endl
+                  << "The socket defaults to " << usd_s3::DAEMON_SOCKET_ENV_VAR << std::endl;
+        return -1;
+    }
+
+    return usd_s3::run_daemon(socket_path);
+}
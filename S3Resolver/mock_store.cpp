@@ -0,0 +1,355 @@
+#include "object_store.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+#include <pxr/base/tf/fileUtils.h>
+#include <pxr/base/tf/pathUtils.h>
+#include <pxr/base/tf/stringUtils.h>
+
+#include <boost/functional/hash.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+    using steady_clock = std::chrono::steady_clock;
+
+    constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    // get an environment variable
+    std::string get_env_var(const std::string& env_var, const std::string& default_value) {
+        const auto env_var_value = getenv(env_var.c_str());
+        return (env_var_value != nullptr) ? env_var_value : default_value;
+    }
+
+    double get_env_double(const std::string& env_var, double default_value) {
+        const auto env_var_value = getenv(env_var.c_str());
+        return (env_var_value != nullptr) ? atof(env_var_value) : default_value;
+    }
+
+    usd_s3::StoreOutcome success() {
+        return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+    }
+
+    // In process stand-in for an object store. Objects are the files below
+    // the root directory; every request pays the configured latency, all
+    // transfers share the configured bandwidth and requests fail at random
+    // with the configured rates. A fixed seed makes a single threaded run
+    // fully reproducible.
+    class MockObjectStore : public usd_s3::ObjectStore {
+    public:
+        MockObjectStore() :
+            root(TfNormPath(get_env_var(usd_s3::MOCK_ROOT_ENV_VAR, "/tmp/usd_s3_mock"))),
+            latency(get_env_double(usd_s3::MOCK_LATENCY_ENV_VAR, 0.0) / 1000.0),
+            bandwidth(get_env_double(usd_s3::MOCK_BANDWIDTH_ENV_VAR, 0.0) * (1 << 20)),
+            error_rate(get_env_double(usd_s3::MOCK_ERROR_RATE_ENV_VAR, 0.0)),
+            throttle_rate(get_env_double(usd_s3::MOCK_THROTTLE_RATE_ENV_VAR, 0.0)),
+            random(static_cast<unsigned int>(get_env_double(usd_s3::MOCK_SEED_ENV_VAR, 0.0))),
+            link_free(steady_clock::now()) {
+            TF_DEBUG(S3_DBG).Msg(
+                "S3: mock store at %s, latency %.3fs, bandwidth %.0fB/s, error rate %.3f, "
+                "throttle rate %.3f\n", root.c_str(), latency, bandwidth, error_rate,
+                throttle_rate);
+        }
+
+        usd_s3::StoreOutcome head(
+                const usd_s3::ObjectRequest& request, usd_s3::ObjectInfo& info) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (outcome.is_success()) {
+                outcome = stat_object(request, info);
+            }
+            return outcome;
+        }
+
+        usd_s3::StoreOutcome get(
+                const usd_s3::ObjectRequest& request, double if_modified_since,
+                const std::string& local_path, usd_s3::ObjectInfo& info) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (outcome.is_success()) {
+                outcome = stat_object(request, info);
+            }
+            if (!outcome.is_success()) {
+                return outcome;
+            }
+            if (if_modified_since > 0.0 && info.last_modified <= if_modified_since) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_NOT_MODIFIED, std::string()};
+            }
+
+            std::string temp_path = local_path + ".XXXXXX";
+            const int fd = mkstemp(&temp_path[0]);
+            if (fd == -1) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR,
+                    "failed to create a temporary file for " + local_path};
+            }
+            close(fd);
+            std::ifstream source(object_path(request), std::ios::in | std::ios::binary);
+            std::ofstream destination(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            std::vector<char> buffer(CHUNK_SIZE);
+            while (source) {
+                source.read(buffer.data(), buffer.size());
+                const auto count = source.gcount();
+                transfer(count);
+                destination.write(buffer.data(), count);
+            }
+            destination.close();
+            if (!destination || rename(temp_path.c_str(), local_path.c_str()) != 0) {
+                remove(temp_path.c_str());
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "failed to write " + local_path};
+            }
+            return success();
+        }
+
+        usd_s3::StoreOutcome range_get(
+                const usd_s3::ObjectRequest& request, uint64_t offset, uint64_t length,
+                std::string& data, usd_s3::ObjectInfo& info) override {
+            // like the AWS store, which can't ask for an empty range
+            if (length == 0) {
+                data.clear();
+                return usd_s3::StoreOutcome{usd_s3::STORE_OK, std::string()};
+            }
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (outcome.is_success()) {
+                outcome = stat_object(request, info);
+            }
+            if (!outcome.is_success()) {
+                return outcome;
+            }
+            if (offset >= info.size) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "range not satisfiable"};
+            }
+            length = std::min(length, info.size - offset);
+            std::ifstream source(object_path(request), std::ios::in | std::ios::binary);
+            source.seekg(offset);
+            data.resize(length);
+            source.read(&data[0], length);
+            data.resize(source.gcount());
+            transfer(data.size());
+            return success();
+        }
+
+        usd_s3::StoreOutcome list(
+                const std::string& bucket, const std::string& prefix,
+                std::vector<usd_s3::ObjectInfo>& objects) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (!outcome.is_success()) {
+                return outcome;
+            }
+            const std::string bucket_path = root + "/" + bucket;
+            if (!TfIsDir(bucket_path)) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_NOT_FOUND, "no such bucket " + bucket};
+            }
+            for (const auto& path : TfListDir(bucket_path, true)) {
+                const auto key = path.substr(bucket_path.size() + 1);
+                if (TfIsFile(path) && TfStringStartsWith(key, prefix)) {
+                    usd_s3::ObjectInfo info;
+                    stat_object(usd_s3::ObjectRequest{bucket, key, std::string()}, info);
+                    objects.push_back(info);
+                }
+            }
+            std::sort(objects.begin(), objects.end(),
+                [](const usd_s3::ObjectInfo& a, const usd_s3::ObjectInfo& b) {
+                    return a.key < b.key;
+                });
+            return success();
+        }
+
+        // Parts are staged as files below <root>/.uploads/<upload id> and
+        // concatenated into the object when the upload completes
+        usd_s3::StoreOutcome create_multipart(
+                const usd_s3::ObjectRequest& request, std::string& upload_id) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (!outcome.is_success()) {
+                return outcome;
+            }
+            upload_id = TfStringPrintf("%d-%zu", static_cast<int>(getpid()), next_upload++);
+            const std::string upload_path = staging_path(upload_id);
+            if (!TfMakeDirs(upload_path) && !TfIsDir(upload_path)) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "failed to create " + upload_path};
+            }
+            return success();
+        }
+
+        usd_s3::StoreOutcome upload_part(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id,
+                int part_number, const char* data, size_t size, std::string& etag) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (!outcome.is_success()) {
+                return outcome;
+            }
+            const std::string upload_path = staging_path(upload_id);
+            if (!TfIsDir(upload_path)) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_NOT_FOUND, "no such upload " + upload_id};
+            }
+            transfer(size);
+            std::ofstream part(TfStringPrintf("%s/%d", upload_path.c_str(), part_number),
+                std::ios::out | std::ios::binary | std::ios::trunc);
+            part.write(data, size);
+            part.close();
+            if (!part) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "failed to write part of " + request.key};
+            }
+            etag = part_etag(data, size);
+            return success();
+        }
+
+        usd_s3::StoreOutcome complete_multipart(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id,
+                const std::vector<std::string>& etags) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (!outcome.is_success()) {
+                return outcome;
+            }
+            const std::string upload_path = staging_path(upload_id);
+            const std::string local_path = object_path(request);
+            const std::string object_dir = TfGetPathName(local_path);
+            if (!TfIsDir(object_dir) && !TfMakeDirs(object_dir) && !TfIsDir(object_dir)) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "failed to create " + object_dir};
+            }
+            std::string temp_path = local_path + ".XXXXXX";
+            const int fd = mkstemp(&temp_path[0]);
+            if (fd == -1) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR,
+                    "failed to create a temporary file for " + local_path};
+            }
+            close(fd);
+            std::ofstream destination(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            for (size_t i = 0; i < etags.size(); ++i) {
+                std::ifstream source(TfStringPrintf("%s/%zu", upload_path.c_str(), i + 1),
+                    std::ios::in | std::ios::binary);
+                std::string data((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+                if (!source.is_open() || part_etag(data.data(), data.size()) != etags[i]) {
+                    destination.close();
+                    remove(temp_path.c_str());
+                    return usd_s3::StoreOutcome{usd_s3::STORE_ERROR,
+                        TfStringPrintf("InvalidPart %zu of %s", i + 1, request.key.c_str())};
+                }
+                destination.write(data.data(), data.size());
+            }
+            destination.close();
+            if (!destination || rename(temp_path.c_str(), local_path.c_str()) != 0) {
+                remove(temp_path.c_str());
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "failed to write " + local_path};
+            }
+            TfRmTree(upload_path);
+            return success();
+        }
+
+        usd_s3::StoreOutcome abort_multipart(
+                const usd_s3::ObjectRequest& request, const std::string& upload_id) override {
+            usd_s3::StoreOutcome outcome = begin_request();
+            if (outcome.is_success()) {
+                TfRmTree(staging_path(upload_id));
+            }
+            return outcome;
+        }
+
+    private:
+        std::string object_path(const usd_s3::ObjectRequest& request) const {
+            return TfNormPath(root + "/" + request.bucket + "/" + request.key);
+        }
+
+        std::string staging_path(const std::string& upload_id) const {
+            return root + "/.uploads/" + upload_id;
+        }
+
+        static std::string part_etag(const char* data, size_t size) {
+            return TfStringPrintf("\"%zx\"", boost::hash_range(data, data + size));
+        }
+
+        usd_s3::StoreOutcome stat_object(
+                const usd_s3::ObjectRequest& request, usd_s3::ObjectInfo& info) const {
+            struct stat st;
+            if (stat(object_path(request).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_NOT_FOUND, "no such key " + request.key};
+            }
+            info.key = request.key;
+            info.last_modified = st.st_mtim.tv_sec + st.st_mtim.tv_nsec * 1e-9;
+            info.size = static_cast<uint64_t>(st.st_size);
+            info.etag = TfStringPrintf("\"%llx-%llx\"",
+                static_cast<unsigned long long>(st.st_size),
+                static_cast<unsigned long long>(st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec));
+            return success();
+        }
+
+        // Pay the latency, then fail the request at the configured rates
+        usd_s3::StoreOutcome begin_request() {
+            if (latency > 0.0) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(latency));
+            }
+            if (error_rate <= 0.0 && throttle_rate <= 0.0) {
+                return success();
+            }
+            double draw;
+            {
+                mutex_scoped_lock lock(random_mutex);
+                draw = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+            }
+            if (draw < throttle_rate) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_THROTTLED, "SlowDown (injected)"};
+            }
+            if (draw < throttle_rate + error_rate) {
+                return usd_s3::StoreOutcome{usd_s3::STORE_ERROR, "InternalError (injected)"};
+            }
+            return success();
+        }
+
+        // All transfers share one link: reserve the time the bytes need on it
+        // and wait until they have gone through.
+        void transfer(uint64_t bytes) {
+            if (bandwidth <= 0.0 || bytes == 0) {
+                return;
+            }
+            steady_clock::time_point done;
+            {
+                mutex_scoped_lock lock(link_mutex);
+                link_free = std::max(link_free, steady_clock::now()) +
+                    std::chrono::duration_cast<steady_clock::duration>(
+                        std::chrono::duration<double>(bytes / bandwidth));
+                done = link_free;
+            }
+            std::this_thread::sleep_until(done);
+        }
+
+        const std::string root;
+        const double latency;       // seconds
+        const double bandwidth;     // bytes per second, 0 - unlimited
+        const double error_rate;
+        const double throttle_rate;
+
+        std::mutex random_mutex;
+        std::mt19937 random;
+
+        std::mutex link_mutex;
+        steady_clock::time_point link_free;
+
+        std::atomic<size_t> next_upload{0};
+    };
+}
+
+namespace usd_s3 {
+    std::unique_ptr<ObjectStore> create_mock_store() {
+        return std::unique_ptr<ObjectStore>(new MockObjectStore());
+    }
+
+    std::unique_ptr<ObjectStore> create_object_store() {
+        const auto backend = getenv(BACKEND_ENV_VAR);
+        if (backend != nullptr && std::string(backend) == "mock") {
+            return create_mock_store();
+        }
+        return create_aws_store();
+    }
+}
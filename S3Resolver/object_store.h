@@ -0,0 +1,112 @@
+#ifndef OBJECT_STORE_H
+#define OBJECT_STORE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace usd_s3 {
+    constexpr const char BACKEND_ENV_VAR[] = "USD_S3_BACKEND";
+    constexpr const char MOCK_ROOT_ENV_VAR[] = "USD_S3_MOCK_ROOT";
+    constexpr const char MOCK_LATENCY_ENV_VAR[] = "USD_S3_MOCK_LATENCY_MS";
+    constexpr const char MOCK_BANDWIDTH_ENV_VAR[] = "USD_S3_MOCK_BANDWIDTH_MB";
+    constexpr const char MOCK_ERROR_RATE_ENV_VAR[] = "USD_S3_MOCK_ERROR_RATE";
+    constexpr const char MOCK_THROTTLE_RATE_ENV_VAR[] = "USD_S3_MOCK_THROTTLE_RATE";
+    constexpr const char MOCK_SEED_ENV_VAR[] = "USD_S3_MOCK_SEED";
+
+    // An object in a bucket, optionally pinned to a version
+    struct ObjectRequest {
+        std::string bucket;
+        std::string key;
+        std::string version_id;
+    };
+
+    struct ObjectInfo {
+        std::string key;
+        double last_modified;   // seconds since epoch
+        std::string etag;
+        uint64_t size;
+    };
+
+    enum StoreStatus {
+        STORE_OK,
+        STORE_NOT_MODIFIED,     // conditional get, the local copy is up to date
+        STORE_NOT_FOUND,
+        STORE_THROTTLED,        // 503 SlowDown and friends, retry later with less load
+        STORE_TIMEOUT,          // timeouts and dropped connections, also a sign of load
+        STORE_ERROR             // access denied, invalid requests, local I/O...
+    };
+
+    struct StoreOutcome {
+        StoreStatus status;
+        std::string message;
+
+        bool is_success() const { return status == STORE_OK; }
+    };
+
+    // The subset of an object store the resolver needs.
+    // Implementations have to be safe to call from multiple threads.
+    class ObjectStore {
+    public:
+        virtual ~ObjectStore() {}
+
+        virtual StoreOutcome head(const ObjectRequest& request, ObjectInfo& info) = 0;
+
+        // Download an object to local_path, replacing the file only when the
+        // download succeeds. Returns STORE_NOT_MODIFIED without touching
+        // local_path when the object is not newer than if_modified_since
+        // (seconds since epoch, 0 to always download).
+        virtual StoreOutcome get(
+            const ObjectRequest& request, double if_modified_since,
+            const std::string& local_path, ObjectInfo& info) = 0;
+
+        // Read length bytes starting at offset into data. A length of 0
+        // succeeds with empty data and info untouched, without a request.
+        virtual StoreOutcome range_get(
+            const ObjectRequest& request, uint64_t offset, uint64_t length,
+            std::string& data, ObjectInfo& info) = 0;
+
+        virtual StoreOutcome list(
+            const std::string& bucket, const std::string& prefix,
+            std::vector<ObjectInfo>& objects) = 0;
+
+        // Multipart uploads: start an upload, send its parts (numbered from
+        // 1, all but the last at least 5MB on S3) from any thread, then
+        // complete it with the ETags of all parts in order or abort it.
+        // The object only appears once the upload is completed.
+        virtual StoreOutcome create_multipart(
+            const ObjectRequest& request, std::string& upload_id) = 0;
+
+        virtual StoreOutcome upload_part(
+            const ObjectRequest& request, const std::string& upload_id, int part_number,
+            const char* data, size_t size, std::string& etag) = 0;
+
+        virtual StoreOutcome complete_multipart(
+            const ObjectRequest& request, const std::string& upload_id,
+            const std::vector<std::string>& etags) = 0;
+
+        virtual StoreOutcome abort_multipart(
+            const ObjectRequest& request, const std::string& upload_id) = 0;
+    };
+
+    // Upload local_path to the object in parts of part_size bytes, with up to
+    // num_threads parts in flight. Only num_threads part buffers are held in
+    // memory, whatever the size of the file. The part size is raised to the
+    // 5 MiB minimum of S3, and so that the file takes at most 10000 parts.
+    StoreOutcome upload_file(
+        ObjectStore& store, const ObjectRequest& request, const std::string& local_path,
+        size_t part_size, size_t num_threads);
+
+    // S3 through the AWS SDK, configured with the USD_S3_* variables
+    std::unique_ptr<ObjectStore> create_aws_store();
+
+    // Serves the files below USD_S3_MOCK_ROOT (<root>/<bucket>/<key>) in
+    // process, with configurable latency, bandwidth and error injection
+    std::unique_ptr<ObjectStore> create_mock_store();
+
+    // Select the backend with USD_S3_BACKEND ("aws" or "mock"), aws by default
+    std::unique_ptr<ObjectStore> create_object_store();
+}
+
+#endif // OBJECT_STORE_H
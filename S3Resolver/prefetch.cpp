@@ -0,0 +1,137 @@
+#include "prefetch.h"
+#include "s3.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+#include <pxr/base/tf/pathUtils.h>
+#include <pxr/usd/usdUtils/dependencies.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+
+    // Only layers can have dependencies, and only layers Sdf can read
+    // without the resolver
+    bool is_layer(const std::string& asset_path) {
+        const auto extension = TfGetExtension(asset_path.substr(0, asset_path.find_first_of('?')));
+        return extension == "usd" || extension == "usda" || extension == "usdc";
+    }
+
+    bool is_s3_path(const std::string& path) {
+        return path.compare(0, sizeof(usd_s3::S3_PREFIX_SHORT) - 1, usd_s3::S3_PREFIX_SHORT) == 0;
+    }
+
+    // Anchor a dependency against the layer it was found in, the way Sdf
+    // anchors it through the resolver, e.g. ./geo.usd in
+    // s3://bucket/set/root.usd is s3://bucket/set/geo.usd. Absolute paths
+    // and paths with a scheme are returned as they are.
+    std::string anchor_dependency(const std::string& asset_path, const std::string& path) {
+        if (path.empty() || path[0] == '/' || path.find(':') != std::string::npos) {
+            return path;
+        }
+        const auto parsed_start = asset_path.find_first_not_of('/', sizeof(usd_s3::S3_PREFIX_SHORT) - 1);
+        // the version of the layer doesn't apply to its dependencies
+        const std::string parsed = asset_path.substr(parsed_start, asset_path.find_first_of('?') - parsed_start);
+        const auto last_slash = parsed.find_last_of('/');
+        if (last_slash == std::string::npos) {
+            return path;
+        }
+        return std::string(usd_s3::S3_PREFIX) + TfNormPath(parsed.substr(0, last_slash) + "/" + path);
+    }
+}
+
+namespace usd_s3 {
+    std::vector<std::string> get_dependencies(
+            const std::string& asset_path, const std::string& local_path) {
+        std::vector<std::string> dependencies;
+        if (!is_layer(asset_path)) {
+            return dependencies;
+        }
+        // only collects the asset paths, without composing the layer
+        std::vector<std::string> sublayers, references, payloads;
+        UsdUtilsExtractExternalReferences(local_path, &sublayers, &references, &payloads);
+        for (const auto* paths : {&sublayers, &references, &payloads}) {
+            for (const auto& path : *paths) {
+                const auto anchored = anchor_dependency(asset_path, path);
+                if (is_s3_path(anchored)) {
+                    dependencies.push_back(anchored);
+                }
+            }
+        }
+        return dependencies;
+    }
+
+    Prefetcher::Prefetcher(S3& s3, size_t num_threads) : s3(s3), stopping(false) {
+        TF_DEBUG(S3_DBG).Msg("S3: prefetch with %zu threads\n", num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back(&Prefetcher::run, this);
+        }
+    }
+
+    Prefetcher::~Prefetcher() {
+        {
+            mutex_scoped_lock lock(queue_mutex);
+            stopping = true;
+            queue.clear();
+        }
+        queue_changed.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void Prefetcher::layer_fetched(const std::string& asset_path, const std::string& local_path) {
+        if (!is_layer(asset_path)) {
+            return;
+        }
+        {
+            mutex_scoped_lock lock(queue_mutex);
+            seen.insert(asset_path);
+            queue.push_back(Job{asset_path, local_path});
+        }
+        queue_changed.notify_one();
+    }
+
+    void Prefetcher::reset() {
+        mutex_scoped_lock lock(queue_mutex);
+        queue.clear();
+        seen.clear();
+    }
+
+    // Scanning a layer queues fetches for its unseen dependencies. Fetching
+    // goes through S3::fetch_asset, which queues the layer for scanning in
+    // turn, so the prefetch walks the whole dependency tree. Fetches USD
+    // asks for in the meantime wait for the prefetch in flight.
+    void Prefetcher::run() {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while (true) {
+            queue_changed.wait(lock, [&]() { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            const Job job = queue.front();
+            queue.pop_front();
+            lock.unlock();
+
+            if (job.local_path.empty()) {
+                const auto local_path = s3.resolve_name(job.asset_path);
+                const bool success = !local_path.empty() && s3.fetch_asset(job.asset_path, local_path, PRIORITY_PREFETCH);
+                TF_DEBUG(S3_DBG).Msg("S3: prefetch %s %s\n", job.asset_path.c_str(), success ? "OK" : "NOK");
+                lock.lock();
+                continue;
+            }
+
+            const auto dependencies = get_dependencies(job.asset_path, job.local_path);
+            TF_DEBUG(S3_DBG).Msg("S3: prefetch scanned %s, %zu dependencies\n",
+                job.asset_path.c_str(), dependencies.size());
+            lock.lock();
+            for (const auto& dependency : dependencies) {
+                if (seen.insert(dependency).second) {
+                    queue.push_back(Job{dependency, std::string()});
+                    queue_changed.notify_one();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace usd_s3 {
+    class S3;
+
+    // Returns the s3: sublayers, references and payloads of a fetched layer,
+    // relative ones anchored at the layer, or nothing if the asset isn't a
+    // layer
+    std::vector<std::string> get_dependencies(
+        const std::string& asset_path, const std::string& local_path);
+
+    // Speculatively fetches the s3: dependencies of freshly fetched layers
+    // in the background, so their downloads overlap with USD parsing the
+    // layer instead of starting one level at a time when USD gets to them.
+    class Prefetcher {
+    public:
+        Prefetcher(S3& s3, size_t num_threads);
+        ~Prefetcher();
+
+        // Queue a fetched layer for dependency extraction
+        void layer_fetched(const std::string& asset_path, const std::string& local_path);
+
+        // Forget the assets seen so far, so they are prefetched again
+        void reset();
+
+    private:
+        struct Job {
+            std::string asset_path;
+            std::string local_path;     // layer to scan, empty to fetch asset_path
+        };
+
+        void run();
+
+        S3& s3;
+        std::mutex queue_mutex;
+        std::condition_variable queue_changed;
+        std::deque<Job> queue;
+        std::set<std::string> seen;
+        bool stopping;
+        std::vector<std::thread> threads;
+    };
+}
+
+#endif // PREFETCH_H
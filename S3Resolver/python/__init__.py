@@ -0,0 +1,13 @@
+"""
+Python access to the USD S3 resolver
+
+Warmup(assetPaths, numThreads=16, followDependencies=True) downloads s3:
+assets and their dependencies into the local cache, returning the number
+of assets that could not be fetched.
+"""
+from pxr import Ar
+
+# Load the resolver plugin before the module, so both share one cache
+Ar.GetResolver() #pylint: disable=no-member
+
+from ._usdS3 import * #pylint: disable=wrong-import-position,wildcard-import
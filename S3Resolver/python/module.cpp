@@ -0,0 +1,37 @@
+#include "s3.h"
+
+#include <boost/python.hpp>
+
+#include <string>
+#include <vector>
+
+namespace {
+    // Downloads run without the GIL, so other python threads keep going
+    class ReleaseGIL {
+    public:
+        ReleaseGIL() : state(PyEval_SaveThread()) {}
+        ~ReleaseGIL() { PyEval_RestoreThread(state); }
+    private:
+        PyThreadState* state;
+    };
+
+    size_t warmup(
+            const boost::python::object& asset_paths, size_t num_threads,
+            bool follow_dependencies) {
+        std::vector<std::string> paths;
+        boost::python::stl_input_iterator<std::string> begin(asset_paths), end;
+        paths.assign(begin, end);
+
+        ReleaseGIL release;
+        usd_s3::S3 s3;
+        return s3.warmup(paths, num_threads, follow_dependencies);
+    }
+}
+
+BOOST_PYTHON_MODULE(_usdS3) {
+    using namespace boost::python;
+    def("Warmup", &warmup,
+        (arg("assetPaths"), arg("numThreads") = 16, arg("followDependencies") = true),
+        "Download s3: assets and their dependencies into the local cache.\n"
+        "Returns the number of assets that could not be fetched.");
+}
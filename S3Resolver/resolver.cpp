@@ -1,4 +1,7 @@
+#include <pxr/base/tf/diagnosticLite.h>
 #include <pxr/base/tf/fileUtils.h>
+#include <pxr/base/tf/notice.h>
+#include <pxr/base/tf/weakBase.h>
 #include <pxr/base/tf/pathUtils.h>
 #include <pxr/base/tf/registryManager.h>
 #include <pxr/base/tf/type.h>
@@ -14,6 +17,8 @@
 #include <pxr/usd/ar/packageResolver.h>
 #include <pxr/usd/ar/threadLocalScopedCache.h>
 #include <pxr/usd/usd/zipFile.h>
+#include <pxr/usd/sdf/layer.h>
+#include <pxr/usd/sdf/notice.h>
 
 #include <tbb/concurrent_hash_map.h>
 #include <memory>
@@ -45,7 +50,32 @@ struct S3Resolver::_Cache
     _PathToResolvedPathMap _pathToResolvedPathMap;
 };
 
-S3Resolver::S3Resolver() : ArDefaultResolver()
+// Ar has no writable assets, Sdf saves layers to their local path. Layers
+// with an s3: identifier live in the cache, upload them once they are saved.
+struct S3Resolver::_SaveListener : public TfWeakBase
+{
+    _SaveListener()
+    {
+        TfNotice::Register(TfCreateWeakPtr(this), &_SaveListener::_OnLayerSaved);
+    }
+
+    void _OnLayerSaved(
+        const SdfNotice::LayerDidSaveLayerToFile& notice,
+        const SdfLayerHandle& layer)
+    {
+        if (layer && g_s3.matches_schema(layer->GetIdentifier())) {
+            TF_DEBUG_TIMED_SCOPE(USD_S3_RESOLVER, "SAVE %s", layer->GetIdentifier().c_str());
+            // Sdf marks the layer clean after the notice, the local copy
+            // keeps the changes and the next save uploads it again
+            if (!g_s3.save_asset(layer->GetIdentifier(), layer->GetRealPath())) {
+                TF_RUNTIME_ERROR("Failed to upload %s, the changes are only saved to %s",
+                    layer->GetIdentifier().c_str(), layer->GetRealPath().c_str());
+            }
+        }
+    }
+};
+
+S3Resolver::S3Resolver() : ArDefaultResolver(), _saveListener(new _SaveListener())
 {
     TF_DEBUG(USD_S3_RESOLVER).Msg("Loading the S3Resolver\n");
 }
@@ -96,6 +126,22 @@ void S3Resolver::ConfigureResolverForAsset(
     ArDefaultResolver::ConfigureResolverForAsset(path);
 }
 
+// New s3: layers are created in the cache and uploaded when saved
+std::string S3Resolver::ComputeLocalPath(
+    const std::string& path)
+{
+    if (g_s3.matches_schema(path)) {
+        const std::string localPath = g_s3.resolve_name(path);
+        const std::string localDir = TfGetPathName(localPath);
+        if (!TfIsDir(localDir) && !TfMakeDirs(localDir) && !TfIsDir(localDir)) {
+            S3_WARN("[S3Resolver] failed to create %s", localDir.c_str());
+            return std::string();
+        }
+        return localPath;
+    }
+    return ArDefaultResolver::ComputeLocalPath(path);
+}
+
 // refresh any cashes associated with the given context
 void S3Resolver::RefreshContext(
     const ArResolverContext& context)
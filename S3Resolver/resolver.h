@@ -7,6 +7,7 @@
 #include <pxr/usd/ar/defaultResolver.h>
 #include "pxr/usd/ar/threadLocalScopedCache.h"
 
+#include <memory>
 #include <string>
 
 PXR_NAMESPACE_OPEN_SCOPE
@@ -47,6 +48,9 @@ public:
     virtual void ConfigureResolverForAsset(
         const std::string& path) override;
 
+    virtual std::string ComputeLocalPath(
+        const std::string& path) override;
+
     virtual void RefreshContext(
         const ArResolverContext& context) override;
 
@@ -57,6 +61,9 @@ public:
         VtValue* cacheScopeData) override;
 
 private:
+    struct _SaveListener;
+    std::unique_ptr<_SaveListener> _saveListener;
+
     struct _Cache;
     using ResolveCache = ArThreadLocalScopedCache<_Cache>;
     using _CachePtr = ResolveCache::CachePtr;
@@ -1,22 +1,28 @@
 #include "s3.h"
+#include "daemon.h"
+#include "object_store.h"
+#include "prefetch.h"
 #include "debugCodes.h"
 
+#include "cache_engine.h"
+
 #include <pxr/base/tf/diagnosticLite.h>
 #include <pxr/base/tf/fileUtils.h>
 #include <pxr/base/tf/pathUtils.h>
 
-#include <aws/core/Aws.h>
-#include <aws/s3/S3Client.h>
-#include <aws/s3/model/HeadObjectRequest.h>
-#include <aws/s3/model/GetObjectRequest.h>
-#include <aws/s3/model/ListObjectsV2Request.h>
-#include <fstream>
+#include <boost/utility/string_view.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <iostream>
-#include <fstream>
+#include <map>
+#include <sstream>
+#include <memory>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h>
-
-#include <aws/core/utils/logging/LogMacros.h>
+#include <unistd.h>
 
 PXR_NAMESPACE_USING_DIRECTIVE
 
@@ -65,9 +71,8 @@ PXR_NAMESPACE_USING_DIRECTIVE
 // -------------------------------------------------------------------------------
 
 namespace {
-    constexpr double INVALID_TIME = std::numeric_limits<double>::lowest();
-
-    //using mutex_scoped_lock = std::lock_guard<std::mutex>;
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+    using string_view = boost::string_view;
 
     // Otherwise clang static analyser will throw errors.
     template <size_t len> constexpr size_t
@@ -77,9 +82,10 @@ namespace {
 
     // Parse an S3 url and strip off the prefix ('s3:', 's3:/' or 's3://')
     // e.g. s3://bucket/object.usd returns bucket/object.usd
-    std::string parse_path(const std::string& path) {
+    // The result points into path, parsing doesn't allocate.
+    string_view parse_path(const std::string& path) {
         constexpr auto schema_length_short = cexpr_strlen(usd_s3::S3_PREFIX_SHORT);
-        return path.substr(path.find_first_not_of("/", schema_length_short));
+        return string_view(path).substr(path.find_first_not_of('/', schema_length_short));
     }
 
     // Get the bucket from a parsed path
@@ -109,10 +115,20 @@ namespace {
     // e.g. 'bucket/object.usd' returns an empty string
     //      'bucket/object.usd?versionId=abc123' returns abc123
     const std::string get_object_versionid(const std::string& path) {
-        const uint i = path.find_first_of("versionId=");
+        const auto i = path.find("versionId=");
         return (i != std::string::npos) ? path.substr(i + 10) : std::string();
     }
 
+    // Give a local copy the date of its object. A copy in sync with S3 has
+    // the date of the object, one saved since has a later one.
+    void set_modification_time(const std::string& local_path, double time) {
+        struct timeval times[2];
+        times[0].tv_sec = times[1].tv_sec = static_cast<time_t>(time);
+        times[0].tv_usec = times[1].tv_usec = static_cast<suseconds_t>(
+            (time - times[0].tv_sec) * 1e6);
+        utimes(local_path.c_str(), times);
+    }
+
     // get an environment variable
     std::string get_env_var(const std::string& env_var, const std::string& default_value) {
         const auto env_var_value = getenv(env_var.c_str());
@@ -134,275 +150,364 @@ namespace {
 }
 
 namespace usd_s3 {
-    Aws::SDKOptions options;
-    Aws::S3::S3Client* s3_client;
-
-    enum CacheState {
-        CACHE_MISSING,
-        CACHE_NEEDS_FETCHING,
-        CACHE_FETCHED
-    };
-
-    struct Cache {
-        CacheState state;
-        std::string local_path;
-        double timestamp;       // date last modified
-        bool is_pinned;         // pinned (versioned) objects don't need to be checked for changes
-        std::string ETag;       // md5 hash
-    };
-
-    std::map<std::string, Cache> cached_requests;
+    std::unique_ptr<ObjectStore> object_store;
+    std::unique_ptr<FetchScheduler> scheduler;
+    // Adapts the requests in flight per bucket, nullptr if disabled
+    std::shared_ptr<ConcurrencyController> controller;
+
+    // The class of the fetch running on this thread, downloads of the cache
+    // engine happen on the thread calling fetch_asset
+    thread_local FetchPriority fetch_priority = PRIORITY_DEMAND;
+
+    // Local directory of the cache, set up by the first S3 instance
+    std::string cache_root;
+
+    // All S3 instances share the object store and the cache
+    std::mutex instances_mutex;
+    size_t instances = 0;
+
+    // Split a parsed path into bucket, key and version
+    ObjectRequest make_request(const std::string& path) {
+        return ObjectRequest{
+            get_bucket_name(path),
+            get_object_name(path),
+            uses_versioning(path) ? get_object_versionid(path) : std::string()};
+    }
 
     // Determine a local path for an asset
     std::string generate_path(const std::string& path) {
-        const std::string local_dir = get_env_var(CACHE_PATH_ENV_VAR, "/tmp");
-        return TfNormPath(local_dir + "/" + get_bucket_name(path) + "/" + get_object_name(path));
+        return TfNormPath(cache_root + "/" + get_bucket_name(path) + "/" + get_object_name(path));
     }
 
-    // Check / resolve an asset with an S3 HEAD request and store the result in the cache
-    // Set CACHE_NEEDS_FETCHING if the asset was updated
-    // Requires the asset to be fetched before --
-    std::string check_object(const std::string& path, Cache& cache) {
-        if (s3_client == nullptr) {
-            TF_DEBUG(S3_DBG).Msg("S3: check_object - abort due to s3_client nullptr\n");
-            return std::string();
+    // The object store behind the cache engine, keyed by parsed paths
+    struct S3Backend {
+        std::string local_path(const std::string& path) {
+            return generate_path(path);
         }
 
-        // versioned objects can't change... no need to check them
-        // TODO: move this check?
-        if (cache.is_pinned) {
-            return cache.local_path;
-        }
-
-        Aws::S3::Model::HeadObjectRequest head_request;
-        Aws::String bucket_name = get_bucket_name(path).c_str();
-        Aws::String object_name = get_object_name(path).c_str();
-        head_request.WithBucket(bucket_name).WithKey(object_name);
-
-        if (uses_versioning(path)) {
-            Aws::String object_versionid = get_object_versionid(path).c_str();
-            head_request.WithVersionId(object_versionid);
-            cache.is_pinned = true;
-            TF_DEBUG(S3_DBG).Msg("S3: check_object bucket: %s and object: %s and version: %s\n",
-                bucket_name.c_str(), object_name.c_str(), object_versionid.c_str());
-        } else {
-            TF_DEBUG(S3_DBG).Msg("S3: check_object bucket: %s and object: %s\n", bucket_name.c_str(), object_name.c_str());
-        }
-
-        auto head_object_outcome = s3_client->HeadObject(head_request);
+        // Check an asset with an S3 HEAD request
+        bool head(const std::string& path, usd_cache::Entry& entry) {
+            if (object_store == nullptr) {
+                TF_DEBUG(S3_DBG).Msg("S3: check_object - abort due to object_store nullptr\n");
+                return false;
+            }
 
-        if (head_object_outcome.IsSuccess())
-        {
-            // TODO set local_dir in S3 constructor
-            double date_modified = head_object_outcome.GetResult().GetLastModified().SecondsWithMSPrecision();
-            TF_DEBUG(S3_DBG).Msg("S3: check_object OK %.0f\n", date_modified);
-            // check
-            std::string local_path = generate_path(path);
-            if (date_modified > cache.timestamp) {
-                cache.state = CACHE_NEEDS_FETCHING;
+            const ObjectRequest request = make_request(path);
+            if (!request.version_id.empty()) {
+                entry.is_pinned = true;
+                TF_DEBUG(S3_DBG).Msg("S3: check_object bucket: %s and object: %s and version: %s\n",
+                    request.bucket.c_str(), request.key.c_str(), request.version_id.c_str());
+            } else {
+                TF_DEBUG(S3_DBG).Msg("S3: check_object bucket: %s and object: %s\n", request.bucket.c_str(), request.key.c_str());
             }
-            cache.timestamp = date_modified;
-            cache.local_path = local_path;
 
-            return local_path;
-        }
-        else
-        {
+            ObjectInfo info;
+            const auto outcome = object_store->head(request, info);
+            if (outcome.is_success()) {
+                TF_DEBUG(S3_DBG).Msg("S3: check_object OK %.0f\n", info.last_modified);
+                entry.timestamp = info.last_modified;
+                entry.size = info.size;
+                entry.etag = info.etag;
+                return true;
+            }
             TF_DEBUG(S3_DBG).Msg("S3: check_object NOK\n");
-            cache.timestamp = INVALID_TIME;
-            std::cout << "HeadObjects error: " <<
-                head_object_outcome.GetError().GetExceptionName() << " " <<
-                head_object_outcome.GetError().GetMessage() << std::endl;
-            return std::string();
-        };
-    }
-
-    // Fetch an asset from S3 to the local_path set in the cache object.
-    // Check for the presence of a local cache and only fetch the asset
-    // when it was modified after the cached timestamp.
-    bool fetch_object(const std::string& path, Cache& cache) {
-        if (s3_client == nullptr) {
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_object - abort due to s3_client nullptr\n");
+            if (outcome.status == STORE_NOT_FOUND) {
+                entry.state = usd_cache::CACHE_MISSING;
+                return true;
+            }
+            std::cout << "HeadObjects error: " << outcome.message << std::endl;
             return false;
         }
 
-        Aws::S3::Model::GetObjectRequest object_request;
-        Aws::String bucket_name = get_bucket_name(path).c_str();
-        Aws::String object_name = get_object_name(path).c_str();
-        object_request.WithBucket(bucket_name).WithKey(object_name);
-
-        if (uses_versioning(path)) {
-            Aws::String object_versionid = get_object_versionid(path).c_str();
-            object_request.WithVersionId(object_versionid);
-            cache.is_pinned = true;
+        // Fetch an asset from S3 to the local path of the entry. A local
+        // copy is only replaced when the object was modified after it.
+        bool get(const std::string& path, usd_cache::Entry& entry) {
+            if (object_store == nullptr) {
+                TF_DEBUG(S3_DBG).Msg("S3: fetch_object - abort due to object_store nullptr\n");
+                return false;
+            }
 
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_object bucket: %s and object: %s and version: %s\n",
-                bucket_name.c_str(), object_name.c_str(), object_versionid.c_str());
-        } else {
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_object bucket: %s and object: %s\n", bucket_name.c_str(), object_name.c_str());
-        }
-
-        // Only download the asset if there's no local copy or if the local copy is outdated
-        // The GET request returns a 304 (not modified).
-        const std::string local_path = cache.local_path;
-        if (TfPathExists(local_path)) {
-            double local_date_modified;
-            if (ArchGetModificationTime(local_path.c_str(), &local_date_modified)) {
-                TF_DEBUG(S3_DBG).Msg("S3: fetch_object - found local asset\n");
-                cache.timestamp = local_date_modified;
-                object_request.WithIfModifiedSince(local_date_modified);
+            const ObjectRequest request = make_request(path);
+            if (!request.version_id.empty()) {
+                entry.is_pinned = true;
+                TF_DEBUG(S3_DBG).Msg("S3: fetch_object bucket: %s and object: %s and version: %s\n",
+                    request.bucket.c_str(), request.key.c_str(), request.version_id.c_str());
+            } else {
+                TF_DEBUG(S3_DBG).Msg("S3: fetch_object bucket: %s and object: %s\n", request.bucket.c_str(), request.key.c_str());
             }
-            // TODO compare cache ETag with MD5 of local copy to know if fetching is required
-        }
 
-        auto get_object_outcome = s3_client->GetObject(object_request);
+            // Only download the asset if there's no local copy or if the local copy is outdated
+            // The GET request returns a 304 (not modified).
+            const std::string& local_path = entry.local_path;
+            double if_modified_since = 0.0;
+            if (TfPathExists(local_path)) {
+                double local_date_modified;
+                if (ArchGetModificationTime(local_path.c_str(), &local_date_modified)) {
+                    TF_DEBUG(S3_DBG).Msg("S3: fetch_object - found local asset\n");
+                    if_modified_since = local_date_modified;
+                }
+                // TODO compare cache ETag with MD5 of local copy to know if fetching is required
+            }
 
-        if (get_object_outcome.IsSuccess())
-        {
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_object %s success\n", path.c_str());
-            // TODO: support directories in object_name
             // prepare cache directory
-            const std::string& bucket_path = cache.local_path.substr(0, cache.local_path.find_last_of('/'));
+            const std::string bucket_path = local_path.substr(0, local_path.find_last_of('/'));
             if (!TfIsDir(bucket_path)) {
-                bool isSuccess = TfMakeDirs(bucket_path);
+                // another thread may have created it in the meantime
+                bool isSuccess = TfMakeDirs(bucket_path) || TfIsDir(bucket_path);
                 if (! isSuccess) {
                     TF_DEBUG(S3_DBG).Msg("S3: fetch_object failed to create bucket directory\n");
                     return false;
                 }
             }
-            // TODO: restore the original datemodified on the asset
-            Aws::OFStream local_file;
-            local_file.open(cache.local_path, std::ios::out | std::ios::binary);
-            local_file << get_object_outcome.GetResult().GetBody().rdbuf();
-            cache.timestamp = get_object_outcome.GetResult().GetLastModified().SecondsWithMSPrecision();
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_object OK %.0f\n", cache.timestamp);
-            //TF_DEBUG(S3_DBG).Msg("S3: fetch_object version: %s\n", get_object_outcome.GetResult().GetVersionId().c_str());
-            cache.state = CACHE_FETCHED;
-            cache.ETag = get_object_outcome.GetResult().GetETag().c_str();
-            return true;
-        }
-        else
-        {
-            if (get_object_outcome.GetError().GetResponseCode() == Aws::Http::HttpResponseCode::NOT_MODIFIED) {
-                //cache.timestamp = get_object_outcome.GetResult().GetLastModified().SecondsWithMSPrecision();
+
+            ObjectInfo info;
+            const auto outcome = [&]() {
+                FetchScheduler::Slot slot(*scheduler, path, fetch_priority);
+                return object_store->get(request, if_modified_since, local_path, info);
+            }();
+            if (outcome.is_success()) {
+                TF_DEBUG(S3_DBG).Msg("S3: fetch_object %s OK %.0f\n", path.c_str(), info.last_modified);
+                set_modification_time(local_path, info.last_modified);
+                entry.state = usd_cache::CACHE_FETCHED;
+                entry.timestamp = info.last_modified;
+                entry.size = info.size;
+                entry.etag = info.etag;
+                return true;
+            }
+            if (outcome.status == STORE_NOT_MODIFIED) {
                 TF_DEBUG(S3_DBG).Msg("S3: fetch_object OK (not modified)\n");
-                cache.state = CACHE_FETCHED;
+                struct stat st;
+                entry.state = usd_cache::CACHE_FETCHED;
+                entry.timestamp = if_modified_since;
+                entry.size = stat(local_path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
                 return true;
             }
-            std::cout << "GetObject error: " <<
-                get_object_outcome.GetError().GetExceptionName() << " " <<
-                get_object_outcome.GetError().GetMessage() << std::endl;
+            std::cout << "GetObject error: " << outcome.message << std::endl;
             return false;
         }
-    }
 
-    S3::S3() {
-        TF_DEBUG(S3_DBG).Msg("S3: client setup \n");
-        Aws::InitAPI(options);
+        // List the objects below a parsed path prefix
+        bool list(const std::string& prefix, std::map<std::string, usd_cache::Entry>& entries) {
+            if (object_store == nullptr) {
+                return false;
+            }
+            const std::string bucket = get_bucket_name(prefix);
+            std::string key_prefix = prefix.substr(bucket.size());
+            key_prefix.erase(0, key_prefix.find_first_not_of('/'));
+
+            std::vector<ObjectInfo> objects;
+            const auto outcome = object_store->list(bucket, key_prefix, objects);
+            if (!outcome.is_success()) {
+                TF_DEBUG(S3_DBG).Msg("S3: list %s failed: %s\n", prefix.c_str(), outcome.message.c_str());
+                return false;
+            }
+            TF_DEBUG(S3_DBG).Msg("S3: list %s - %zu objects\n", prefix.c_str(), objects.size());
+            for (const auto& object : objects) {
+                const std::string path = bucket + "/" + object.key;
+                entries[path] = usd_cache::Entry{
+                    usd_cache::CACHE_NEEDS_FETCHING, generate_path(path), object.last_modified,
+                    object.size, object.etag, false};
+            }
+            return true;
+        }
+    };
 
-        Aws::Client::ClientConfiguration config;
-        // TODO: set executor to a PooledThreadExecutor to limit the number of threads
-        config.scheme = Aws::Http::Scheme::HTTP;
+    S3Backend backend;
+    std::unique_ptr<usd_cache::CacheEngine<S3Backend>> cache;
+
+    // Set when USD_S3_DAEMON_SOCKET names a running daemon, which then
+    // handles the requests instead of the object store and cache below.
+    // The client lives as long as the process, so threads resolving while
+    // instances come and go read it without a lock.
+    std::atomic<DaemonClient*> daemon(nullptr);
+    std::atomic<bool> daemon_failed(false);
+    // The object store and cache of this process are set up
+    std::atomic<bool> local_ready(false);
+
+    // Set up the object store and cache of this process, instances_mutex
+    // must be held
+    void start_local() {
+        cache_root = TfNormPath(get_env_var(CACHE_PATH_ENV_VAR, "/tmp"));
+        object_store = create_object_store();
+        const int initial_requests = atoi(get_env_var(REQUESTS_ENV_VAR, "8").c_str());
+        if (initial_requests > 0) {
+            controller = std::make_shared<ConcurrencyController>(
+                static_cast<size_t>(initial_requests),
+                static_cast<size_t>(std::max(1, atoi(get_env_var(MAX_REQUESTS_ENV_VAR, "25").c_str()))));
+            object_store = create_adaptive_store(std::move(object_store), controller);
+        }
+        scheduler.reset(new FetchScheduler(
+            static_cast<size_t>(std::max(0, atoi(get_env_var(DEMAND_FETCHES_ENV_VAR, "16").c_str()))),
+            static_cast<size_t>(std::max(0, atoi(get_env_var(PREFETCH_FETCHES_ENV_VAR, "8").c_str())))));
+        cache.reset(new usd_cache::CacheEngine<S3Backend>(backend, usd_cache::Options{
+            cache_root, INDEX_FILE_NAME,
+            atof(get_env_var(TTL_ENV_VAR, "0").c_str()),
+            static_cast<uint64_t>(atof(get_env_var(CACHE_SIZE_ENV_VAR, "0").c_str()) * (1 << 20)),
+            false,
+            static_cast<size_t>(std::max(0, atoi(get_env_var(REVALIDATE_THREADS_ENV_VAR, "0").c_str())))}));
+        cache->load_index();
+        TF_DEBUG(S3_DBG).Msg("S3: load_index - %zu local copies\n",
+            static_cast<size_t>(cache->metrics().entries));
+        local_ready = true;
+    }
+
+    // Write the index and tear down what start_local set up,
+    // instances_mutex must be held
+    void stop_local() {
+        local_ready = false;
+        cache->save_index(0.0);
+        const auto metrics = cache->metrics();
+        TF_DEBUG(S3_DBG).Msg(
+            "S3: %llu hits, %llu misses, %llu fetches (%llu failed, %llu bytes), "
+            "%llu revalidations (%llu stale resolves), %llu evictions\n",
+            static_cast<unsigned long long>(metrics.hits),
+            static_cast<unsigned long long>(metrics.misses),
+            static_cast<unsigned long long>(metrics.fetches),
+            static_cast<unsigned long long>(metrics.fetch_failures),
+            static_cast<unsigned long long>(metrics.fetched_bytes),
+            static_cast<unsigned long long>(metrics.revalidations),
+            static_cast<unsigned long long>(metrics.stale),
+            static_cast<unsigned long long>(metrics.evictions));
+        cache.reset();
+        scheduler.reset();
+        object_store.reset();
+        controller.reset();
+    }
 
-        // set a custom endpoint e.g. an ActiveScale system node or minio server
-        if (!get_env_var(ENDPOINT_ENV_VAR, "").empty()) {
-            config.endpointOverride = (get_env_var(ENDPOINT_ENV_VAR, "")).c_str();
+    // Send a request to the daemon, callers check there is one before they
+    // build the request. Returns false if it went away or didn't answer
+    // within USD_S3_DAEMON_TIMEOUT, the caller then continues in process.
+    // A daemon that is only slow, say with a large download, keeps serving
+    // the next requests.
+    bool ask_daemon(const std::vector<std::string>& request, std::string& reply) {
+        bool timed_out = false;
+        if (!daemon_failed && daemon.load()->request(request, reply, &timed_out)) {
+            return true;
         }
-        if (!get_env_var(PROXY_HOST_ENV_VAR, "").empty()) {
-            config.proxyHost = get_env_var(PROXY_HOST_ENV_VAR, "").c_str();
-            config.proxyPort = atoi(get_env_var(PROXY_PORT_ENV_VAR, "80").c_str());
+        if (timed_out) {
+            TF_DEBUG(S3_DBG).Msg("S3: daemon request %s timed out, continuing in process\n",
+                request[0].c_str());
+        } else if (!daemon_failed.exchange(true)) {
+            S3_WARN("[S3Resolver] lost the cache daemon, continuing in process");
         }
+        if (!local_ready) {
+            mutex_scoped_lock lock(instances_mutex);
+            if (!local_ready) {
+                start_local();
+            }
+        }
+        return false;
+    }
 
-        config.connectTimeoutMs = 3000;
-        config.requestTimeoutMs = 3000;
-
-        // create a client with useVirtualAddressing=false to use path style addressing
-        // see https://github.com/aws/aws-sdk-cpp/issues/587
-        s3_client = Aws::New<Aws::S3::S3Client>("s3resolver", config, Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never, false);
+    // USD resolved the asset through the daemon, before it went away or
+    // timed out, so the cache of this process hasn't seen it yet
+    void adopt_resolved(string_view path) {
+        usd_cache::Entry entry;
+        if (!cache->lookup(path, entry)) {
+            cache->resolve(path);
+        }
+    }
 
+    S3::S3() {
+        {
+            mutex_scoped_lock lock(instances_mutex);
+            if (instances++ == 0) {
+                const auto socket_path = get_env_var(DAEMON_SOCKET_ENV_VAR, "");
+                std::string reply;
+                if (daemon != nullptr) {
+                    // a daemon lost by the previous instances may be back
+                    daemon_failed = !daemon.load()->request({"ping"}, reply);
+                } else if (!socket_path.empty()) {
+                    const int timeout = std::max(0, atoi(get_env_var(
+                        DAEMON_TIMEOUT_ENV_VAR, std::to_string(DAEMON_TIMEOUT)).c_str()));
+                    std::unique_ptr<DaemonClient> client(new DaemonClient(socket_path, timeout));
+                    if (client->request({"ping"}, reply)) {
+                        daemon_failed = false;
+                        daemon = client.release();
+                    } else {
+                        TF_DEBUG(S3_DBG).Msg("S3: no daemon at %s\n", socket_path.c_str());
+                    }
+                }
+                if (daemon == nullptr || daemon_failed) {
+                    start_local();
+                }
+            }
+        }
+        // a daemon prefetches what it fetches itself
+        const int prefetch_threads = atoi(get_env_var(PREFETCH_ENV_VAR, "0").c_str());
+        if (prefetch_threads > 0 && (daemon == nullptr || daemon_failed)) {
+            prefetcher.reset(new Prefetcher(*this, static_cast<size_t>(prefetch_threads)));
+        }
     }
 
     S3::~S3() {
-        TF_DEBUG(S3_DBG).Msg("S3: client teardown \n");
-        Aws::Delete(s3_client);
-        Aws::ShutdownAPI(options);
+        // stop prefetching before the object store goes away
+        prefetcher.reset();
+        mutex_scoped_lock lock(instances_mutex);
+        if (--instances == 0) {
+            if (local_ready) {
+                stop_local();
+            }
+        }
     }
 
     // Resolve an asset path such as 's3://hello/world.usd'
-    // Checks if the asset exists and returns a local path for the asset
+    // Returns a local path for the asset, the asset is only looked up on
+    // the object store when it is fetched. Fetched assets are checked for
+    // changes once USD_S3_TTL expired.
     std::string S3::resolve_name(const std::string& asset_path) {
-        const auto path = parse_path(asset_path);
-        TF_DEBUG(S3_DBG).Msg("S3: resolve_name %s\n", path.c_str());
-        const auto cached_result = cached_requests.find(path);
-        if (cached_result != cached_requests.end()) {
-            if (cached_result->second.state == CACHE_FETCHED) {
-                TF_DEBUG_TIMED_SCOPE(USD_S3_RESOLVER, "RESOLVE %s", path.c_str());
-                TF_DEBUG(S3_DBG).Msg("S3: resolve_name - got cache, need check %s\n", path.c_str());
-                return check_object(path, cached_result->second);
-            }
-            if (cached_result->second.state != CACHE_MISSING) {
-                TF_DEBUG(S3_DBG).Msg("S3: resolve_name - use cached result for %s\n", path.c_str());
-                return cached_result->second.local_path;
-            }
-            TF_DEBUG(S3_DBG).Msg("S3: resolve_name - refresh cached result for %s\n", path.c_str());
-            // TODO: this should just generate a local path
-            // return check_object(path, cached_result->second);
-            return cached_result->second.local_path;
-        } else {
-            Cache cache{
-                CACHE_NEEDS_FETCHING,
-                generate_path(path)
-            };
-            TF_DEBUG(S3_DBG).Msg("S3: resolve_name - no cache for %s\n", path.c_str());
-            // std::string result = check_object(path, cache);
-            // TODO: this should just generate a local path
-            cached_requests.insert(std::make_pair(path, cache));
-            return cache.local_path;
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"resolve", asset_path}, reply)) {
+            return reply;
         }
+        const auto path = parse_path(asset_path);
+        TF_DEBUG(S3_DBG).Msg("S3: resolve_name %s\n", path.to_string().c_str());
+        return cache->resolve(path);
     }
 
     // Update asset info for resolved assets
     // If the asset needs fetching, nothing is done as the cache is updated during the fetch phase
     // If the asset doesn't need fetching, also do nothing (lol)
     void S3::update_asset_info(const std::string& asset_path) {
-        // const auto path = parse_path(asset_path);
-        // const auto cached_result = cached_requests.find(path);
-        // if (cached_result != cached_requests.end()) {
-        //     //
-        //     if (cached_result->second.state == CACHE_NEEDS_FETCHING) {
-        //         return;
-        //     }
-
-        //     TF_DEBUG(S3_DBG).Msg("S3: update_asset_info %s cache state %d\n", path.c_str(), cached_result->second.state);
-        //     //cached_result->second.state = CACHE_NEEDS_FETCHING;
-        //     //cached_result->second.timestamp = INVALID_TIME;
-        //     //check_object(path, cached_result->second);
-        // }
     }
 
     // Fetch an asset to a local path
     // The asset should be resolved first and exist in the cache
-    bool S3::fetch_asset(const std::string& asset_path, const std::string& local_path) {
+    bool S3::fetch_asset(
+            const std::string& asset_path, const std::string& local_path, FetchPriority priority) {
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"fetch", asset_path, std::to_string(priority)}, reply)) {
+            return reply == "1";
+        }
         const auto path = parse_path(asset_path);
-        TF_DEBUG(S3_DBG).Msg("S3: fetch_asset %s\n", path.c_str());
-        if (s3_client == nullptr) {
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_asset - abort due to s3_client nullptr\n");
+        TF_DEBUG(S3_DBG).Msg("S3: fetch_asset %s\n", path.to_string().c_str());
+        if (object_store == nullptr) {
+            TF_DEBUG(S3_DBG).Msg("S3: fetch_asset - abort due to object_store nullptr\n");
             return false;
         }
+        if (daemon != nullptr) {
+            adopt_resolved(path);
+        }
 
-        const auto cached_result = cached_requests.find(path);
-        if (cached_result == cached_requests.end()) {
-            S3_WARN("[S3Resolver] %s was not resolved before fetching!", path.c_str());
+        // only one thread fetches an asset, the others wait for it. USD
+        // waiting for a queued prefetch moves it ahead of the others.
+        if (priority == PRIORITY_DEMAND) {
+            scheduler->promote(path);
+        }
+        const FetchPriority previous_priority = fetch_priority;
+        fetch_priority = priority;
+        usd_cache::Entry fetched{usd_cache::CACHE_MISSING};
+        const bool success = cache->fetch(path, &fetched);
+        fetch_priority = previous_priority;
+        if (!success) {
+            usd_cache::Entry entry;
+            if (!cache->lookup(path, entry)) {
+                S3_WARN("[S3Resolver] %s was not resolved before fetching!", path.to_string().c_str());
+            }
             return false;
         }
-
-        if (cached_result->second.state == CACHE_NEEDS_FETCHING) {
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_asset - cache needed fetching\n");
-            cached_result->second.state = CACHE_MISSING; // we'll set this up if fetching is successful
-            bool success = fetch_object(path, cached_result->second);
-            return success;
-        } else {
-            TF_DEBUG(S3_DBG).Msg("S3: fetch_asset - cache does not need fetch\n");
+        if (fetched.state == usd_cache::CACHE_FETCHED && prefetcher) {
+            prefetcher->layer_fetched(asset_path, fetched.local_path);
         }
         return true;
     }
@@ -415,32 +520,131 @@ namespace usd_s3 {
 
     // returns the timestamp of the local cached asset
     double S3::get_timestamp(const std::string& asset_path) {
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"timestamp", asset_path}, reply)) {
+            return atof(reply.c_str());
+        }
         const auto path = parse_path(asset_path);
-        if (s3_client == nullptr) {
+        if (object_store == nullptr) {
             return 1.0;
         }
 
-        const auto cached_result = cached_requests.find(path);
-        if (cached_result == cached_requests.end() ||
-                cached_result->second.state == CACHE_MISSING) {
-            S3_WARN("[S3Resolver] %s is missing when querying timestamps!",
-                    path.c_str());
+        if (daemon != nullptr) {
+            adopt_resolved(path);
+        }
+        usd_cache::Entry entry;
+        if (!cache->lookup(path, entry) || entry.state == usd_cache::CACHE_MISSING) {
+            S3_WARN("[S3Resolver] %s is missing when querying timestamps!", path.to_string().c_str());
             return 1.0;
+        }
+        return entry.timestamp;
+    }
+
+    // Upload a saved layer and make the saved file the cached copy, so the
+    // next resolve doesn't download what was just written. Sdf sends the save
+    // notice for Export too, without the path written: a cached copy still
+    // dated like its object wasn't saved and isn't uploaded. A failed upload
+    // leaves the copy with a later date, so the next save uploads it again.
+    bool S3::save_asset(const std::string& asset_path, const std::string& local_path) {
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"save", asset_path, local_path}, reply)) {
+            return reply == "1";
+        }
+        const std::string path = parse_path(asset_path).to_string();
+        TF_DEBUG(S3_DBG).Msg("S3: save_asset %s from %s\n", path.c_str(), local_path.c_str());
+        if (object_store == nullptr) {
+            TF_DEBUG(S3_DBG).Msg("S3: save_asset - abort due to object_store nullptr\n");
+            return false;
+        }
+        usd_cache::Entry cached;
+        double local_date_modified = 0.0;
+        if (local_path == generate_path(path) && cache->lookup(path, cached) &&
+            cached.state == usd_cache::CACHE_FETCHED &&
+            ArchGetModificationTime(local_path.c_str(), &local_date_modified) &&
+            std::abs(local_date_modified - cached.timestamp) < 1e-3) {
+            TF_DEBUG(S3_DBG).Msg("S3: save_asset - %s is unchanged\n", local_path.c_str());
+            return true;
+        }
+        const ObjectRequest request = make_request(path);
+        if (!request.version_id.empty()) {
+            S3_WARN("[S3Resolver] can't save %s, versions are read only", path.c_str());
+            return false;
+        }
+
+        const size_t part_size = static_cast<size_t>(
+            atof(get_env_var(UPLOAD_PART_SIZE_ENV_VAR, "8").c_str()) * (1 << 20));
+        const size_t num_threads = static_cast<size_t>(
+            std::max(atoi(get_env_var(UPLOAD_THREADS_ENV_VAR, "4").c_str()), 1));
+        const auto outcome = upload_file(*object_store, request, local_path, part_size, num_threads);
+        if (!outcome.is_success()) {
+            S3_WARN("[S3Resolver] failed to save %s: %s", path.c_str(), outcome.message.c_str());
+            return false;
+        }
+
+        // The upload doesn't return the date of the new object
+        ObjectInfo info;
+        usd_cache::Entry entry{
+            usd_cache::CACHE_FETCHED, local_path, usd_cache::INVALID_TIME, 0, std::string(), false};
+        if (object_store->head(request, info).is_success()) {
+            entry.timestamp = info.last_modified;
+            entry.size = info.size;
+            entry.etag = info.etag;
+            // fetch_object compares the date of the local copy with the object
+            set_modification_time(local_path, info.last_modified);
         } else {
-            return cached_result->second.timestamp;
+            entry.state = usd_cache::CACHE_NEEDS_FETCHING;
+        }
+        if (local_path != generate_path(path)) {
+            // saved somewhere else than the cached copy, which is outdated now
+            entry.state = usd_cache::CACHE_NEEDS_FETCHING;
+            entry.local_path = generate_path(path);
         }
+        cache->store(path, entry);
+        return true;
     }
 
-    // refresh all assets with this prefix
+    // refresh all assets with this prefix, with a single list request when
+    // the prefix names a bucket
     void S3::refresh(const std::string& prefix) {
-        if (prefix.empty()) {
-            // refresh all assets
-            cached_requests.clear();
-        } else {
-            // TODO: remove only matching assets
-            // and reload based on S3 list operation with prefix
-            cached_requests.clear();
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"refresh", prefix}, reply)) {
+            return;
+        }
+        cache->refresh(matches_schema(prefix) ? parse_path(prefix).to_string() : prefix);
+        if (prefetcher) {
+            prefetcher->reset();
+        }
+    }
+
+    // The counters of the daemon's cache when there is one
+    usd_cache::Metrics S3::get_metrics() {
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"metrics"}, reply)) {
+            usd_cache::Metrics metrics{};
+            std::istringstream values(reply);
+            values >> metrics.hits >> metrics.misses >> metrics.fetches >> metrics.fetch_failures
+                   >> metrics.joined >> metrics.revalidations >> metrics.stale >> metrics.changes
+                   >> metrics.evictions >> metrics.fetched_bytes >> metrics.cached_bytes >> metrics.entries;
+            return metrics;
+        }
+        return cache->metrics();
+    }
+
+    // Only the requests of this process, a daemon keeps its own
+    std::map<std::string, EndpointMetrics> S3::get_endpoint_metrics() {
+        return controller == nullptr || !local_ready
+            ? std::map<std::string, EndpointMetrics>() : controller->metrics();
+    }
+
+    // Write the fetched assets to the persistent index, merged with the
+    // entries other processes wrote since we loaded it
+    void S3::save_index() {
+        std::string reply;
+        if (daemon != nullptr && ask_daemon({"save_index"}, reply)) {
+            return;
         }
+        cache->save_index(0.0);
+        TF_DEBUG(S3_DBG).Msg("S3: save_index\n");
     }
 
 }
@@ -1,16 +1,19 @@
 #ifndef S3_H
 #define S3_H
 
-#include <aws/core/Aws.h>
-#include <aws/s3/S3Client.h>
-#include <aws/s3/model/GetObjectRequest.h>
-#include <fstream>
-
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 #include <map>
 
+#include "concurrency.h"
+#include "scheduler.h"
+
+namespace usd_cache {
+    struct Metrics;
+}
+
 namespace usd_s3 {
     constexpr const char S3_PREFIX[] = "s3://";
     constexpr const char S3_PREFIX_SINGLE[] = "s3:/";
@@ -20,6 +23,21 @@ namespace usd_s3 {
     constexpr const char PROXY_HOST_ENV_VAR[] = "USD_S3_PROXY_HOST";
     constexpr const char PROXY_PORT_ENV_VAR[] = "USD_S3_PROXY_PORT";
     constexpr const char ENDPOINT_ENV_VAR[] = "USD_S3_ENDPOINT";
+    constexpr const char PREFETCH_ENV_VAR[] = "USD_S3_PREFETCH";
+    constexpr const char TTL_ENV_VAR[] = "USD_S3_TTL";
+    constexpr const char CACHE_SIZE_ENV_VAR[] = "USD_S3_CACHE_SIZE_MB";
+    constexpr const char REVALIDATE_THREADS_ENV_VAR[] = "USD_S3_REVALIDATE_THREADS";
+    constexpr const char DEMAND_FETCHES_ENV_VAR[] = "USD_S3_DEMAND_FETCHES";
+    constexpr const char PREFETCH_FETCHES_ENV_VAR[] = "USD_S3_PREFETCH_FETCHES";
+    constexpr const char REQUESTS_ENV_VAR[] = "USD_S3_REQUESTS";
+    constexpr const char MAX_REQUESTS_ENV_VAR[] = "USD_S3_MAX_REQUESTS";
+    constexpr const char UPLOAD_PART_SIZE_ENV_VAR[] = "USD_S3_UPLOAD_PART_SIZE_MB";
+    constexpr const char UPLOAD_THREADS_ENV_VAR[] = "USD_S3_UPLOAD_THREADS";
+    constexpr const char DAEMON_SOCKET_ENV_VAR[] = "USD_S3_DAEMON_SOCKET";
+    constexpr const char DAEMON_TIMEOUT_ENV_VAR[] = "USD_S3_DAEMON_TIMEOUT";
+    constexpr const char INDEX_FILE_NAME[] = ".usd_s3_index";
+
+    class Prefetcher;
 
     class S3 {
     public:
@@ -30,11 +48,39 @@ namespace usd_s3 {
 
         std::string resolve_name(const std::string& path);
         void update_asset_info(const std::string& asset_path);
-        bool fetch_asset(const std::string& asset_path, const std::string& local_path);
+        // Prefetch and warmup fetch with PRIORITY_PREFETCH, so they don't
+        // hold up the fetches USD is waiting for, see scheduler.h
+        bool fetch_asset(
+            const std::string& asset_path, const std::string& local_path,
+            FetchPriority priority = PRIORITY_DEMAND);
         double get_timestamp(const std::string& asset_path);
 
+        // Upload a saved layer from local_path with a parallel multipart
+        // upload, then cache local_path as the current copy of the asset.
+        // Versioned paths can't be written.
+        bool save_asset(const std::string& asset_path, const std::string& local_path);
+
         void refresh(const std::string& prefix);
+
+        // Download assets into the local cache with num_threads parallel
+        // fetches, following their s3: sublayers, references and payloads
+        // unless follow_dependencies is false.
+        // Returns the number of assets that could not be fetched.
+        size_t warmup(
+            const std::vector<std::string>& asset_paths, size_t num_threads,
+            bool follow_dependencies = true);
+
+        // Write the persistent cache index, done on shutdown and after warmup
+        void save_index();
+
+        // Counters of the cache, see cache_engine.h
+        usd_cache::Metrics get_metrics();
+        // The adaptive request limit of every bucket used so far, see
+        // concurrency.h. Empty when USD_S3_REQUESTS is 0.
+        std::map<std::string, EndpointMetrics> get_endpoint_metrics();
         private:
+            // set when USD_S3_PREFETCH asks for prefetch threads
+            std::unique_ptr<Prefetcher> prefetcher;
     };
 }
 
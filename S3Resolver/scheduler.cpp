@@ -0,0 +1,81 @@
+#include "scheduler.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+}
+
+namespace usd_s3 {
+    FetchScheduler::FetchScheduler(size_t demand_limit, size_t prefetch_limit)
+        : limits{demand_limit, prefetch_limit}, running{0, 0} {
+    }
+
+    FetchScheduler::Slot::Slot(FetchScheduler& scheduler, const std::string& key, FetchPriority priority)
+        : scheduler(scheduler), priority(scheduler.acquire(key, priority)) {
+    }
+
+    FetchScheduler::Slot::~Slot() {
+        scheduler.release(priority);
+    }
+
+    void FetchScheduler::promote(boost::string_view key) {
+        mutex_scoped_lock lock(mutex);
+        for (auto& waiter : waiting) {
+            if (waiter.key == key && waiter.priority != PRIORITY_DEMAND) {
+                TF_DEBUG(S3_DBG).Msg("S3: promote prefetch of %s\n", waiter.key.c_str());
+                waiter.priority = PRIORITY_DEMAND;
+                changed.notify_all();
+            }
+        }
+    }
+
+    // Waits in line with the other downloads of its class, the waiter's
+    // class may change in the meantime, see promote. Returns the class the
+    // slot was taken from.
+    FetchPriority FetchScheduler::acquire(const std::string& key, FetchPriority priority) {
+        std::unique_lock<std::mutex> lock(mutex);
+        const auto waiter = waiting.insert(waiting.end(), Waiter{key, priority});
+        changed.wait(lock, [&]() { return can_start(waiter); });
+        priority = waiter->priority;
+        waiting.erase(waiter);
+        ++running[priority];
+        // the next waiter of another class may be able to start now
+        changed.notify_all();
+        return priority;
+    }
+
+    void FetchScheduler::release(FetchPriority priority) {
+        {
+            mutex_scoped_lock lock(mutex);
+            --running[priority];
+        }
+        changed.notify_all();
+    }
+
+    // A waiter starts once its class has a free slot and it is the first
+    // waiter of its class. Prefetches also wait for every demand fetch.
+    bool FetchScheduler::can_start(Waiters::const_iterator waiter) const {
+        const auto priority = waiter->priority;
+        if (limits[priority] != 0 && running[priority] >= limits[priority]) {
+            return false;
+        }
+        for (auto it = waiting.cbegin(); it != waiter; ++it) {
+            if (it->priority == priority) {
+                return false;
+            }
+        }
+        if (priority == PRIORITY_DEMAND) {
+            return true;
+        }
+        for (const auto& other : waiting) {
+            if (other.priority == PRIORITY_DEMAND) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <boost/utility/string_view.hpp>
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+
+namespace usd_s3 {
+    // Fetches USD is blocked on come first, speculative ones (prefetch and
+    // warmup) use what is left
+    enum FetchPriority {
+        PRIORITY_DEMAND,
+        PRIORITY_PREFETCH,
+        NUM_PRIORITIES
+    };
+
+    // Limits the downloads running at once per priority class, so that
+    // background transfers can't take every connection. A waiting demand
+    // fetch starts before any waiting prefetch, and a prefetch still waiting
+    // for its turn is promoted when USD asks for the same asset.
+    class FetchScheduler {
+    public:
+        // A limit of 0 doesn't limit the class
+        FetchScheduler(size_t demand_limit, size_t prefetch_limit);
+
+        // Holds a download slot while in scope
+        class Slot {
+        public:
+            Slot(FetchScheduler& scheduler, const std::string& key, FetchPriority priority);
+            ~Slot();
+
+        private:
+            FetchScheduler& scheduler;
+            FetchPriority priority; // of the class the slot was taken from
+        };
+
+        // Move a waiting download of key to the demand class
+        void promote(boost::string_view key);
+
+    private:
+        struct Waiter {
+            std::string key;
+            FetchPriority priority;
+        };
+        using Waiters = std::list<Waiter>;
+
+        FetchPriority acquire(const std::string& key, FetchPriority priority);
+        void release(FetchPriority priority);
+        bool can_start(Waiters::const_iterator waiter) const;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        Waiters waiting; // in arrival order
+        size_t limits[NUM_PRIORITIES];
+        size_t running[NUM_PRIORITIES];
+    };
+}
+
+#endif // SCHEDULER_H
@@ -0,0 +1,128 @@
+#include "object_store.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace {
+    using mutex_scoped_lock = std::lock_guard<std::mutex>;
+
+    // The limits of S3 multipart uploads
+    constexpr size_t MIN_PART_SIZE = 5 << 20;
+    constexpr size_t MAX_PARTS = 10000;
+
+    // Parts are idempotent, a failed one is simply sent again
+    constexpr int MAX_PART_ATTEMPTS = 3;
+    constexpr auto RETRY_DELAY = std::chrono::milliseconds(200);
+
+    bool read_part(int fd, char* data, size_t size, off_t offset) {
+        while (size > 0) {
+            const auto count = pread(fd, data, size, offset);
+            if (count <= 0) {
+                return false;
+            }
+            data += count;
+            size -= count;
+            offset += count;
+        }
+        return true;
+    }
+}
+
+namespace usd_s3 {
+    StoreOutcome upload_file(
+            ObjectStore& store, const ObjectRequest& request, const std::string& local_path,
+            size_t part_size, size_t num_threads) {
+        const int fd = open(local_path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return StoreOutcome{STORE_ERROR, "failed to open " + local_path};
+        }
+        const size_t size = static_cast<size_t>(st.st_size);
+        // only the last part may be smaller than MIN_PART_SIZE
+        part_size = std::max(part_size, MIN_PART_SIZE);
+        part_size = std::max(part_size, (size + MAX_PARTS - 1) / MAX_PARTS);
+        const size_t num_parts = std::max<size_t>((size + part_size - 1) / part_size, 1);
+
+        std::string upload_id;
+        StoreOutcome outcome = store.create_multipart(request, upload_id);
+        if (!outcome.is_success()) {
+            close(fd);
+            return outcome;
+        }
+        TF_DEBUG(S3_DBG).Msg("S3: upload_file %s, %zu bytes in %zu parts\n",
+            local_path.c_str(), size, num_parts);
+
+        // Workers take the next part, read it and send it, so every thread
+        // holds a single part buffer at a time
+        std::vector<std::string> etags(num_parts);
+        std::atomic<size_t> next_part(0);
+        std::atomic<bool> failed(false);
+        std::mutex failure_mutex;
+        auto upload_parts = [&]() {
+            std::vector<char> buffer;
+            while (!failed) {
+                const size_t part = next_part++;
+                if (part >= num_parts) {
+                    break;
+                }
+                const size_t offset = part * part_size;
+                const size_t length = std::min(part_size, size - std::min(offset, size));
+                buffer.resize(length);
+                StoreOutcome part_outcome{STORE_ERROR, "failed to read " + local_path};
+                if (read_part(fd, buffer.data(), length, static_cast<off_t>(offset))) {
+                    for (int attempt = 1; attempt <= MAX_PART_ATTEMPTS; ++attempt) {
+                        part_outcome = store.upload_part(
+                            request, upload_id, static_cast<int>(part + 1),
+                            buffer.data(), length, etags[part]);
+                        if (part_outcome.is_success() || attempt == MAX_PART_ATTEMPTS) {
+                            break;
+                        }
+                        std::this_thread::sleep_for(RETRY_DELAY * attempt);
+                    }
+                }
+                if (!part_outcome.is_success()) {
+                    mutex_scoped_lock lock(failure_mutex);
+                    if (!failed) {
+                        outcome = part_outcome;
+                        failed = true;
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        const size_t extra_threads = std::min(std::max<size_t>(num_threads, 1), num_parts) - 1;
+        for (size_t i = 0; i < extra_threads; ++i) {
+            threads.emplace_back(upload_parts);
+        }
+        upload_parts();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        close(fd);
+
+        if (failed) {
+            store.abort_multipart(request, upload_id);
+            return outcome;
+        }
+        outcome = store.complete_multipart(request, upload_id, etags);
+        if (!outcome.is_success()) {
+            store.abort_multipart(request, upload_id);
+        }
+        return outcome;
+    }
+}
@@ -0,0 +1,84 @@
+#include "s3.h"
+#include "prefetch.h"
+#include "debugCodes.h"
+
+#include <pxr/base/tf/diagnosticLite.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+
+PXR_NAMESPACE_USING_DIRECTIVE
+
+namespace usd_s3 {
+    // Fetch assets from a shared queue with num_threads workers. Fetched
+    // layers are parsed for s3: dependencies, which join the same queue, so
+    // the whole dependency tree downloads in parallel.
+    size_t S3::warmup(
+            const std::vector<std::string>& asset_paths, size_t num_threads,
+            bool follow_dependencies) {
+        TF_DEBUG_TIMED_SCOPE(USD_S3_RESOLVER, "WARMUP %zu assets", asset_paths.size());
+        std::mutex queue_mutex;
+        std::condition_variable queue_changed;
+        std::deque<std::string> queue;
+        std::set<std::string> seen;
+        size_t active = 0;
+        size_t failed = 0;
+
+        for (const auto& asset_path : asset_paths) {
+            if (matches_schema(asset_path) && seen.insert(asset_path).second) {
+                queue.push_back(asset_path);
+            }
+        }
+
+        auto worker = [&]() {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (true) {
+                queue_changed.wait(lock, [&]() { return !queue.empty() || active == 0; });
+                if (queue.empty()) {
+                    // nothing queued and nobody left who could queue more
+                    return;
+                }
+                const std::string asset_path = queue.front();
+                queue.pop_front();
+                ++active;
+                lock.unlock();
+
+                std::vector<std::string> dependencies;
+                const auto local_path = resolve_name(asset_path);
+                const bool success = !local_path.empty() && fetch_asset(asset_path, local_path, PRIORITY_PREFETCH);
+                if (success && follow_dependencies) {
+                    dependencies = get_dependencies(asset_path, local_path);
+                }
+                TF_DEBUG(S3_DBG).Msg("S3: warmup %s %s, %zu dependencies\n",
+                    asset_path.c_str(), success ? "OK" : "NOK", dependencies.size());
+
+                lock.lock();
+                --active;
+                if (!success) {
+                    ++failed;
+                }
+                for (const auto& dependency : dependencies) {
+                    if (matches_schema(dependency) && seen.insert(dependency).second) {
+                        queue.push_back(dependency);
+                    }
+                }
+                queue_changed.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < std::max<size_t>(1, num_threads); ++i) {
+            threads.emplace_back(worker);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        save_index();
+        return failed;
+    }
+}
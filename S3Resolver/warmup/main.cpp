@@ -0,0 +1,61 @@
+#include "s3.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Download s3: assets and their dependencies into USD_S3_CACHE_PATH before
+// a job starts, so opening the stage only needs local reads.
+int main(int argc, char* argv[]) {
+    size_t num_threads = 16;
+    bool follow_dependencies = true;
+    std::vector<std::string> asset_paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            num_threads = static_cast<size_t>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            // one asset path per line, # starts a comment
+            std::ifstream manifest(argv[++i]);
+            if (!manifest) {
+                std::cerr << "Could not read manifest " << argv[i] << std::endl;
+                return -1;
+            }
+            std::string line;
+            while (std::getline(manifest, line)) {
+                line = line.substr(0, line.find('#'));
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                line.erase(0, line.find_first_not_of(" \t"));
+                if (!line.empty()) {
+                    asset_paths.push_back(line);
+                }
+            }
+        } else if (strcmp(argv[i], "--no-dependencies") == 0) {
+            follow_dependencies = false;
+        } else if (argv[i][0] == '-') {
+            asset_paths.clear();
+            break;
+        } else {
+            asset_paths.push_back(argv[i]);
+        }
+    }
+
+    if (asset_paths.empty()) {
+        std::cerr << "Usage: usd_s3_warmup [-j threads] [-m manifest] [--no-dependencies] "
+                     "[s3:asset.usd ...]" << std::endl;
+        return -1;
+    }
+
+    // nothing else is fetching here, let every thread download
+    setenv(usd_s3::PREFETCH_FETCHES_ENV_VAR, std::to_string(num_threads).c_str(), 0);
+    usd_s3::S3 s3;
+    const auto failed = s3.warmup(asset_paths, num_threads, follow_dependencies);
+    if (failed > 0) {
+        std::cerr << failed << " assets could not be fetched" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,851 @@
+#pragma once
+
+#include <tbb/concurrent_hash_map.h>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The local cache shared by the resolvers. A backend only knows how to talk
+// to its store, the engine owns the cache entries, their concurrency and
+// persistence.
+//
+// A backend provides:
+//
+//   // The local path the asset at key is cached at
+//   std::string local_path(const std::string& key);
+//   // Ask the store for the metadata of key: timestamp, size and etag of
+//   // the entry are updated, state is set to CACHE_MISSING if the asset
+//   // doesn't exist. Returns false if the store couldn't be asked.
+//   bool head(const std::string& key, usd_cache::Entry& entry);
+//   // Bring the local copy at entry.local_path up to date and update the
+//   // metadata of the entry. Returns false if the asset couldn't be
+//   // fetched.
+//   bool get(const std::string& key, usd_cache::Entry& entry);
+//   // The metadata of the assets below prefix, keyed like the cache.
+//   // Returns false if the store can't list or the listing failed.
+//   bool list(
+//       const std::string& prefix,
+//       std::map<std::string, usd_cache::Entry>& entries);
+//
+// The engine never holds its lock while calling the backend.
+namespace usd_cache {
+using string_view = boost::string_view;
+
+constexpr double INVALID_TIME = std::numeric_limits<double>::lowest();
+
+enum CacheState {
+    CACHE_MISSING,
+    CACHE_NEEDS_FETCHING,
+    CACHE_FETCHING, // a fetch is in flight, wait for it
+    CACHE_FETCHED
+};
+
+struct Entry {
+    CacheState state;
+    std::string local_path;
+    double timestamp; // date last modified on the store
+    uint64_t size;    // of the local copy
+    std::string etag; // empty if the store has none
+    bool is_pinned;   // pinned (versioned) assets can't change
+};
+
+// Counters since the engine was created, and the current contents
+struct Metrics {
+    uint64_t hits;           // resolves and fetches served from the cache
+    uint64_t misses;         // resolves of assets not cached yet
+    uint64_t fetches;        // downloads started
+    uint64_t fetch_failures;
+    uint64_t joined;         // waits for a request of another thread
+    uint64_t revalidations;  // metadata requests of cached assets
+    uint64_t stale;          // resolves answered while revalidating
+    uint64_t changes;        // cached assets found out of date
+    uint64_t evictions;
+    uint64_t fetched_bytes;
+    uint64_t cached_bytes;
+    uint64_t entries;
+};
+
+struct Options {
+    // Directory and name of the persistent index, no index if empty
+    std::string index_root;
+    std::string index_name;
+    // Seconds a fetched asset is used before asking the store again, a
+    // negative ttl never asks again
+    double ttl;
+    // Local copies are evicted, least recently used first, once they take
+    // more than max_bytes. 0 keeps everything.
+    uint64_t max_bytes;
+    // Use the unpinned entries of the index without asking the store again
+    bool trust_index;
+    // Threads revalidating expired assets in the background. Resolves then
+    // return the cached copy right away and a change is fetched on the
+    // next use. 0 revalidates on the resolving thread.
+    size_t revalidate_threads;
+};
+
+template <class Backend>
+class CacheEngine {
+public:
+    CacheEngine(Backend& backend, const Options& options)
+        : backend(backend),
+          options(options),
+          lru_newest(nullptr),
+          lru_oldest(nullptr),
+          lru_count(0),
+          cached_bytes(0),
+          stopping(false) {}
+
+    ~CacheEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (auto& worker : workers) { worker.join(); }
+    }
+
+    // The local path of an asset, without taking the lock when the asset is
+    // cached and current. Assets not cached yet are added without asking
+    // the store, fetch finds out if they exist. Cached assets are checked
+    // with the store once their ttl expired, one thread asks for everyone,
+    // or a background thread with revalidate_threads. Returns an empty
+    // string for missing assets. Hits only copy the local path.
+    std::string resolve(string_view key) {
+        {
+            typename ResolvedPaths::const_accessor accessor;
+            if (resolved_paths.find(accessor, key) &&
+                steady_clock::now() < accessor->second.valid_until) {
+                ++counters.hits;
+                mark_used(*accessor->second.record);
+                return accessor->second.local_path;
+            }
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        auto record = wait_for(lock, key);
+        if (record == records.end() ||
+            record->second.entry.state == CACHE_MISSING) {
+            ++counters.misses;
+            if (record == records.end()) {
+                record = add_record(key.to_string());
+            }
+            Record& added = record->second;
+            added.entry = Entry{
+                CACHE_NEEDS_FETCHING, backend.local_path(record->first),
+                INVALID_TIME, 0, std::string(), false};
+            touch(*record);
+            publish(*record);
+            return added.entry.local_path;
+        }
+        Record& cached = record->second;
+        touch(*record);
+        if (cached.entry.state != CACHE_FETCHED || is_current(cached)) {
+            ++counters.hits;
+            return cached.entry.local_path;
+        }
+        if (cached.checking) {
+            // only background checks are left in flight for resolves
+            ++counters.stale;
+            return cached.entry.local_path;
+        }
+
+        ++counters.revalidations;
+        cached.checking = true;
+        if (options.revalidate_threads > 0) {
+            ++counters.stale;
+            revalidate_queue.push_back(record->first);
+            start_workers();
+            queued.notify_one();
+            return cached.entry.local_path;
+        }
+        // the record may go away while the lock is released
+        const std::string checked_key = record->first;
+        Entry entry = cached.entry;
+        lock.unlock();
+        const bool asked = backend.head(checked_key, entry);
+        lock.lock();
+        record = find_record(key);
+        if (record == records.end()) {
+            changed.notify_all();
+            return asked && entry.state != CACHE_MISSING ? entry.local_path
+                                                         : std::string();
+        }
+        record->second.checking = false;
+        if (asked) { apply_head(*record, entry); }
+        changed.notify_all();
+        return record->second.entry.state == CACHE_MISSING
+                   ? std::string()
+                   : record->second.entry.local_path;
+    }
+
+    // The local path of a resolved asset, without taking the lock. Returns
+    // an empty string if the asset is missing or not resolved yet.
+    std::string find_local_path(string_view key) const {
+        typename ResolvedPaths::const_accessor accessor;
+        return resolved_paths.find(accessor, key) ? accessor->second.local_path
+                                                  : std::string();
+    }
+
+    // A copy of the entry of an asset, returns false if there is none
+    bool lookup(string_view key, Entry& entry) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto record = find_record(key);
+        if (record == records.end()) { return false; }
+        entry = record->second.entry;
+        return true;
+    }
+
+    // Add an asset whose metadata was queried elsewhere. Assets resolved by
+    // another thread in the meantime are left as they are.
+    void insert(const std::string& key, const Entry& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto inserted = records.find(key);
+        if (inserted == records.end()) {
+            inserted = add_record(key);
+        } else if (inserted->second.entry.state != CACHE_MISSING) {
+            return;
+        }
+        ++counters.misses;
+        inserted->second.entry = entry;
+        touch(*inserted);
+        publish(*inserted);
+    }
+
+    // Replace the entry of an asset, e.g. with a copy written locally and
+    // uploaded to the store
+    void store(const std::string& key, const Entry& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto stored = records.find(key);
+        if (stored == records.end()) { stored = add_record(key); }
+        Record& record = stored->second;
+        account(*stored, false);
+        record.entry = entry;
+        record.checked = steady_clock::now();
+        record.indexed = true;
+        account(*stored, true);
+        touch(*stored);
+        publish(*stored);
+        changed.notify_all();
+        evict(key);
+    }
+
+    // The store has a newer version of a cached asset, fetch it again
+    void update(
+        const std::string& key, double timestamp, uint64_t size,
+        const std::string& etag) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto record = records.find(key);
+        if (record == records.end() ||
+            record->second.entry.state == CACHE_MISSING) {
+            return;
+        }
+        Entry entry = record->second.entry;
+        entry.timestamp = timestamp;
+        entry.size = size;
+        entry.etag = etag;
+        apply_head(*record, entry);
+    }
+
+    // Download an asset unless the local copy is current. Only one thread
+    // fetches an asset, the others wait for it. Returns false if the asset
+    // wasn't resolved, is missing or couldn't be fetched. fetched is set if
+    // this call downloaded the asset. Hits don't allocate.
+    bool fetch(string_view key, Entry* fetched = nullptr) {
+        Entry entry;
+        if (!begin_fetch(key, entry, [](const Entry&) { return true; })) {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto record = find_record(key);
+            return record != records.end() &&
+                   record->second.entry.state == CACHE_FETCHED;
+        }
+        const std::string fetched_key = key.to_string();
+        backend.get(fetched_key, entry);
+        const bool success = end_fetch(fetched_key, entry);
+        if (success && fetched != nullptr) { *fetched = entry; }
+        return success;
+    }
+
+    // Split fetch for callers downloading on their own threads. Waits for a
+    // fetch in flight unless wait is false, then claims the asset if it
+    // needs fetching and accept returns true for its entry. The claimed
+    // entry has to be handed back to end_fetch with the outcome.
+    template <class Accept>
+    bool begin_fetch(
+        string_view key, Entry& entry, Accept accept, bool wait = true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        const auto record = wait ? wait_for(lock, key) : find_record(key);
+        if (record == records.end()) { return false; }
+        Record& cached = record->second;
+        touch(*record);
+        if (cached.entry.state != CACHE_NEEDS_FETCHING ||
+            !accept(cached.entry)) {
+            if (cached.entry.state == CACHE_FETCHED) { ++counters.hits; }
+            return false;
+        }
+        ++counters.fetches;
+        entry = cached.entry;
+        cached.entry.state = CACHE_FETCHING;
+        return true;
+    }
+
+    // Store the outcome of a claimed fetch, entry.state is CACHE_FETCHED if
+    // it succeeded. Returns whether it did.
+    bool end_fetch(const std::string& key, Entry entry) {
+        if (entry.state == CACHE_FETCHING ||
+            entry.state == CACHE_NEEDS_FETCHING) {
+            entry.state = CACHE_MISSING;
+        }
+        const bool success = entry.state == CACHE_FETCHED;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (success) {
+            counters.fetched_bytes += entry.size;
+        } else {
+            ++counters.fetch_failures;
+        }
+        const auto record = records.find(key);
+        if (record != records.end()) {
+            Record& cached = record->second;
+            // a revalidation may have seen a newer version than the fetched
+            if (success && cached.entry.timestamp > entry.timestamp) {
+                entry.state = CACHE_NEEDS_FETCHING;
+                entry.timestamp = cached.entry.timestamp;
+                entry.size = cached.entry.size;
+                entry.etag = cached.entry.etag;
+            }
+            account(*record, false);
+            cached.entry = entry;
+            cached.checked = steady_clock::now();
+            cached.indexed = cached.indexed || success;
+            account(*record, true);
+            touch(*record);
+            publish(*record);
+            evict(key);
+        }
+        changed.notify_all();
+        return success;
+    }
+
+    // Bring the cached assets below prefix up to date with one listing of
+    // the store, instead of a request per asset. If the store can't list
+    // them, they are forgotten and resolved again.
+    void refresh(const std::string& prefix) {
+        std::map<std::string, Entry> listed;
+        const bool success = !prefix.empty() && backend.list(prefix, listed);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto record = records.begin(); record != records.end();) {
+            if (record->first.compare(0, prefix.size(), prefix) != 0) {
+                ++record;
+                continue;
+            }
+            if (success && record->second.entry.is_pinned) {
+                ++record;
+                continue;
+            }
+            if (!success) {
+                account(*record, false);
+                resolved_paths.erase(record->first);
+                record = records.erase(record);
+                continue;
+            }
+            const auto found = listed.find(record->first);
+            Entry entry = record->second.entry;
+            if (found == listed.end()) {
+                entry.state = CACHE_MISSING;
+            } else {
+                entry.timestamp = found->second.timestamp;
+                entry.size = found->second.size;
+                entry.etag = found->second.etag;
+            }
+            ++counters.revalidations;
+            apply_head(*record, entry);
+            ++record;
+        }
+        changed.notify_all();
+    }
+
+    // Forget every asset, fetches in flight are dropped when they end
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        // erased one by one, concurrent resolves may be reading the map
+        for (const auto& record : records) {
+            resolved_paths.erase(record.first);
+        }
+        records.clear();
+        lru_newest = lru_oldest = nullptr;
+        lru_count = 0;
+        cached_bytes = 0;
+        changed.notify_all();
+    }
+
+    // Call visit with the key and entry of every asset, under the lock
+    template <class Visit>
+    void for_each(Visit visit) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& record : records) {
+            visit(record.first, record.second.entry);
+        }
+    }
+
+    Metrics metrics() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return Metrics{
+            counters.hits,          counters.misses,
+            counters.fetches,       counters.fetch_failures,
+            counters.joined,        counters.revalidations,
+            counters.stale,         counters.changes,
+            counters.evictions,     counters.fetched_bytes,
+            cached_bytes,           records.size()};
+    }
+
+    // The persistent index remembers the local copies across processes.
+    // The first line holds the format and a mark of the backend, then one
+    // asset per line: timestamp, size, pinned, etag and the key. Entries
+    // whose local copy is gone or has another size are skipped. Returns
+    // the mark, INVALID_TIME if there is no index.
+    double load_index() {
+        std::map<std::string, Entry> entries;
+        const double mark = read_index(entries);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& entry : entries) {
+            struct stat st;
+            if (stat(entry.second.local_path.c_str(), &st) != 0 ||
+                static_cast<uint64_t>(st.st_size) != entry.second.size) {
+                continue;
+            }
+            if (!entry.second.is_pinned && !options.trust_index) {
+                entry.second.state = CACHE_NEEDS_FETCHING;
+            }
+            auto loaded = records.find(entry.first);
+            if (loaded == records.end()) { loaded = add_record(entry.first); }
+            account(*loaded, false);
+            loaded->second.entry = entry.second;
+            account(*loaded, true);
+            publish(*loaded);
+        }
+        return mark;
+    }
+
+    // Write the fetched assets to the index, merged with the entries other
+    // processes wrote since it was loaded. Only the assets this process
+    // fetched or found out of date replace or remove the entries of others,
+    // an asset it merely resolved may have been fetched by another one. The
+    // merged index keeps the older of the two marks, so neither misses
+    // changes.
+    void save_index(double mark) {
+        if (options.index_root.empty()) { return; }
+        std::map<std::string, Entry> entries;
+        const double saved_mark = read_index(entries);
+        if (saved_mark != INVALID_TIME) { mark = std::min(mark, saved_mark); }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& record : records) {
+                if (!record.second.indexed) { continue; }
+                if (record.second.entry.state == CACHE_FETCHED) {
+                    entries[record.first] = record.second.entry;
+                } else {
+                    entries.erase(record.first);
+                }
+            }
+        }
+        if (entries.empty() || !make_dirs(options.index_root)) { return; }
+        const std::string index_path = get_index_path();
+        std::string temp_path = index_path + ".XXXXXX";
+        const int fd = mkstemp(&temp_path[0]);
+        if (fd == -1) { return; }
+        close(fd);
+        {
+            std::ofstream index(temp_path, std::ios::out | std::ios::trunc);
+            index.precision(17);
+            index << INDEX_FORMAT << '\t' << mark << '\n';
+            for (const auto& entry : entries) {
+                index << entry.second.timestamp << '\t' << entry.second.size
+                      << '\t' << entry.second.is_pinned << '\t'
+                      << entry.second.etag << '\t' << entry.first << '\n';
+            }
+        }
+        if (rename(temp_path.c_str(), index_path.c_str()) != 0) {
+            remove(temp_path.c_str());
+        }
+    }
+
+private:
+    using steady_clock = std::chrono::steady_clock;
+
+    static constexpr const char* INDEX_FORMAT = "usd_cache_1";
+
+    struct Record;
+    using Item = std::pair<const std::string, Record>;
+
+    struct Record {
+        Entry entry;
+        bool checking = false; // a head request is in flight
+        steady_clock::time_point checked; // the store last confirmed it
+        // This process fetched, stored or invalidated the local copy, so its
+        // state goes to the index, see save_index
+        bool indexed = false;
+        // The records holding a local copy form a list, most recently used
+        // first, see evict
+        Item* newer = nullptr;
+        Item* older = nullptr;
+        // The local path was handed out since the last eviction pass. Set
+        // without the lock by resolves of current assets.
+        std::atomic<bool> used{false};
+    };
+
+    // Keys are looked up by string_view, so a lookup doesn't need to
+    // allocate a key
+    struct KeyHash {
+        size_t operator()(string_view key) const {
+            return boost::hash_range(key.begin(), key.end());
+        }
+    };
+
+    struct KeyEqual {
+        bool operator()(string_view a, string_view b) const { return a == b; }
+    };
+
+    struct KeyHashCompare {
+        size_t hash(string_view key) const { return KeyHash()(key); }
+        bool equal(string_view a, string_view b) const { return a == b; }
+    };
+
+    // The nodes of records don't move, their keys outlive the views
+    using Records = boost::unordered_map<std::string, Record, KeyHash, KeyEqual>;
+
+    // Resolves of current assets only read the local path here. The keys
+    // point into the keys of records, an entry is erased before its record.
+    struct Resolved {
+        std::string local_path;
+        steady_clock::time_point valid_until;
+        Record* record = nullptr;
+    };
+    using ResolvedPaths =
+        tbb::concurrent_hash_map<string_view, Resolved, KeyHashCompare>;
+
+    // Cache hits count without the lock
+    struct Counters {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> fetches{0};
+        std::atomic<uint64_t> fetch_failures{0};
+        std::atomic<uint64_t> joined{0};
+        std::atomic<uint64_t> revalidations{0};
+        std::atomic<uint64_t> stale{0};
+        std::atomic<uint64_t> changes{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> fetched_bytes{0};
+    };
+
+    // Records hold an atomic and are built in place
+    typename Records::iterator add_record(std::string key) {
+        return records
+            .emplace(
+                std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                std::forward_as_tuple())
+            .first;
+    }
+
+    typename Records::iterator find_record(string_view key) {
+        return records.find(key, KeyHash(), KeyEqual());
+    }
+
+    typename Records::const_iterator find_record(string_view key) const {
+        return records.find(key, KeyHash(), KeyEqual());
+    }
+
+    // Wait for a request of another thread for the asset, the lock must be
+    // held
+    typename Records::iterator wait_for(
+        std::unique_lock<std::mutex>& lock, string_view key) {
+        auto record = find_record(key);
+        if (record != records.end() && is_busy(record->second)) {
+            ++counters.joined;
+            changed.wait(lock, [&]() {
+                record = find_record(key);
+                return record == records.end() || !is_busy(record->second);
+            });
+        }
+        return record;
+    }
+
+    // Background checks are not waited for, the cached copy is used
+    // meanwhile
+    bool is_busy(const Record& record) const {
+        return record.entry.state == CACHE_FETCHING ||
+               (record.checking && options.revalidate_threads == 0);
+    }
+
+    // Started by the first background check, the lock must be held
+    void start_workers() {
+        while (workers.size() < options.revalidate_threads) {
+            workers.emplace_back([this]() { revalidate(); });
+        }
+    }
+
+    // Ask the store for the queued assets until the engine goes away
+    void revalidate() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            queued.wait(lock, [&]() {
+                return stopping || !revalidate_queue.empty();
+            });
+            if (stopping) { return; }
+            const std::string key = revalidate_queue.front();
+            revalidate_queue.pop_front();
+            auto record = records.find(key);
+            if (record == records.end()) { continue; }
+            Entry entry = record->second.entry;
+            lock.unlock();
+            const bool asked = backend.head(key, entry);
+            lock.lock();
+            record = records.find(key);
+            if (record == records.end()) { continue; }
+            record->second.checking = false;
+            if (asked) { apply_head(*record, entry); }
+            changed.notify_all();
+        }
+    }
+
+    bool is_current(const Record& record) const {
+        return record.entry.is_pinned || options.ttl < 0 ||
+               steady_clock::now() < valid_until(record);
+    }
+
+    steady_clock::time_point valid_until(const Record& record) const {
+        if (record.entry.is_pinned || options.ttl < 0) {
+            return steady_clock::time_point::max();
+        }
+        return record.checked +
+               std::chrono::duration_cast<steady_clock::duration>(
+                   std::chrono::duration<double>(options.ttl));
+    }
+
+    // Merge the metadata the store returned for a cached asset, the lock
+    // must be held. A newer version is fetched again, a fetch in flight
+    // finds out about it in end_fetch.
+    void apply_head(Item& item, Entry& entry) {
+        Record& record = item.second;
+        record.checked = steady_clock::now();
+        if (entry.state == CACHE_MISSING) {
+            if (record.entry.state == CACHE_FETCHING) { return; }
+            account(item, false);
+            record.entry.state = CACHE_MISSING;
+            record.indexed = true;
+        } else if (entry.timestamp > record.entry.timestamp ||
+                   (!entry.etag.empty() && !record.entry.etag.empty() &&
+                    entry.etag != record.entry.etag)) {
+            ++counters.changes;
+            if (record.entry.state == CACHE_FETCHED) {
+                account(item, false);
+                record.entry.state = CACHE_NEEDS_FETCHING;
+            }
+            record.indexed = true;
+            record.entry.timestamp = entry.timestamp;
+            record.entry.size = entry.size;
+            record.entry.etag = entry.etag;
+        }
+        publish(item);
+    }
+
+    // Bring resolved_paths in line with a record, the lock must be held.
+    // Only fetched records can be current without asking the store.
+    void publish(Item& item) {
+        Record& record = item.second;
+        if (record.entry.state == CACHE_MISSING) {
+            resolved_paths.erase(item.first);
+            return;
+        }
+        typename ResolvedPaths::accessor accessor;
+        resolved_paths.insert(accessor, item.first);
+        accessor->second.local_path = record.entry.local_path;
+        accessor->second.record = &record;
+        accessor->second.valid_until = record.entry.state == CACHE_FETCHED
+                                           ? valid_until(record)
+                                           : steady_clock::time_point::min();
+    }
+
+    // The local path of a record is handed out, a copy in the list moves
+    // to the front. The lock must be held.
+    void touch(Item& item) {
+        mark_used(item.second);
+        if (!is_listed(item)) { return; }
+        unlist(item);
+        list_front(item);
+    }
+
+    // Also called without the lock, the flag is only written when it
+    // changes so hits don't bounce its cache line between cores
+    static void mark_used(Record& record) {
+        if (!record.used.load(std::memory_order_relaxed)) {
+            record.used.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    bool is_listed(const Item& item) const {
+        return item.second.newer != nullptr || lru_newest == &item;
+    }
+
+    void list_front(Item& item) {
+        item.second.newer = nullptr;
+        item.second.older = lru_newest;
+        if (lru_newest != nullptr) {
+            lru_newest->second.newer = &item;
+        } else {
+            lru_oldest = &item;
+        }
+        lru_newest = &item;
+        ++lru_count;
+    }
+
+    void unlist(Item& item) {
+        Record& record = item.second;
+        (record.newer != nullptr ? record.newer->second.older : lru_newest) =
+            record.older;
+        (record.older != nullptr ? record.older->second.newer : lru_oldest) =
+            record.newer;
+        record.newer = record.older = nullptr;
+        --lru_count;
+    }
+
+    // Count the local copy of a fetched record in or out of cached_bytes and
+    // the list, the lock must be held
+    void account(Item& item, bool add) {
+        const Record& record = item.second;
+        if (record.entry.state != CACHE_FETCHED) { return; }
+        if (add) {
+            cached_bytes += record.entry.size;
+            if (!is_listed(item)) { list_front(item); }
+        } else {
+            cached_bytes -= std::min(cached_bytes, record.entry.size);
+            if (is_listed(item)) { unlist(item); }
+        }
+    }
+
+    // Remove the least recently used local copies until they fit in
+    // max_bytes, except the one of keep. USD may still be reading a copy
+    // handed out since the last pass, it gets a second chance and moves to
+    // the front instead, so the cache may stay over max_bytes until the
+    // copies go unused. Each pass visits a copy at most once. The lock must
+    // be held.
+    void evict(const std::string& keep) {
+        if (options.max_bytes == 0 || cached_bytes <= options.max_bytes) {
+            return;
+        }
+        Item* item = lru_oldest;
+        for (size_t visits = lru_count;
+             visits > 0 && item != nullptr && cached_bytes > options.max_bytes;
+             --visits) {
+            Item& victim = *item;
+            item = victim.second.newer;
+            Record& record = victim.second;
+            if (victim.first == keep) { continue; }
+            if (record.used.exchange(false, std::memory_order_relaxed)) {
+                unlist(victim);
+                list_front(victim);
+                continue;
+            }
+            account(victim, false);
+            remove(record.entry.local_path.c_str());
+            record.entry.state = CACHE_NEEDS_FETCHING;
+            record.indexed = true;
+            publish(victim);
+            ++counters.evictions;
+        }
+    }
+
+    std::string get_index_path() const {
+        return options.index_root + "/" + options.index_name;
+    }
+
+    double read_index(std::map<std::string, Entry>& entries) {
+        if (options.index_root.empty()) { return INVALID_TIME; }
+        std::ifstream index(get_index_path());
+        std::string line;
+        if (!std::getline(index, line) ||
+            line.compare(0, strlen(INDEX_FORMAT), INDEX_FORMAT) != 0) {
+            return INVALID_TIME;
+        }
+        const double mark = atof(line.c_str() + strlen(INDEX_FORMAT));
+        while (std::getline(index, line)) {
+            size_t tabs[4];
+            size_t position = 0;
+            bool complete = true;
+            for (auto& tab : tabs) {
+                tab = line.find('\t', position);
+                if (tab == std::string::npos) {
+                    complete = false;
+                    break;
+                }
+                position = tab + 1;
+            }
+            if (!complete) { continue; }
+            const auto key = line.substr(tabs[3] + 1);
+            entries[key] = Entry{
+                CACHE_FETCHED,
+                backend.local_path(key),
+                atof(line.c_str()),
+                strtoull(line.c_str() + tabs[0] + 1, nullptr, 10),
+                line.substr(tabs[2] + 1, tabs[3] - tabs[2] - 1),
+                line[tabs[1] + 1] == '1'};
+        }
+        return mark;
+    }
+
+    static bool make_dirs(const std::string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) { return S_ISDIR(st.st_mode); }
+        const auto slash = path.find_last_of('/');
+        if (slash != std::string::npos && slash > 0 &&
+            !make_dirs(path.substr(0, slash))) {
+            return false;
+        }
+        // another process may have created it in the meantime
+        return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+    }
+
+    Backend& backend;
+    const Options options;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed; // a request for an asset finished
+    Records records;
+    ResolvedPaths resolved_paths;
+    Item* lru_newest; // the list of records holding a local copy
+    Item* lru_oldest;
+    size_t lru_count;
+    uint64_t cached_bytes;
+    Counters counters;
+
+    // Background revalidation, see Options::revalidate_threads
+    std::condition_variable queued;
+    std::deque<std::string> revalidate_queue;
+    std::vector<std::thread> workers;
+    bool stopping;
+};
+
+template <class Backend>
+constexpr const char* CacheEngine<Backend>::INDEX_FORMAT;
+} // namespace usd_cache
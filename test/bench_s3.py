@@ -0,0 +1,265 @@
+"""
+Benchmark the USD S3 resolver against a local S3 stand-in
+
+Generates a set of synthetic stages, serves them with s3_standin.py and
+measures, for every stage:
+- cold open: empty local cache, fresh process
+- warm open: populated local cache, fresh process
+- reload: Stage.Reload in the same process
+- refresh + reload: RefreshContext followed by Stage.Reload
+together with the number of requests and bytes the resolver needed.
+
+When --benchmark points at the usd_s3_benchmark binary, its resolve/fetch
+throughput versus thread count runs against the same stand-in, or with
+--mock against the resolver's in-process mock object store, which removes
+the network and the stand-in from the measurement.
+
+Generation is deterministic, so the same arguments always produce the same
+objects. Keep --root around to avoid regenerating large crates.
+
+Copyright (c) 2018 Western Digital Corporation or its affiliates.
+SPDX-License-Identifier: MIT
+"""
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+try:
+    from urllib.request import urlopen, Request
+except ImportError:
+    from urllib2 import urlopen, Request
+
+STANDIN = os.path.join(os.path.dirname(os.path.abspath(__file__)), 's3_standin.py')
+STANDIN_ENV_VAR = 'USD_S3_BENCH_STANDIN'
+
+
+def write_layer(path, text):
+    """Write a usda layer, creating the directory if needed"""
+    if not os.path.isdir(os.path.dirname(path)):
+        os.makedirs(os.path.dirname(path))
+    with open(path, 'w') as f:
+        f.write('#usda 1.0\n' + text)
+
+
+def generate_small(bucket_root, url, count):
+    """A root layer referencing count small layers"""
+    prims = []
+    for i in range(count):
+        write_layer(os.path.join(bucket_root, 'small', 'layer_{0:05d}.usda'.format(i)),
+                    'def Xform "Layer"\n{{\n    double3 xformOp:translate = ({0}, 0, 0)\n'
+                    '    uniform token[] xformOpOrder = ["xformOp:translate"]\n}}\n'.format(i))
+        prims.append('    def "Ref_{0:05d}" (\n        references = @{1}/small/layer_{0:05d}.usda@\n'
+                     '    )\n    {{\n    }}\n'.format(i, url))
+    write_layer(os.path.join(bucket_root, 'small', 'root.usda'),
+                'def Xform "World"\n{\n' + ''.join(prims) + '}\n')
+
+
+def generate_crates(bucket_root, url, count, size_mb):
+    """A root layer referencing count crate files of size_mb each"""
+    from pxr import Sdf, Vt #pylint: disable=import-error
+    points = max(1, size_mb * (1 << 20) // 12)
+    prims = []
+    for i in range(count):
+        path = os.path.join(bucket_root, 'crate', 'crate_{0}.usdc'.format(i))
+        if not os.path.isdir(os.path.dirname(path)):
+            os.makedirs(os.path.dirname(path))
+        layer = Sdf.Layer.CreateNew(path)
+        prim = Sdf.CreatePrimInLayer(layer, '/Crate')
+        prim.specifier = Sdf.SpecifierDef
+        prim.typeName = 'Points'
+        attr = Sdf.AttributeSpec(prim, 'points', Sdf.ValueTypeNames.Point3fArray)
+        attr.default = Vt.Vec3fArray(points)
+        layer.Save()
+        prims.append('    def "Crate_{0}" (\n        references = @{1}/crate/crate_{0}.usdc@\n'
+                     '    )\n    {{\n    }}\n'.format(i, url))
+    write_layer(os.path.join(bucket_root, 'crate', 'root.usda'),
+                'def Xform "World"\n{\n' + ''.join(prims) + '}\n')
+
+
+def generate_deep(bucket_root, url, depth):
+    """A chain of depth sublayers, each one only discovered after the previous"""
+    for i in range(depth):
+        sublayer = '(\n    subLayers = [@{0}/deep/layer_{1:03d}.usda@]\n)\n'.format(
+            url, i + 1) if i + 1 < depth else ''
+        write_layer(os.path.join(bucket_root, 'deep', 'layer_{0:03d}.usda'.format(i)),
+                    '{0}\ndef "Deep_{1:03d}"\n{{\n}}\n'.format(sublayer, i))
+
+
+def generate(args):
+    """Generate all stages below args.root, unless they already exist"""
+    bucket_root = os.path.join(args.root, args.bucket)
+    url = 's3://' + args.bucket
+    stamp = os.path.join(args.root, 'generated.json')
+    settings = {'bucket': args.bucket, 'small': args.small, 'crates': args.crates,
+                'crate_size_mb': args.crate_size_mb, 'depth': args.depth}
+    if os.path.isfile(stamp):
+        with open(stamp) as f:
+            if json.load(f) == settings:
+                return
+    if os.path.isdir(bucket_root):
+        shutil.rmtree(bucket_root)
+    print('Generating stages in', bucket_root)
+    generate_small(bucket_root, url, args.small)
+    generate_crates(bucket_root, url, args.crates, args.crate_size_mb)
+    generate_deep(bucket_root, url, args.depth)
+    with open(stamp, 'w') as f:
+        json.dump(settings, f)
+
+
+def standin_request(path, method='GET'):
+    """Talk to the stand-in's own endpoints"""
+    request = Request('http://' + os.environ[STANDIN_ENV_VAR] + path,
+                      data=b'' if method == 'POST' else None)
+    response = urlopen(request)
+    body = response.read()
+    return json.loads(body.decode('utf-8')) if body else None
+
+
+def measure(name, function):
+    """Run function and return its duration with the stand-in counters"""
+    standin_request('/_standin/reset', 'POST')
+    start = time.time()
+    function()
+    seconds = time.time() - start
+    stats = standin_request('/_standin/stats')
+    return dict(phase=name, seconds=seconds, **stats)
+
+
+def open_stage(asset):
+    """Child process: open, reload and refresh+reload a single stage"""
+    from pxr import Usd, Ar #pylint: disable=import-error
+    resolver = Ar.GetResolver() #pylint: disable=no-member
+    resolver.ConfigureResolverForAsset(asset)
+    stages = []
+    results = [measure('open', lambda: stages.append(Usd.Stage.Open(asset)))] #pylint: disable=no-member
+    results.append(measure('reload', lambda: stages[0].Reload()))
+
+    def refresh_reload():
+        resolver.RefreshContext(resolver.GetCurrentContext())
+        stages[0].Reload()
+    results.append(measure('refresh+reload', refresh_reload))
+    print(json.dumps(results))
+
+
+def run_child(asset, env):
+    """Open a stage in a fresh process, so every run starts without state"""
+    output = subprocess.check_output(
+        [sys.executable, os.path.abspath(__file__), '--open', asset], env=env)
+    return json.loads(output.decode('utf-8').strip().splitlines()[-1])
+
+
+def print_results(results):
+    """Print a table with one line per stage and phase"""
+    row = '{0:<18} {1:<20} {2:>9} {3:>7} {4:>7} {5:>7} {6:>12}'
+    print(row.format('stage', 'phase', 'seconds', 'HEAD', 'GET', '304', 'bytes'))
+    for result in results:
+        requests = result['requests']
+        print(row.format(
+            result['stage'], result['phase'], '{0:.3f}'.format(result['seconds']),
+            requests.get('HEAD', 0), requests.get('GET', 0) + requests.get('RANGE_GET', 0),
+            requests.get('GET_304', 0), result['bytes_out']))
+
+
+def main():
+    """Benchmark the resolver"""
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[1])
+    parser.add_argument('--root', help='directory for the generated objects, '
+                        'a temporary directory by default')
+    parser.add_argument('--bucket', default='usd-s3-bench')
+    parser.add_argument('--small', type=int, default=2000, help='number of small layers')
+    parser.add_argument('--crates', type=int, default=4, help='number of large crates')
+    parser.add_argument('--crate-size-mb', type=int, default=64)
+    parser.add_argument('--depth', type=int, default=64, help='depth of the sublayer stack')
+    parser.add_argument('--latency-ms', type=float, default=0.0,
+                        help='latency the stand-in adds to every request')
+    parser.add_argument('--threads', type=int, default=16,
+                        help='highest thread count for --benchmark')
+    parser.add_argument('--benchmark', help='path to the usd_s3_benchmark binary')
+    parser.add_argument('--mock', action='store_true',
+                        help='run --benchmark against the in-process mock object store')
+    parser.add_argument('--bandwidth-mb', type=float, default=0.0,
+                        help='bandwidth cap of the mock object store in MB/s')
+    parser.add_argument('--prefetch', type=int, default=0,
+                        help='number of dependency prefetch threads of the resolver (USD_S3_PREFETCH)')
+    parser.add_argument('--plugin-path', help='directory containing the resolver plugInfo.json')
+    parser.add_argument('--json', help='also write the results to this file')
+    parser.add_argument('--open', help=argparse.SUPPRESS)
+    args, benchmark_args = parser.parse_known_args()
+
+    if args.open:
+        open_stage(args.open)
+        return
+
+    keep_root = args.root is not None
+    root = args.root or tempfile.mkdtemp(prefix='usd_s3_bench_')
+    args.root = root
+    generate(args)
+    cache_path = os.path.join(root, 'cache')
+
+    standin = subprocess.Popen(
+        [sys.executable, STANDIN, '--root', root, '--latency-ms', str(args.latency_ms)],
+        stdout=subprocess.PIPE)
+    try:
+        endpoint = standin.stdout.readline().decode('utf-8').strip()
+        env = dict(os.environ)
+        env.update({
+            'USD_S3_ENDPOINT': endpoint,
+            'USD_S3_CACHE_PATH': cache_path,
+            STANDIN_ENV_VAR: endpoint,
+            'AWS_ACCESS_KEY_ID': 'standin',
+            'AWS_SECRET_ACCESS_KEY': 'standin',
+            'AWS_EC2_METADATA_DISABLED': 'true',
+            'USD_S3_BENCH_BUCKET': args.bucket,
+            'USD_S3_BENCH_SMALL': str(args.small),
+            'USD_S3_BENCH_CRATES': str(args.crates),
+            'USD_S3_BENCH_THREADS': str(args.threads),
+            'USD_S3_PREFETCH': str(args.prefetch)})
+        if args.plugin_path:
+            env['PXR_PLUGINPATH_NAME'] = args.plugin_path
+        os.environ[STANDIN_ENV_VAR] = endpoint
+
+        results = []
+        stages = [('small', 'small/root.usda'), ('crate', 'crate/root.usda'),
+                  ('deep', 'deep/layer_000.usda')]
+        for stage, key in stages:
+            asset = 's3://{0}/{1}'.format(args.bucket, key)
+            if os.path.isdir(cache_path):
+                shutil.rmtree(cache_path)
+            for run in ('cold', 'warm'):
+                for result in run_child(asset, env):
+                    result['stage'] = stage
+                    result['phase'] = '{0} {1}'.format(run, result['phase'])
+                    results.append(result)
+        print_results(results)
+
+        if args.benchmark:
+            if args.mock:
+                env.update({
+                    'USD_S3_BACKEND': 'mock',
+                    'USD_S3_MOCK_ROOT': root,
+                    'USD_S3_MOCK_LATENCY_MS': str(args.latency_ms),
+                    'USD_S3_MOCK_BANDWIDTH_MB': str(args.bandwidth_mb)})
+            standin_request('/_standin/reset', 'POST')
+            subprocess.check_call([args.benchmark] + benchmark_args, env=env)
+            if not args.mock:
+                print('stand-in totals:', json.dumps(standin_request('/_standin/stats')))
+
+        if args.json:
+            with open(args.json, 'w') as f:
+                json.dump(results, f, indent=2)
+    finally:
+        standin.terminate()
+        standin.wait()
+        if not keep_root:
+            shutil.rmtree(root)
+
+
+if __name__ == "__main__":
+    main()
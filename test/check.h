@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The behaviour tests are plain executables run by ctest. CHECK reports a
+// failed condition and carries on, main returns check_result().
+namespace usd_test {
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void check(
+    bool condition, const char* text, const char* file, int line) {
+    if (condition) { return; }
+    std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, text);
+    ++failures();
+}
+
+inline int check_result() {
+    if (failures() > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// A fresh directory below TMPDIR for the files of a test
+inline std::string make_temp_dir(const std::string& name) {
+    const auto tmp = getenv("TMPDIR");
+    std::string path =
+        std::string(tmp == nullptr ? "/tmp" : tmp) + "/" + name + ".XXXXXX";
+    if (mkdtemp(&path[0]) == nullptr) {
+        std::perror("mkdtemp");
+        std::exit(EXIT_FAILURE);
+    }
+    return path;
+}
+
+inline void write_file(const std::string& path, const std::string& data) {
+    std::ofstream(path, std::ios::out | std::ios::binary | std::ios::trunc)
+        << data;
+}
+
+inline bool file_exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+} // namespace usd_test
+
+#define CHECK(condition) \
+    ::usd_test::check((condition), #condition, __FILE__, __LINE__)
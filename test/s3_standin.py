@@ -0,0 +1,300 @@
+"""
+Local S3 compatible stand-in for testing and benchmarking the S3 resolver
+
+Serves the files below a root directory as objects with path style
+addressing, i.e. s3://bucket/some/key.usd is <root>/bucket/some/key.usd.
+Only the subset of the S3 API used by the resolver is supported:
+HEAD, GET (If-Modified-Since, If-None-Match, Range), ListObjectsV2 and PUT.
+Authentication is not checked.
+
+Every request is counted. The counters can be read with
+GET /_standin/stats and cleared with POST /_standin/reset.
+
+Copyright (c) 2018 Western Digital Corporation or its affiliates.
+SPDX-License-Identifier: MIT
+"""
+from __future__ import print_function
+
+import argparse
+import email.utils
+import hashlib
+import json
+import os
+import sys
+import threading
+import time
+
+try:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+    from socketserver import ThreadingMixIn
+    from urllib.parse import urlparse, parse_qs, unquote
+except ImportError:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+    from SocketServer import ThreadingMixIn
+    from urlparse import urlparse, parse_qs
+    from urllib import unquote
+
+STATS_PATH = '/_standin/stats'
+RESET_PATH = '/_standin/reset'
+CHUNK_SIZE = 1 << 20
+MAX_KEYS = 1000
+
+
+class Stats(object):
+    """Request and byte counters, shared by all handler threads"""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reset()
+
+    def reset(self):
+        with self.lock:
+            self.requests = {}
+            self.bytes_in = 0
+            self.bytes_out = 0
+
+    def add(self, name, bytes_in=0, bytes_out=0):
+        with self.lock:
+            self.requests[name] = self.requests.get(name, 0) + 1
+            self.bytes_in += bytes_in
+            self.bytes_out += bytes_out
+
+    def as_dict(self):
+        with self.lock:
+            return {'requests': dict(self.requests),
+                    'bytes_in': self.bytes_in,
+                    'bytes_out': self.bytes_out}
+
+
+class StandinServer(ThreadingMixIn, HTTPServer):
+    """Threaded HTTP server holding the object root and the counters"""
+    daemon_threads = True
+
+    def __init__(self, address, root, latency):
+        HTTPServer.__init__(self, address, StandinHandler)
+        self.root = os.path.abspath(root)
+        self.latency = latency
+        self.stats = Stats()
+        self.etags = {}
+        self.etags_lock = threading.Lock()
+
+    def etag(self, path, stat):
+        """md5 of a file, cached on path, size and modification time"""
+        key = (path, stat.st_size, stat.st_mtime)
+        with self.etags_lock:
+            if key in self.etags:
+                return self.etags[key]
+        md5 = hashlib.md5()
+        with open(path, 'rb') as f:
+            for chunk in iter(lambda: f.read(CHUNK_SIZE), b''):
+                md5.update(chunk)
+        etag = '"{0}"'.format(md5.hexdigest())
+        with self.etags_lock:
+            self.etags[key] = etag
+        return etag
+
+
+class StandinHandler(BaseHTTPRequestHandler):
+    """Maps S3 requests onto the files below the server root"""
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, *args): #pylint: disable=arguments-differ
+        pass
+
+    def _parse(self):
+        url = urlparse(self.path)
+        bucket, _, key = unquote(url.path).lstrip('/').partition('/')
+        query = dict((k, v[0]) for k, v in parse_qs(url.query, True).items())
+        return bucket, key, query
+
+    def _local_path(self, bucket, key):
+        path = os.path.normpath(os.path.join(self.server.root, bucket, key))
+        # never serve anything outside of the root
+        if not path.startswith(self.server.root + os.sep):
+            return None
+        return path
+
+    def _reply(self, code, body=b'', headers=None):
+        self.send_response(code)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        if self.command != 'HEAD':
+            self.wfile.write(body)
+        return len(body)
+
+    def _error(self, code, error_code, message):
+        body = ('<?xml version="1.0" encoding="UTF-8"?>\n'
+                '<Error><Code>{0}</Code><Message>{1}</Message></Error>'
+                .format(error_code, message)).encode('utf-8')
+        return self._reply(code, body, {'Content-Type': 'application/xml'})
+
+    def _object_headers(self, path, stat):
+        return {'Last-Modified': email.utils.formatdate(stat.st_mtime, usegmt=True),
+                'ETag': self.server.etag(path, stat),
+                'Accept-Ranges': 'bytes'}
+
+    def _not_modified(self, headers, stat):
+        if_none_match = self.headers.get('If-None-Match')
+        if if_none_match is not None:
+            return if_none_match == headers['ETag']
+        if_modified_since = self.headers.get('If-Modified-Since')
+        if if_modified_since is not None:
+            parsed = email.utils.parsedate_tz(if_modified_since)
+            if parsed is not None:
+                return int(stat.st_mtime) <= email.utils.mktime_tz(parsed)
+        return False
+
+    def _send_file(self, path, stat, headers):
+        offset, length, code = 0, stat.st_size, 200
+        ranges = self.headers.get('Range')
+        if ranges is not None and ranges.startswith('bytes='):
+            first, _, last = ranges[6:].partition('-')
+            offset = int(first) if first else max(0, stat.st_size - int(last))
+            end = int(last) if first and last else stat.st_size - 1
+            end = min(end, stat.st_size - 1)
+            if offset > end:
+                return self._error(416, 'InvalidRange', 'Range not satisfiable')
+            length, code = end - offset + 1, 206
+            headers['Content-Range'] = 'bytes {0}-{1}/{2}'.format(
+                offset, end, stat.st_size)
+        self.send_response(code)
+        for name, value in headers.items():
+            self.send_header(name, value)
+        self.send_header('Content-Length', str(length))
+        self.end_headers()
+        if self.command == 'HEAD':
+            return 0
+        with open(path, 'rb') as f:
+            f.seek(offset)
+            remaining = length
+            while remaining > 0:
+                chunk = f.read(min(CHUNK_SIZE, remaining))
+                if not chunk:
+                    break
+                self.wfile.write(chunk)
+                remaining -= len(chunk)
+        return length
+
+    def _list(self, bucket, query):
+        bucket_root = self._local_path(bucket, '')
+        if bucket_root is None or not os.path.isdir(bucket_root):
+            return self._error(404, 'NoSuchBucket', bucket)
+        prefix = query.get('prefix', '')
+        keys = []
+        for dirpath, _, filenames in os.walk(bucket_root):
+            for filename in filenames:
+                key = os.path.relpath(os.path.join(dirpath, filename), bucket_root)
+                key = key.replace(os.sep, '/')
+                if key.startswith(prefix):
+                    keys.append(key)
+        keys.sort()
+        start = int(query.get('continuation-token', '0'))
+        page = keys[start:start + MAX_KEYS]
+        truncated = start + MAX_KEYS < len(keys)
+        contents = []
+        for key in page:
+            path = os.path.join(bucket_root, key)
+            stat = os.stat(path)
+            contents.append(
+                '<Contents><Key>{0}</Key><LastModified>{1}</LastModified>'
+                '<ETag>{2}</ETag><Size>{3}</Size></Contents>'.format(
+                    key,
+                    time.strftime('%Y-%m-%dT%H:%M:%S.000Z', time.gmtime(stat.st_mtime)),
+                    self.server.etag(path, stat).replace('"', '&quot;'),
+                    stat.st_size))
+        body = ('<?xml version="1.0" encoding="UTF-8"?>\n'
+                '<ListBucketResult><Name>{0}</Name><Prefix>{1}</Prefix>'
+                '<KeyCount>{2}</KeyCount><MaxKeys>{3}</MaxKeys>'
+                '<IsTruncated>{4}</IsTruncated>{5}{6}</ListBucketResult>'.format(
+                    bucket, prefix, len(page), MAX_KEYS,
+                    'true' if truncated else 'false',
+                    '<NextContinuationToken>{0}</NextContinuationToken>'.format(
+                        start + MAX_KEYS) if truncated else '',
+                    ''.join(contents))).encode('utf-8')
+        return self._reply(200, body, {'Content-Type': 'application/xml'})
+
+    def _read_body(self):
+        length = int(self.headers.get('Content-Length', '0'))
+        return self.rfile.read(length) if length > 0 else b''
+
+    def do_HEAD(self): #pylint: disable=invalid-name
+        self._handle_get('HEAD')
+
+    def do_GET(self): #pylint: disable=invalid-name
+        if self.path == STATS_PATH:
+            self._reply(200, json.dumps(self.server.stats.as_dict()).encode('utf-8'),
+                        {'Content-Type': 'application/json'})
+            return
+        self._handle_get('GET')
+
+    def _handle_get(self, name):
+        if self.server.latency > 0:
+            time.sleep(self.server.latency)
+        bucket, key, query = self._parse()
+        if not key and query.get('list-type') == '2':
+            self.server.stats.add('LIST', bytes_out=self._list(bucket, query))
+            return
+        path = self._local_path(bucket, key)
+        if path is None or not os.path.isfile(path):
+            self.server.stats.add(name, bytes_out=self._error(404, 'NoSuchKey', key))
+            return
+        stat = os.stat(path)
+        headers = self._object_headers(path, stat)
+        if name == 'GET' and self._not_modified(headers, stat):
+            self.server.stats.add('GET_304', bytes_out=self._reply(304, headers=headers))
+            return
+        if name == 'GET' and 'Range' in self.headers:
+            name = 'RANGE_GET'
+        self.server.stats.add(name, bytes_out=self._send_file(path, stat, headers))
+
+    def do_POST(self): #pylint: disable=invalid-name
+        if self.path == RESET_PATH:
+            self._read_body()
+            self.server.stats.reset()
+            self._reply(204)
+            return
+        self._error(501, 'NotImplemented', self.path)
+
+    def do_PUT(self): #pylint: disable=invalid-name
+        if self.server.latency > 0:
+            time.sleep(self.server.latency)
+        bucket, key, _ = self._parse()
+        path = self._local_path(bucket, key)
+        body = self._read_body()
+        if path is None or not key:
+            self._error(400, 'InvalidArgument', key)
+            return
+        if not os.path.isdir(os.path.dirname(path)):
+            os.makedirs(os.path.dirname(path))
+        temp_path = '{0}.{1}.part'.format(path, threading.current_thread().ident)
+        with open(temp_path, 'wb') as f:
+            f.write(body)
+        os.rename(temp_path, path)
+        self.server.stats.add('PUT', bytes_in=len(body))
+        self._reply(200, headers={'ETag': self.server.etag(path, os.stat(path))})
+
+
+def main():
+    """Run the stand-in until interrupted"""
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[1])
+    parser.add_argument('--root', required=True, help='directory holding the buckets')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=0, help='0 picks a free port')
+    parser.add_argument('--latency-ms', type=float, default=0.0,
+                        help='delay added to every object request')
+    args = parser.parse_args()
+
+    server = StandinServer((args.host, args.port), args.root, args.latency_ms / 1000.0)
+    # the benchmark driver reads the endpoint from the first line
+    print('{0}:{1}'.format(*server.server_address))
+    sys.stdout.flush()
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,229 @@
+#include "cache_engine.h"
+#include "check.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+using usd_cache::CACHE_FETCHED;
+using usd_cache::CACHE_MISSING;
+using usd_cache::CACHE_NEEDS_FETCHING;
+using usd_cache::CacheEngine;
+using usd_cache::Entry;
+using usd_cache::Options;
+using usd_test::file_exists;
+
+// Objects held in memory, keyed like the cache. Downloads take a while, so
+// that concurrent fetches of an asset overlap.
+class MemoryBackend {
+public:
+    explicit MemoryBackend(const std::string& root) : root(root), gets(0) {}
+
+    void put(
+        const std::string& key, const std::string& data, double timestamp) {
+        objects[key] = std::make_pair(data, timestamp);
+    }
+
+    std::string local_path(const std::string& key) { return root + "/" + key; }
+
+    bool head(const std::string& key, Entry& entry) {
+        const auto object = objects.find(key);
+        if (object == objects.end()) {
+            entry.state = CACHE_MISSING;
+            return true;
+        }
+        entry.timestamp = object->second.second;
+        entry.size = object->second.first.size();
+        entry.etag =
+            key + std::to_string(static_cast<int>(object->second.second));
+        return true;
+    }
+
+    bool get(const std::string& key, Entry& entry) {
+        ++gets;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if (!head(key, entry) || entry.state == CACHE_MISSING) { return false; }
+        const auto slash = entry.local_path.find_last_of('/');
+        mkdir(entry.local_path.substr(0, slash).c_str(), 0777);
+        usd_test::write_file(entry.local_path, objects[key].first);
+        entry.state = CACHE_FETCHED;
+        return true;
+    }
+
+    bool list(const std::string&, std::map<std::string, Entry>&) {
+        return false;
+    }
+
+    const std::string root;
+    std::atomic<int> gets;
+
+private:
+    std::map<std::string, std::pair<std::string, double>> objects;
+};
+
+Options make_options(
+    const std::string& index_root, uint64_t max_bytes, bool trust_index) {
+    return Options{
+        index_root, ".test_index", -1.0, max_bytes, trust_index, 0};
+}
+
+// Threads fetching the same asset share a single download
+void test_single_flight() {
+    MemoryBackend backend(usd_test::make_temp_dir("cache_single_flight"));
+    backend.put("asset", std::string(100, 'a'), 1.0);
+    CacheEngine<MemoryBackend> cache(backend, make_options("", 0, false));
+    CHECK(cache.resolve("asset") == backend.root + "/asset");
+
+    std::atomic<int> fetched(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&]() {
+            if (cache.fetch("asset")) { ++fetched; }
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    CHECK(fetched == 8);
+    CHECK(backend.gets == 1);
+    CHECK(cache.metrics().fetches == 1);
+    CHECK(file_exists(backend.root + "/asset"));
+
+    // assets that weren't resolved aren't fetched
+    CHECK(!cache.fetch("unresolved"));
+    CHECK(backend.gets == 1);
+}
+
+// The least recently used copies go first, but not the ones handed out
+// since the last eviction pass
+void test_eviction() {
+    MemoryBackend backend(usd_test::make_temp_dir("cache_eviction"));
+    for (const auto key : {"a", "b", "c", "d"}) {
+        backend.put(key, std::string(10, key[0]), 1.0);
+    }
+    CacheEngine<MemoryBackend> cache(backend, make_options("", 25, false));
+    for (const auto key : {"a", "b", "c"}) {
+        cache.resolve(key);
+        CHECK(cache.fetch(key));
+    }
+    // every copy was handed out since, the first pass spares them
+    CHECK(cache.metrics().evictions == 0);
+    CHECK(cache.metrics().cached_bytes == 30);
+
+    // a is resolved again without taking the lock, b is left alone
+    cache.resolve("a");
+    cache.resolve("d");
+    CHECK(cache.fetch("d"));
+    CHECK(cache.metrics().evictions == 1);
+    CHECK(file_exists(backend.root + "/a"));
+    CHECK(!file_exists(backend.root + "/b"));
+    CHECK(file_exists(backend.root + "/c"));
+    CHECK(file_exists(backend.root + "/d"));
+
+    // an evicted asset is fetched again on its next use
+    Entry entry;
+    CHECK(cache.lookup("b", entry) && entry.state == CACHE_NEEDS_FETCHING);
+    const int gets = backend.gets;
+    CHECK(cache.fetch("b"));
+    CHECK(backend.gets == gets + 1);
+    CHECK(file_exists(backend.root + "/b"));
+}
+
+// The index brings the fetched assets of a process back in the next one
+void test_index_round_trip() {
+    MemoryBackend backend(usd_test::make_temp_dir("cache_index"));
+    backend.put("a", "first", 1.0);
+    backend.put("dir/b", "second", 2.0);
+    const auto index_root = backend.root + "/index";
+    {
+        CacheEngine<MemoryBackend> cache(
+            backend, make_options(index_root, 0, false));
+        for (const auto key : {"a", "dir/b"}) {
+            cache.resolve(key);
+            CHECK(cache.fetch(key));
+        }
+        cache.save_index(42.0);
+    }
+
+    CacheEngine<MemoryBackend> checked(
+        backend, make_options(index_root, 0, false));
+    CHECK(checked.load_index() == 42.0);
+    Entry entry;
+    CHECK(checked.lookup("a", entry));
+    // without trust_index the store is asked again
+    CHECK(entry.state == CACHE_NEEDS_FETCHING);
+    CHECK(entry.local_path == backend.root + "/a");
+    CHECK(entry.timestamp == 1.0);
+    CHECK(entry.size == 5);
+    CHECK(entry.etag == "a1");
+    CHECK(checked.lookup("dir/b", entry));
+    CHECK(entry.timestamp == 2.0 && entry.size == 6 && entry.etag == "dir/b2");
+
+    CacheEngine<MemoryBackend> trusted(
+        backend, make_options(index_root, 0, true));
+    CHECK(trusted.load_index() == 42.0);
+    CHECK(trusted.lookup("a", entry) && entry.state == CACHE_FETCHED);
+    CHECK(trusted.metrics().cached_bytes == 11);
+
+    // entries whose local copy went away are skipped
+    remove((backend.root + "/a").c_str());
+    CacheEngine<MemoryBackend> reloaded(
+        backend, make_options(index_root, 0, true));
+    reloaded.load_index();
+    CHECK(!reloaded.lookup("a", entry));
+    CHECK(reloaded.lookup("dir/b", entry));
+}
+
+// A process only replaces or removes the index entries of the assets it
+// fetched or found out of date
+void test_index_merge() {
+    MemoryBackend backend(usd_test::make_temp_dir("cache_index_merge"));
+    backend.put("a", "first", 1.0);
+    backend.put("b", "second", 1.0);
+    const auto index_root = backend.root + "/index";
+    {
+        CacheEngine<MemoryBackend> cache(
+            backend, make_options(index_root, 0, false));
+        cache.resolve("a");
+        CHECK(cache.fetch("a"));
+        cache.save_index(10.0);
+    }
+    {
+        // only resolves a, which another process fetched
+        CacheEngine<MemoryBackend> cache(
+            backend, make_options(index_root, 0, false));
+        cache.resolve("a");
+        cache.resolve("b");
+        CHECK(cache.fetch("b"));
+        cache.save_index(20.0);
+    }
+    Entry entry;
+    {
+        CacheEngine<MemoryBackend> cache(
+            backend, make_options(index_root, 0, true));
+        // the older mark is kept
+        CHECK(cache.load_index() == 10.0);
+        CHECK(cache.lookup("a", entry) && entry.state == CACHE_FETCHED);
+        CHECK(cache.lookup("b", entry) && entry.state == CACHE_FETCHED);
+        // a newer version of a makes the indexed copy outdated
+        cache.update("a", 2.0, 5, "a2");
+        cache.save_index(10.0);
+    }
+    CacheEngine<MemoryBackend> cache(
+        backend, make_options(index_root, 0, true));
+    cache.load_index();
+    CHECK(!cache.lookup("a", entry));
+    CHECK(cache.lookup("b", entry));
+}
+} // namespace
+
+int main() {
+    test_single_flight();
+    test_eviction();
+    test_index_round_trip();
+    test_index_merge();
+    return usd_test::check_result();
+}
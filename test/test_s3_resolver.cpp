@@ -0,0 +1,269 @@
+#include "cache_engine.h"
+#include "concurrency.h"
+#include "daemon.h"
+#include "object_store.h"
+#include "s3.h"
+#include "scheduler.h"
+
+#include "check.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The S3 resolver against the mock object store, see mock_store.cpp. The
+// environment is set up once, the S3 instances of a process share their
+// object store and cache.
+namespace {
+using usd_test::file_exists;
+
+std::string store_root;
+std::string cache_root;
+
+void put_object(const std::string& key, const std::string& data) {
+    usd_test::write_file(store_root + "/bucket/" + key, data);
+}
+
+std::string cached_path(const std::string& key) {
+    return cache_root + "/bucket/" + key;
+}
+
+// A daemon in a child process, started before the test starts threads
+pid_t start_daemon(const std::string& socket_path) {
+    const pid_t pid = fork();
+    if (pid == 0) { _exit(usd_s3::run_daemon(socket_path)); }
+    usd_s3::DaemonClient client(socket_path);
+    std::string reply;
+    for (int attempt = 0; attempt < 200 && !client.request({"ping"}, reply);
+         ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(25));
+    }
+    return pid;
+}
+
+// A prefetch waiting for its slot moves to the demand class when USD asks
+// for the same asset
+void test_scheduler_promotion() {
+    usd_s3::FetchScheduler scheduler(1, 1);
+    std::promise<void> held;
+    std::promise<void> release;
+    std::thread holder([&]() {
+        usd_s3::FetchScheduler::Slot slot(
+            scheduler, "held", usd_s3::PRIORITY_PREFETCH);
+        held.set_value();
+        release.get_future().wait();
+    });
+    held.get_future().wait();
+
+    auto waiting = std::async(std::launch::async, [&]() {
+        usd_s3::FetchScheduler::Slot slot(
+            scheduler, "promoted", usd_s3::PRIORITY_PREFETCH);
+    });
+    const auto wait = std::chrono::milliseconds(100);
+    CHECK(waiting.wait_for(wait) == std::future_status::timeout);
+    scheduler.promote("other");
+    CHECK(waiting.wait_for(wait) == std::future_status::timeout);
+    scheduler.promote("promoted");
+    // starts while the prefetch slot is still held
+    CHECK(
+        waiting.wait_for(std::chrono::seconds(5)) ==
+        std::future_status::ready);
+    release.set_value();
+    holder.join();
+}
+
+// Only congestion lowers the request limit of a bucket, missing objects and
+// denied access don't
+void test_request_limit() {
+    usd_s3::ConcurrencyController controller(8, 25);
+    // large transfers, so their latency plays no part
+    const uint64_t bytes = 16 << 20;
+    for (const auto status : {usd_s3::STORE_NOT_FOUND, usd_s3::STORE_ERROR}) {
+        for (int i = 0; i < 16; ++i) {
+            usd_s3::ConcurrencyController::Permit(controller, "bucket")
+                .done(status, bytes);
+        }
+    }
+    CHECK(controller.metrics()["bucket"].limit == 8);
+    CHECK(controller.metrics()["bucket"].throttled == 0);
+
+    usd_s3::ConcurrencyController::Permit(controller, "bucket")
+        .done(usd_s3::STORE_TIMEOUT, bytes);
+    CHECK(controller.metrics()["bucket"].limit == 4);
+    CHECK(controller.metrics()["bucket"].throttled == 1);
+}
+
+// Ranges are read as asked, an empty one without a request
+void test_range_get() {
+    const auto store = usd_s3::create_mock_store();
+    const usd_s3::ObjectRequest request{"bucket", "a.usd", std::string()};
+    std::string data = "stale";
+    usd_s3::ObjectInfo info{};
+    CHECK(store->range_get(request, 0, 0, data, info).is_success());
+    CHECK(data.empty());
+    const uint64_t size = 400 * 1024;
+    CHECK(store->range_get(request, size - 3, 16, data, info).is_success());
+    CHECK(data == "aaa");
+    CHECK(info.size == size);
+}
+
+// Requests go to the daemon while it runs and to an in-process cache once
+// it went away
+void test_daemon_fallback(usd_s3::S3& s3, pid_t daemon) {
+    // only the owner may ask the daemon to upload files
+    struct stat socket_stat;
+    CHECK(stat(getenv(usd_s3::DAEMON_SOCKET_ENV_VAR), &socket_stat) == 0);
+    CHECK((socket_stat.st_mode & 0777) == 0600);
+
+    const std::string served = "s3://bucket/daemon.usda";
+    const auto served_path = s3.resolve_name(served);
+    CHECK(served_path == cached_path("daemon.usda"));
+    CHECK(s3.fetch_asset(served, served_path));
+    CHECK(file_exists(served_path));
+    // the counters are the daemon's
+    CHECK(s3.get_metrics().fetches == 1);
+    // tabs and newlines in paths survive the protocol
+    const std::string escaped = "s3://bucket/tab\tnew\nline\\.usda";
+    CHECK(s3.resolve_name(escaped) == cached_path("tab\tnew\nline\\.usda"));
+    // resolved, but USD only fetches it once the daemon is gone
+    const std::string adopted = "s3://bucket/adopted.usda";
+    const auto adopted_path = s3.resolve_name(adopted);
+
+    kill(daemon, SIGTERM);
+    int status = 0;
+    CHECK(waitpid(daemon, &status, 0) == daemon);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    const std::string local = "s3://bucket/local.usda";
+    const auto local_path = s3.resolve_name(local);
+    CHECK(local_path == cached_path("local.usda"));
+    CHECK(s3.fetch_asset(local, local_path));
+    CHECK(file_exists(local_path));
+    // the counters are the ones of this process now
+    CHECK(s3.get_metrics().fetches == 1);
+    // the copy the daemon fetched is still served
+    CHECK(s3.resolve_name(served) == served_path);
+
+    // assets resolved through the daemon are fetched in process
+    CHECK(!file_exists(adopted_path));
+    CHECK(s3.fetch_asset(adopted, adopted_path));
+    CHECK(file_exists(adopted_path));
+    CHECK(s3.get_timestamp(adopted) > 1.0);
+    CHECK(s3.get_metrics().fetches == 2);
+}
+
+// A daemon that doesn't answer in time isn't taken for one that went away
+void test_daemon_timeout(const std::string& socket_path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(
+        address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    const auto bound = bind(
+        listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    CHECK(bound == 0);
+    CHECK(listen(listener, 1) == 0);
+
+    usd_s3::DaemonClient client(socket_path, 1);
+    std::string reply;
+    bool timed_out = false;
+    const auto start = std::chrono::steady_clock::now();
+    CHECK(!client.request({"ping"}, reply, &timed_out));
+    CHECK(timed_out);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+    close(listener);
+    unlink(socket_path.c_str());
+    CHECK(!client.request({"ping"}, reply, &timed_out));
+    CHECK(!timed_out);
+}
+
+// Threads fetching the same asset share a single download
+void test_single_flight(usd_s3::S3& s3) {
+    const std::string asset = "s3://bucket/single.usda";
+    const auto local_path = s3.resolve_name(asset);
+    const auto fetches = s3.get_metrics().fetches;
+    std::atomic<int> fetched(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&]() {
+            if (s3.fetch_asset(asset, local_path)) { ++fetched; }
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    CHECK(fetched == 8);
+    CHECK(s3.get_metrics().fetches == fetches + 1);
+    CHECK(file_exists(local_path));
+}
+
+// Over USD_S3_CACHE_SIZE_MB the least recently used copies are removed,
+// except the ones handed out since the last pass
+void test_eviction(usd_s3::S3& s3) {
+    for (const auto key : {"a.usd", "b.usd", "c.usd"}) {
+        const auto asset = std::string("s3://bucket/") + key;
+        CHECK(s3.fetch_asset(asset, s3.resolve_name(asset)));
+    }
+    for (const auto key : {"a.usd", "b.usd", "c.usd"}) {
+        CHECK(file_exists(cached_path(key)));
+    }
+
+    s3.resolve_name("s3://bucket/a.usd");
+    const std::string asset = "s3://bucket/d.usd";
+    CHECK(s3.fetch_asset(asset, s3.resolve_name(asset)));
+    CHECK(s3.get_metrics().evictions > 0);
+    CHECK(s3.get_metrics().cached_bytes <= 3 * 400 * 1024 + 4096);
+    CHECK(file_exists(cached_path("a.usd")));
+    CHECK(!file_exists(cached_path("b.usd")));
+    CHECK(file_exists(cached_path("c.usd")));
+    CHECK(file_exists(cached_path("d.usd")));
+}
+} // namespace
+
+int main() {
+    const auto root = usd_test::make_temp_dir("s3_resolver");
+    store_root = root + "/store";
+    cache_root = root + "/cache";
+    mkdir(store_root.c_str(), 0777);
+    mkdir((store_root + "/bucket").c_str(), 0777);
+    for (const auto key :
+         {"daemon.usda", "adopted.usda", "local.usda", "single.usda"}) {
+        put_object(key, "#usda 1.0\n");
+    }
+    for (const auto key : {"a.usd", "b.usd", "c.usd", "d.usd"}) {
+        put_object(key, std::string(400 * 1024, key[0]));
+    }
+    setenv(usd_s3::BACKEND_ENV_VAR, "mock", 1);
+    setenv(usd_s3::MOCK_ROOT_ENV_VAR, store_root.c_str(), 1);
+    setenv(usd_s3::MOCK_LATENCY_ENV_VAR, "20", 1);
+    setenv(usd_s3::CACHE_PATH_ENV_VAR, cache_root.c_str(), 1);
+    setenv(usd_s3::CACHE_SIZE_ENV_VAR, "1", 1);
+    setenv(usd_s3::TTL_ENV_VAR, "-1", 1);
+    const auto socket_path = root + "/daemon.sock";
+    setenv(usd_s3::DAEMON_SOCKET_ENV_VAR, socket_path.c_str(), 1);
+
+    const pid_t daemon = start_daemon(socket_path);
+    test_scheduler_promotion();
+    test_request_limit();
+    test_range_get();
+    test_daemon_timeout(root + "/silent.sock");
+    {
+        usd_s3::S3 s3;
+        test_daemon_fallback(s3, daemon);
+        test_single_flight(s3);
+        test_eviction(s3);
+    }
+    return usd_test::check_result();
+}
@@ -0,0 +1,104 @@
+#include "codec.h"
+#include "check.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace {
+// Compressible, but not a single repeated byte
+std::string make_data(size_t size) {
+    std::string data;
+    data.reserve(size);
+    for (size_t i = 0; data.size() < size; ++i) {
+        data += "#usda 1.0\ndef Xform \"prim_" + std::to_string(i % 97) +
+                "\" {}\n";
+    }
+    data.resize(size);
+    return data;
+}
+
+// Feed the encoder and decoder pieces of the given sizes, so that frames
+// and blocks are split across writes
+bool encode(
+    const std::string& encoding, const std::string& data, size_t piece,
+    std::string& encoded) {
+    auto encoder = usd_sql::create_encoder(encoding, 0);
+    if (encoder == nullptr) { return false; }
+    const usd_sql::Sink sink = [&](const char* bytes, size_t size) {
+        encoded.append(bytes, size);
+        return true;
+    };
+    for (size_t offset = 0; offset < data.size(); offset += piece) {
+        const auto size = std::min(piece, data.size() - offset);
+        if (!encoder->write(data.data() + offset, size, sink)) {
+            return false;
+        }
+    }
+    return encoder->finish(sink);
+}
+
+bool decode(
+    const std::string& encoding, const std::string& encoded, size_t piece,
+    std::string& decoded) {
+    auto decoder = usd_sql::create_decoder(encoding);
+    if (decoder == nullptr) { return false; }
+    const usd_sql::Sink sink = [&](const char* bytes, size_t size) {
+        decoded.append(bytes, size);
+        return true;
+    };
+    for (size_t offset = 0; offset < encoded.size(); offset += piece) {
+        const auto size = std::min(piece, encoded.size() - offset);
+        if (!decoder->write(encoded.data() + offset, size, sink)) {
+            return false;
+        }
+    }
+    return decoder->finish();
+}
+
+void test_round_trip(const std::string& encoding) {
+    for (const size_t size : {0, 1, 4096, 3 << 20}) {
+        const auto data = make_data(size);
+        std::string encoded;
+        CHECK(encode(encoding, data, 64 * 1024, encoded));
+        std::string decoded;
+        CHECK(decode(encoding, encoded, 4093, decoded));
+        CHECK(decoded == data);
+    }
+}
+
+// A frame cut short is an error, not a shorter asset
+void test_truncated(const std::string& encoding) {
+    std::string encoded;
+    CHECK(encode(encoding, make_data(100000), 100000, encoded));
+    encoded.resize(encoded.size() / 2);
+    std::string decoded;
+    CHECK(!decode(encoding, encoded, encoded.size(), decoded));
+}
+
+// A sink returning false stops the decoder
+void test_stopped(const std::string& encoding) {
+    std::string encoded;
+    CHECK(encode(encoding, make_data(100000), 100000, encoded));
+    auto decoder = usd_sql::create_decoder(encoding);
+    CHECK(!decoder->write(
+        encoded.data(), encoded.size(),
+        [](const char*, size_t) { return false; }));
+}
+} // namespace
+
+int main() {
+    CHECK(usd_sql::create_decoder("unknown") == nullptr);
+    CHECK(usd_sql::create_encoder("unknown", 0) == nullptr);
+    // the empty encoding stores the data as is
+    test_round_trip("");
+
+    std::istringstream encodings(usd_sql::supported_encodings());
+    std::string encoding;
+    while (encodings >> encoding) {
+        test_round_trip(encoding);
+        test_stopped(encoding);
+        if (encoding != "raw") { test_truncated(encoding); }
+    }
+    return usd_test::check_result();
+}